@@ -31,7 +31,7 @@
 	#include "hardware/arm/HW_ARM.h"
 #endif
 
-LCD5110::LCD5110(/*int SCK, int MOSI, int DC, int RST, int CS*/)
+LCD5110::LCD5110(/*int SCK, int MOSI, int DC,*/ uint8_t RST/*, int CS*/)
 { 
 	//P_SCK	= portOutputRegister(digitalPinToPort(SCK));
 	//B_SCK	= digitalPinToBitMask(SCK);
@@ -40,7 +40,7 @@ LCD5110::LCD5110(/*int SCK, int MOSI, int DC, int RST, int CS*/)
 	P_DC	= &PORTC;
 	B_DC	= 1<<PC0;
 	P_RST	= &PORTB;
-	B_RST	= 1<<PB2;
+	B_RST	= 1<<RST;
 	P_CS	= &PORTB;
 	B_CS	= 1<<PB0;
 	//pinMode(SCK,OUTPUT);
@@ -77,7 +77,7 @@ struct _current_font
 class LCD5110
 {
 	public:
-		LCD5110();
+		LCD5110(uint8_t RST);
 		void InitLCD(int contrast=LCD_CONTRAST);
 		void setContrast(int contrast);
 //		void enableSleep();
@@ -0,0 +1,79 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+
+sub usage
+{
+  my $msg = shift || '';
+  print <<"END";
+check_fixed_regs.pl - check that only out.c uses the registers reserved
+for the sample interrupt
+Usage: perl check_fixed_regs.pl "2 3 4" out.nm siggen.dis
+
+out.nm is the output of 'avr-nm --defined-only' for out.o,
+siggen.dis is the output of 'avr-objdump -d' for the linked program.
+
+$msg
+END
+  exit(1);
+}
+
+my $regs_list = $ARGV[0];
+my $nm_fn = $ARGV[1];
+my $dis_fn = $ARGV[2];
+defined $regs_list or usage('No register list specified');
+$nm_fn or usage('No symbol file specified');
+$dis_fn or usage('No disassembly file specified');
+
+my %reserved = map { $_ => 1 } split ' ', $regs_list;
+
+# Functions defined in out.c are allowed to use the reserved registers
+open my $nfh, "<", $nm_fn or usage("Cannot open symbol file '$nm_fn': $!");
+my %allowed;
+while (<$nfh>)
+{
+  if (/^[0-9a-f]+\s+[Tt]\s+(\S+)/)
+  {
+    $allowed{$1} = 1;
+  }
+}
+close $nfh;
+
+open my $dfh, "<", $dis_fn or usage("Cannot open disassembly file '$dis_fn': $!");
+my $function = '';
+my $errors = 0;
+while (<$dfh>)
+{
+  chomp;
+  if (/^[0-9a-f]+ <(.+)>:$/)
+  {
+    $function = $1;
+    next;
+  }
+
+  # e.g. "  2e4:	0f 92       	push	r0"
+  next unless /^\s*([0-9a-f]+):\t[0-9a-f ]+\t(\S+)\s*([^;]*)/;
+  my ($address, $mnemonic, $operands) = ($1, $2, $3);
+  next if $allowed{$function};
+
+  my @used;
+  while ($operands =~ /\br(\d+)\b/g)
+  {
+    push @used, $1;
+    # movw names only the first register of each pair
+    push @used, $1 + 1 if $mnemonic eq 'movw';
+  }
+  if (grep { $reserved{$_} } @used)
+  {
+    print "0x$address <$function>: $mnemonic $operands\n";
+    $errors++;
+  }
+}
+close $dfh;
+
+if ($errors)
+{
+  print "$errors instructions outside out.c use the reserved registers\n";
+  exit(1);
+}
+print "No code outside out.c uses the reserved registers\n";
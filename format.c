@@ -35,10 +35,15 @@ void FORMAT_cat_int8(char*s, int8_t n)
 }
 
 void FORMAT_cat_uint8(char*s, uint8_t n)
+{
+  FORMAT_cat_uint16(s, n);
+}
+
+void FORMAT_cat_uint16(char*s, uint16_t n)
 {
   uint8_t num_digits;
   uint8_t i;
-  uint8_t next_n;
+  uint16_t next_n;
 
   // Find the end of the string
   while (*s != 0)
@@ -47,7 +52,15 @@ void FORMAT_cat_uint8(char*s, uint8_t n)
   }
 
   // Work out the number of digits
-  if (n > 99)
+  if (n > 9999)
+  {
+    num_digits = 5;
+  }
+  else if (n > 999)
+  {
+    num_digits = 4;
+  }
+  else if (n > 99)
   {
     num_digits = 3;
   }
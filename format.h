@@ -9,6 +9,8 @@ void FORMAT_cat_int8(char* s, int8_t n);
 
 void FORMAT_cat_uint8(char* s, uint8_t n);
 
+void FORMAT_cat_uint16(char* s, uint16_t n);
+
 uint8_t FORMAT_cat_uint32(char* s, uint32_t n, int8_t chars);
 
 #ifdef __cplusplus
@@ -0,0 +1,219 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+use POSIX qw(floor);
+
+sub usage
+{
+  my $msg = shift || '';
+  print <<"END";
+gen_waves.pl - create the waveform tables for out.c
+Usage: perl gen_waves.pl min_bits max_bits dac_bits output.c [cutoff_hz at_hz]
+
+Creates half-wave sine and triangle tables for each table length
+from 2^min_bits to 2^max_bits samples per cycle, which out.c
+expands into a full cycle in SRAM: one set with the shape from
+-127 to 127, which out.c scales to the amplitude, and one already
+in steps of the dac_bits-wide R-2R DAC, for full amplitude.
+Also creates 256-sample quarter-wave sine and triangle tables
+that the sample ISR reads from flash directly (OUT_FLASH_TABLE).
+
+With cutoff_hz, the triangle tables are pre-compensated for an RC
+filter with that -3 dB frequency on the output, so that the triangle
+at at_hz comes out of the filter with its harmonics as they should be.
+A sine wave only has the one, so the sine tables are left as they are.
+
+$msg
+END
+  exit(1);
+}
+
+my $min_bits = $ARGV[0];
+my $max_bits = $ARGV[1];
+my $dac_bits = $ARGV[2];
+my $out_fn = $ARGV[3];
+my $cutoff_hz = $ARGV[4] || 0;
+my $at_hz = $ARGV[5] || 0;
+defined $min_bits or usage('No minimum table length specified');
+defined $max_bits or usage('No maximum table length specified');
+defined $dac_bits or usage('No DAC width specified');
+$out_fn or usage('No output file specified');
+($min_bits >= 2) && ($min_bits <= $max_bits) && ($max_bits <= 8)
+  or usage('Table lengths must be between 2^2 and 2^8');
+($dac_bits >= 2) && ($dac_bits <= 8)
+  or usage('The DAC must be 2 to 8 bits wide');
+($cutoff_hz >= 0) && (($cutoff_hz == 0) || ($at_hz > 0))
+  or usage('The RC filter needs a cutoff and a frequency to compensate at');
+
+my $header_fn = $out_fn;
+$header_fn =~ s/\.c$/.h/;
+
+my $pi = 4 * atan2(1, 1);
+
+# DAC steps either side of the centre at full amplitude, as DAC_AMPL in out.c
+my $dac_ampl = 2 ** ($dac_bits - 1) - 1;
+
+my $filter = $cutoff_hz ? "RC filter at $cutoff_hz Hz, compensated at $at_hz Hz" : 'none';
+
+my $text = <<"END";
+// Generated by gen_waves.pl
+// Table lengths: 2^$min_bits to 2^$max_bits samples
+// DAC width: $dac_bits bits
+// Pre-compensation: $filter
+
+#include <avr/pgmspace.h>
+
+#include "$header_fn"
+
+#if (OUT_MIN_WAVEFORM_LENGTH_BITS != $min_bits) || (OUT_MAX_WAVEFORM_LENGTH_BITS != $max_bits)
+  #error $out_fn was generated for different table lengths, run make clean
+#endif
+
+#if OUT_DAC_BITS != $dac_bits
+  #error $out_fn was generated for a different DAC width, run make clean
+#endif
+
+#if !OUT_FLASH_TABLE
+
+// The half-wave table for a table length of n samples
+// starts at n/2 - 2^$min_bits/2 and has n/2 entries.
+// Entry i is 127 * f((i + 0.5) / n) for a cycle of f from 0 to 1,
+// so the full cycle is made by inverting the half.
+END
+my $triangle = $cutoff_hz ? \&compensated_triangle : \&triangle;
+$text .= half_table('WAVES_half_sine', sub { sin(2 * $pi * $_[0]) }, 127);
+$text .= half_table('WAVES_half_triangle', $triangle, 127);
+
+$text .= <<"END";
+
+#if OUT_DAC_TABLES
+
+// The same in DAC steps from the centre at full amplitude:
+// entry i is $dac_ampl * f((i + 0.5) / n), rounded once.
+END
+$text .= half_table('WAVES_dac_half_sine', sub { sin(2 * $pi * $_[0]) }, $dac_ampl);
+$text .= half_table('WAVES_dac_half_triangle', $triangle, $dac_ampl);
+$text .= "\n#endif\n";
+
+$text .= <<"END";
+
+#else
+
+// Quarter-wave tables for a 256-sample cycle, for phase p = 0 to 64.
+// Entry p is 255 * f(2 * pi * p / 256), including both ends,
+// so the ISR can mirror the quarter about p = 64 and p = 128.
+END
+$text .= flash_table('WAVES_flash_sine', sub { sin(2 * $pi * $_[0] / 256) });
+$text .= flash_table('WAVES_flash_triangle', sub { $_[0] / 64 });
+$text .= "\n#endif\n";
+
+open my $ofh, ">", $out_fn or usage("Cannot create output file '$out_fn': $!");
+print $ofh $text;
+close $ofh;
+
+open my $hofh, ">", $header_fn or usage("Cannot create header file '$header_fn': $!");
+print $hofh <<"END";
+// Generated by gen_waves.pl
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "out.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const int8_t WAVES_half_sine[] PROGMEM;
+extern const int8_t WAVES_half_triangle[] PROGMEM;
+extern const int8_t WAVES_dac_half_sine[] PROGMEM;
+extern const int8_t WAVES_dac_half_triangle[] PROGMEM;
+extern const uint8_t WAVES_flash_sine[65] PROGMEM;
+extern const uint8_t WAVES_flash_triangle[65] PROGMEM;
+
+#ifdef __cplusplus
+}
+#endif
+END
+close($hofh);
+exit(0);
+
+# Triangle rising through 0 at the start of the cycle, as sin
+sub triangle
+{
+  my $t = shift;
+  my $n = shift;
+
+  return ($t < 0.25) ? 4 * $t : 2 - 4 * $t;
+}
+
+# The harmonics of the triangle up to half the sample rate, each
+# boosted and advanced in phase as much as the RC filter cuts and
+# delays it at at_hz, so that what comes out of the filter is the
+# triangle. The peaks are higher, so the table is scaled down to fit,
+# and out of the filter the triangle is that much smaller.
+sub compensated_triangle
+{
+  my $t = shift;
+  my $n = shift;
+  my $sum = 0;
+
+  for (my $k = 1; $k < $n / 2; $k += 2)
+  {
+    my $ratio = $k * $at_hz / $cutoff_hz;
+    my $b = 8 / ($pi * $pi * $k * $k) * ((($k - 1) / 2) % 2 ? -1 : 1);
+    $sum += $b * sqrt(1 + $ratio * $ratio) * sin(2 * $pi * $k * $t + atan2($ratio, 1));
+  }
+  return $sum;
+}
+
+sub half_table
+{
+  my $name = shift;
+  my $f = shift;
+  my $ampl = shift;
+
+  my $text = "const int8_t $name"."[] PROGMEM =\n{\n";
+  for my $bits ($min_bits .. $max_bits)
+  {
+    my $n = 2 ** $bits;
+    my @values;
+    my $peak = 1;
+    for my $i (0 .. $n/2 - 1)
+    {
+      push @values, $f->(($i + 0.5) / $n, $n);
+    }
+    for my $value (@values)
+    {
+      $peak = abs($value) if abs($value) > $peak;
+    }
+    @values = map { floor($ampl * $_ / $peak + 0.5) } @values;
+    $text .= "  // $n samples\n";
+    while (@values)
+    {
+      $text .= "  ".join(", ", splice(@values, 0, 8)).",\n";
+    }
+  }
+  $text .= "};\n";
+  return $text;
+}
+
+sub flash_table
+{
+  my $name = shift;
+  my $f = shift;
+
+  my @values;
+  for my $p (0 .. 64)
+  {
+    push @values, int(255 * $f->($p) + 0.5);
+  }
+
+  my $text = "const uint8_t $name"."[65] PROGMEM =\n{\n";
+  while (@values)
+  {
+    $text .= "  ".join(", ", splice(@values, 0, 8)).",\n";
+  }
+  $text .= "};\n";
+  return $text;
+}
@@ -1,8 +1,16 @@
 #include <avr/io.h>
 
+#include "out.h"
 #include "lcd.h"
 
-LCD5110 myGLCD;
+// Reset line on PORTB, moved off PB2 when that's OC1B (OUT_CHANNEL_B)
+#if OUT_CHANNEL_B
+#define LCD_RST_BIT PB6
+#else
+#define LCD_RST_BIT PB2
+#endif
+
+LCD5110 myGLCD(LCD_RST_BIT);
 
 void LCD_init(void)
 {
@@ -14,7 +22,7 @@ void LCD_init(void)
   SPCR = (1<<SPE)|(1<<MSTR)|(1<<CPOL)|(1<<CPHA) | (1<<SPR0);
 
   /* Set the pins for DC, RST and CS to output */
-  DDRB |= (1<<PB0) | (1<<PB2);
+  DDRB |= (1<<PB0) | (1<<LCD_RST_BIT);
   DDRC |= (1<<PC0);
 
   myGLCD.InitLCD(0x46);
@@ -1,54 +1,115 @@
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #include "ui.h"
 #include "out.h"
 #include "store.h"
+#include "plan.h"
+#include "retune.h"
+#include "upload.h"
+#include "waves.h"
 
-// The period in clock cycles from frequency in mHz
-// is p = F_CPU / (f / 1000) i.e. p = (1000 * F_CPU) / f
-// but 1000 * F_CPU may overflow a 32-bit integer
-// so find the smallest power of 2 k such that 
-// (1000/k) * F_CPU does not overflow
-// i.e. (1000/k) * F_CPU < 0xFFFFFFFF
-// or (1000/k) < 0xFFFFFFFF/F_CPU
-// Then p = (1000/k * F_CPU) / (f/k)
-#if 1000 < 0xFFFFFFFF/F_CPU
-  #define F_CPU_MUL 1000
-  #define F_OUT_DIV 1
-#elif 500 < 0xFFFFFFFF/F_CPU 
-  #define F_CPU_MUL 500
-  #define F_OUT_DIV 2
-#elif 250 < 0xFFFFFFFF/F_CPU
-  #define F_CPU_MUL 250
-  #define F_OUT_DIV 4
-#elif 125 < 0xFFFFFFFF/F_CPU 
-  #define F_CPU_MUL 125
-  #define F_OUT_DIV 8
-#else
-  #error Cannot compute frequency scaling parameters
-#endif
-
-// 5-bit R-2R DAC
-#define DAC_CENTRE 16
-#define DAC_AMPL   15
-
-#define WAVEFORM_LENGTH 32
-
-#define SIN__1_OVER_32_PI  0.09802 /* sin(pi *  1/32) */
-#define SIN__3_OVER_32_PI  0.29028 /* sin(pi *  3/32) */
-#define SIN__5_OVER_32_PI  0.47140 /* sin(pi *  5/32) */
-#define SIN__7_OVER_32_PI  0.63439 /* sin(pi *  7/32) */
-#define SIN__9_OVER_32_PI  0.77301 /* sin(pi *  9/32) */
-#define SIN_11_OVER_32_PI  0.88192 /* sin(pi * 11/32) */
-#define SIN_13_OVER_32_PI  0.95694 /* sin(pi * 13/32) */
-#define SIN_15_OVER_32_PI  0.99518 /* sin(pi * 15/32) */
-
-static uint8_t on;
+// R-2R DAC of OUT_DAC_BITS on PD0 upwards. The sample ISR writes the
+// whole of PORTD, so the lines above it are written 0.
+#define DAC_CENTRE (1 << (OUT_DAC_BITS - 1))
+#define DAC_AMPL   (DAC_CENTRE - 1)
+#define DAC_PINS   ((uint8_t)((1 << OUT_DAC_BITS) - 1))
+
+// RXD is PD0, the DAC's lowest line, so with OUT_UPLOAD the USART stops
+// receiving before the DAC lines become outputs. upload.c starts it again
+// once they're inputs.
+#if OUT_UPLOAD
+#define DAC_PINS_OUT() do { UPLOAD_stop(); DDRD |= DAC_PINS; } while (0)
+#else
+#define DAC_PINS_OUT() (DDRD |= DAC_PINS)
+#endif
+
+// What the waveform table holds about. With OUT_PWM_DAC it's OCR1A,
+// OC1A being high for OCR1A + 1 of the OUT_PWM_DAC_LEVELS clocks of
+// each Timer1 period, from 1 to all but 1 of them.
+#if OUT_PWM_DAC
+#define TABLE_CENTRE (OUT_PWM_DAC_LEVELS / 2 - 1)
+#define TABLE_AMPL   TABLE_CENTRE
+#else
+#define TABLE_CENTRE DAC_CENTRE
+#define TABLE_AMPL   DAC_AMPL
+#endif
+
+#define MAX_WAVEFORM_LENGTH (1<<OUT_MAX_WAVEFORM_LENGTH_BITS)
+
+#if OUT_FIXED_REGS && !OUT_ISR_ASM
+  #error OUT_FIXED_REGS needs the assembly sample ISR (OUT_ISR_ASM)
+#endif
+
+#if OUT_FLASH_TABLE && OUT_FIXED_REGS
+  #error OUT_FLASH_TABLE is not available with OUT_FIXED_REGS
+#endif
+
+#if OUT_TWO_TONE && (!OUT_DDS || OUT_FIXED_REGS || OUT_FLASH_TABLE)
+  #error OUT_TWO_TONE needs OUT_DDS, and not OUT_FIXED_REGS or OUT_FLASH_TABLE
+#endif
+
+#if OUT_FLASH_TABLE && (OUT_MAX_WAVEFORM_LENGTH_BITS != 8)
+  #error OUT_FLASH_TABLE needs OUT_MAX_WAVEFORM_LENGTH_BITS = 8
+#endif
+
+#if OUT_SHAPING && (OUT_FIXED_REGS || OUT_FLASH_TABLE || OUT_TWO_TONE)
+  #error OUT_SHAPING is not available with OUT_FIXED_REGS, OUT_FLASH_TABLE or OUT_TWO_TONE
+#endif
+
+#if OUT_PWM_DAC && (!OUT_DDS || OUT_FIXED_REGS || OUT_FLASH_TABLE || OUT_TWO_TONE || OUT_SHAPING)
+  #error OUT_PWM_DAC needs OUT_DDS, and not OUT_FIXED_REGS, OUT_FLASH_TABLE, OUT_TWO_TONE or OUT_SHAPING
+#endif
+
+#if OUT_PWM_DAC && OUT_GATE
+  #error OUT_PWM_DAC is not available with OUT_GATE, which needs compare A to itself
+#endif
+
+#if OUT_PWM_DAC && (OUT_PWM_DAC_LEVELS > 256)
+  #error OUT_PWM_DAC_LEVELS must be at most 256, for the table to hold OCR1A in a byte
+#endif
+
+#if OUT_UPLOAD && OUT_FLASH_TABLE
+  #error OUT_UPLOAD needs the table in SRAM, so not OUT_FLASH_TABLE
+#endif
+
+#if OUT_DDS
+  #if OUT_DDS_SAMPLE_CLOCKS < OUT_MIN_SAMPLE_CLOCKS
+    #error OUT_DDS_SAMPLE_CLOCKS does not leave enough time outside the sample ISR
+  #endif
+  #if (OUT_DDS_SAMPLE_CLOCKS % F_OUT_DIV) != 0
+    #error OUT_DDS_SAMPLE_CLOCKS must be a multiple of F_OUT_DIV
+  #endif
+#endif
+
+#if OUT_FIXED_REGS
+// Registers reserved for the sample ISR with -ffixed-r2 ... -ffixed-r9
+// (OUT_FIXED_REGS_LIST in the Makefile), so it never touches SRAM
+// for its state:
+//   r2      SREG while in the sample ISR
+//   r3      always zero, for carries (r1 isn't, during a multiply)
+//   r4:r5   waveform table base address
+//   r6      waveform table index (table engine)
+//   r7      waveform table index mask (table engine)
+//   r6-r9   DDS phase accumulator (DDS engine)
+// The ISR refers to them by name, so keep the two in step.
+// 'make check_fixed_regs' checks that nothing outside out.c uses them.
+register uint8_t isr_zero asm("r3");
+register uint8_t* table_base asm("r4");
+#if OUT_DDS
+register uint32_t dds_phase asm("r6");
+#else
+register uint8_t table_index asm("r6");
+register uint8_t table_mask asm("r7");
+#endif
+#endif
+
+static volatile uint8_t on;
 static uint8_t freq_mode = OUT_FREQ_MODE;
 static uint8_t waveform;
-static uint8_t duty_cycle = 50;
+static uint16_t duty_cycle = 500;   // in 0.1% steps
 static uint8_t amplitude = 100;
 static int8_t fine_cal;
 static int8_t medium_cal;
@@ -56,27 +117,349 @@ static int8_t medium_cal;
 static uint32_t period_ns;
 static uint32_t freq_mHz = 1000000;
 
-static uint8_t waveform_data[WAVEFORM_LENGTH];
+// Width of the high part of a pulse as set and as it came out,
+// and whether it fitted in the period in whole timer clocks
+static uint32_t pulse_width_ns = 1000;
+static uint32_t pulse_width_actual_ns = 1000;
+static uint8_t pulse_width_fits = 1;
+
+// ICR1 for the settings last handed to RETUNE_set,
+// which a new duty cycle is worked out from
+static uint16_t timer_top;
+
+// Value last set in the current frequency mode, and how far the
+// actual frequency or period ended up from it
+static uint32_t requested = 1000000;
+static uint16_t error_ppm;
+
+#if OUT_FLASH_TABLE
+// Quarter-wave table in flash for the current waveform, and the peak
+// deviation from DAC_CENTRE in 1/16ths of a DAC step.
+// The sample ISR works out each sample from these.
+static const uint8_t* volatile flash_table = WAVES_flash_sine;
+static volatile uint8_t flash_scale;
+#if !OUT_DDS
+// Step through the 256-sample cycle per sample, 256 / table length
+static volatile uint8_t flash_stride = 1;
+#endif
+#else
+static uint8_t waveform_data[MAX_WAVEFORM_LENGTH];
+#if OUT_SEQUENCE
+// A sequence keeps its sine here and its triangle in waveform_data,
+// both built before it starts, and switches the sample ISR between
+// them through table_base
+static uint8_t sequence_sine_data[MAX_WAVEFORM_LENGTH];
+#if !OUT_FIXED_REGS
+static uint8_t* volatile table_base = waveform_data;
+#endif
+#endif
+#endif
+
+// The waveform table holds 2^table_length_bits samples
+static uint8_t table_length_bits = OUT_MAX_WAVEFORM_LENGTH_BITS;
+#if !OUT_DDS && !OUT_FIXED_REGS && !OUT_FLASH_TABLE
+static volatile uint8_t table_mask = MAX_WAVEFORM_LENGTH - 1;
+#endif
+
+// Rate at which the sample ISR runs, or 0 for square waves
+static uint32_t sample_rate_mHz;
+
+#if OUT_DITHER
+// Square waves alternate between periods of dither_top + 1 and
+// dither_top + 2 clocks, the longer one whenever dither_acc
+// overflows as dither_fraction is added once per period
+static volatile uint16_t dither_top;
+static volatile uint16_t dither_fraction;
+static volatile uint16_t dither_acc;
+#endif
+
+#if OUT_POSTSCALE
+// Square waves below the prescaler's range count Timer1 periods
+// in the compare A ISR, which drives PB1 itself.
+// postscale_left periods are left in the current part of the cycle,
+// the low or high one (postscale_level), and the first postscale_longer
+// of them are one prescaled clock longer
+static PLAN_postscale_t postscale;
+static volatile uint16_t postscale_left;
+static volatile uint16_t postscale_longer;
+static volatile uint8_t postscale_level;
+
+// Non-zero while Timer1 is set up for the postscaler
+static uint8_t postscale_running;
+#endif
+
+#if OUT_CHANNEL_B
+// Second square wave output on OC1B, as set and as Timer1 is set up for
+static uint8_t channel_b = OUT_CHANNEL_B_OFF;
+static uint16_t channel_b_phase = 90;   // in degrees
+static uint16_t channel_b_duty = 500;   // in 0.1% steps
+static uint8_t timer_channel_b = OUT_CHANNEL_B_OFF;
+#endif
+
+#if OUT_GATE
+// What the compare A ISR gates: OC1A, the sample ISR, PB1 as driven by
+// the postscaler (at once, as it's in software anyway), or nothing, while
+// OC1B toggles against OC1A and stopping one would swap them over
+#define GATE_OC1A  0
+#define GATE_TABLE 1
+#define GATE_PB1   2
+#define GATE_FIXED 3
+
+// What the compare A ISR does at the next compare match
+#define GATE_IDLE  0   // nothing, the interrupt is off
+#define GATE_START 1   // start the output at the start of a cycle
+#define GATE_COUNT 2   // count down the cycles of a burst
+#define GATE_STOP  3   // stop the output at the end of a cycle
+
+// CPU cycles from reading TCNT1 to the write to TCCR1A, with room to spare
+#define GATE_MARGIN 32
+
+static uint8_t gate_mode = OUT_GATE_NONE;
+static uint16_t burst_cycles = 10;
+
+// gate_running is whether the output is on at the moment, and
+// gate_cycles_left counts the current cycle of a burst and those to come
+static volatile uint8_t gate_target;
+static volatile uint8_t gate_state;
+static volatile uint8_t gate_running;
+static volatile uint16_t gate_cycles_left;
+
+// OC1A can only be connected or disconnected in the low part of the
+// period, after the compare match and before TCNT1 gets near TOP, or it
+// would cut a cycle short. These bound that part in timer clocks, and
+// gate_margin is GATE_MARGIN in timer clocks, rounded up.
+static volatile uint16_t gate_compare;
+static volatile uint16_t gate_last_count;
+static uint16_t gate_margin;
+#endif
+
+#if OUT_SYNC
+// Restart the phase on a rising edge at the sync input: INT0 for square
+// waves and pulses, or the analog comparator for triangle and sine
+// waves, since PD2 is a DAC line then. sync_source is the one in use.
+#define SYNC_NONE       0
+#define SYNC_INT0       1
+#define SYNC_COMPARATOR 2
+
+static uint8_t sync_on;
+static uint8_t sync_source = SYNC_NONE;
+#endif
+
+#if OUT_SWEEP || OUT_SEQUENCE
+// One step of a sweep or segment of a sequence, ready to go into Timer1,
+// or with DDS the tuning word for triangle and sine waves
+typedef union
+{
+  struct
+  {
+    uint16_t top;
+    uint16_t compare;
+    uint8_t clock_select;
+  } timer;
+  uint32_t tuning_word;
+} timer_step_t;
+#endif
+
+#if OUT_SWEEP
+static uint8_t sweep_mode = OUT_SWEEP_OFF;
+static uint32_t sweep_stop_mHz = 10000;
+static uint8_t sweep_steps = OUT_SWEEP_MAX_STEPS;
+static uint16_t sweep_dwell_ms = 100;
+
+// The OUT_tick ISR only steps while sweep_running is set, which it isn't
+// while the steps are being worked out
+static timer_step_t sweep_table[OUT_SWEEP_MAX_STEPS];
+static volatile uint8_t sweep_running;
+static volatile uint8_t sweep_step;
+static uint16_t sweep_dwell_ticks;
+static volatile uint16_t sweep_ticks_left;
+#endif
+
+#if OUT_SEQUENCE
+typedef struct
+{
+  timer_step_t step;
+  uint8_t waveform;
+  uint16_t ticks;
+} sequence_segment_t;
+
+static uint8_t sequence_mode = OUT_SEQUENCE_OFF;
+
+// As for the sweep, OUT_tick only switches segments while
+// sequence_running is set
+static sequence_segment_t sequence_table[OUT_SEQUENCE_MAX_SEGMENTS];
+static uint8_t sequence_length;
+static volatile uint8_t sequence_running;
+static volatile uint8_t sequence_segment;
+static volatile uint16_t sequence_ticks_left;
+#if OUT_FLASH_TABLE
+// The quarter-wave the sample ISR is reading
+static uint8_t sequence_shape;
+#endif
+#if OUT_DDS
+static timer_step_t sequence_dds_timer;
+#endif
+#endif
+
+#if OUT_DDS
+// Phase accumulator, advanced by the tuning word once per sample.
+// The top OUT_MAX_WAVEFORM_LENGTH_BITS bits index waveform_data.
+#if !OUT_FIXED_REGS
+static volatile uint32_t dds_phase;
+#endif
+static volatile uint32_t dds_tuning_word;
+
+// Non-zero while Timer1 is set up for the fixed DDS sample rate
+static uint8_t dds_running;
+
+// Settings waveform_data was last computed for
+static uint8_t dds_table_waveform;
+static uint8_t dds_table_amplitude;
+#endif
+
+#if OUT_TWO_TONE
+// The second tone has a phase accumulator of its own, and waveform_data
+// holds the shape from -127 to 127 rather than DAC values. The sample
+// ISR scales each tone's lookup by its tone_scale, in 1/256ths of a DAC
+// step per unit of the shape, and adds them.
+static uint32_t tone2_freq_mHz = 1336000;
+static uint8_t tone2_amplitude;
+static volatile uint32_t dds_phase2;
+static volatile uint32_t dds_tuning_word2;
+static volatile uint8_t tone_scale[2];
+#endif
+
+#if OUT_SHAPING
+// The table holds each sample with SHAPING_BITS below the DAC's, and the
+// sample ISR adds on what was below them last time before dropping them.
+// With shaping off the table has them all 0, so nothing carries over.
+#define SHAPING_BITS     (8 - OUT_DAC_BITS)
+#define SHAPING_FRACTION ((1 << SHAPING_BITS) - 1)
+static volatile uint8_t shaping_error;
+static uint8_t shaping = 1;
+#endif
+
+#if OUT_UPLOAD
+// Working copy of the shape of OUT_ARBITRARY, one cycle from -127 to 127,
+// which waveform_data is built from as it is from the half-wave tables
+static int8_t arbitrary_data[MAX_WAVEFORM_LENGTH];
+#endif
+
+#if OUT_LFSR
+// Galois LFSR for noise, shifted right once per bit by the compare B ISR,
+// which flips in lfsr_taps when a 1 comes out. noise_level is what the
+// DAC gets for a 0 and for a 1.
+static volatile uint16_t lfsr_state = 1;
+static volatile uint16_t lfsr_taps;
+static volatile uint8_t noise_level[2];
+static uint8_t prbs = OUT_PRBS15;
+
+// Non-zero while the compare B ISR puts noise out, driving PB1 in place
+// of OC1A
+static uint8_t noise_running;
+
+// A bit for each term of the polynomial below x^n, x^k as bit k - 1
+static const uint16_t prbs_taps[OUT_PRBS_LAST + 1] PROGMEM =
+{
+  0x0060, 0x0110, 0x0500, 0x6000
+};
+#endif
 
+static uint8_t is_sampled(void);
 static void range_limit(uint32_t* n);
-static void recompute_waveform(void);
+static void update_error(void);
+static void recompute_waveform(uint8_t shape);
+#if OUT_CHANNEL_B
+static uint8_t channel_b_mode(void);
+static void set_channel_b_mode(uint8_t mode, uint8_t b_high);
+#endif
+#if OUT_POSTSCALE
+static void start_postscale(void);
+static void stop_postscale(void);
+#endif
+static void recompute(void);
+#if OUT_GATE
+static uint16_t gate_sample_compare(uint16_t top, uint8_t clock_select);
+static void gate_set_compare(uint16_t compare);
+static void gate_settle(void);
+static void gate_arm(uint8_t state);
+static void gate_follow_int0(void);
+static void gate_output(uint8_t run);
+#endif
+#if OUT_SYNC
+static void sync_settle(void);
+#endif
+#if OUT_GATE || OUT_SYNC
+static inline void restart_table(void);
+#endif
+#if OUT_SWEEP
+static void sweep_settle(void);
+static void sweep_commit(void);
+#endif
+#if OUT_SEQUENCE
+static void sequence_settle(void);
+static void sequence_commit(void);
+#endif
+#if OUT_DDS
+static void recompute_dds(uint32_t f_cpu);
+static uint32_t div_64_32(uint32_t hi, uint32_t lo, uint32_t d);
+static uint32_t div_1e12(uint32_t n);
+static uint32_t mul_high_32(uint32_t a, uint32_t b);
+#endif
+#if OUT_TWO_TONE
+static uint8_t tone_scale_for(uint8_t percent);
+#endif
+#if OUT_LFSR
+static void start_noise(void);
+static void stop_noise(void);
+#endif
 
 void OUT_init(void)
 {
+#if OUT_UPLOAD
+  uint8_t i;
+  int8_t value;
+#endif
+
   fine_cal = STORE_get_fine_cal();
   medium_cal = STORE_get_medium_cal();
 
+#if OUT_UPLOAD
+  /* Reading the stored shape straight into the working copy takes well
+     under a millisecond. Until one is uploaded it's a sine. */
+  if (!STORE_get_arbitrary(arbitrary_data))
+  {
+    for (i = 0; i < MAX_WAVEFORM_LENGTH/2; i++)
+    {
+      value = (int8_t)pgm_read_byte(&WAVES_half_sine[(MAX_WAVEFORM_LENGTH - (1<<OUT_MIN_WAVEFORM_LENGTH_BITS))/2 + i]);
+      arbitrary_data[i] = value;
+      arbitrary_data[MAX_WAVEFORM_LENGTH/2 + i] = -value;
+    }
+  }
+#endif
+
+#if OUT_FIXED_REGS
+  isr_zero = 0;
+  table_base = waveform_data;
+#if !OUT_DDS
+  table_index = 0;
+  table_mask = MAX_WAVEFORM_LENGTH - 1;
+#endif
+#endif
+
   /* Setup timer 1 in fast PWM mode,
      going low on compare match
-     with TOP=ICR1
-     and force output compare */
-  TCCR1A = (1<<FOC1A)|(1<<FOC1B)|(1<<WGM11)|(0<<WGM10)|(1<<COM1A1)|(0<<COM1A0);
+     with TOP=ICR1. Forcing an output compare
+     does nothing in a PWM mode. */
+  TCCR1A = (1<<WGM11)|(0<<WGM10)|(1<<COM1A1)|(0<<COM1A0);
   TCCR1B = (1<<WGM13)|(1<<WGM12);
 
+  /* OC1A is disconnected while the output is gated off */
+  PORTB &= ~(1<<PB1);
+  DDRB |= (1<<PB1);
+
   OUT_recompute_actual();
   OUT_set_on(1);
-
-  DDRB |= (1<<PB1);
 }
 
 void OUT_cyclic(void)
@@ -85,251 +468,2987 @@ void OUT_cyclic(void)
 
 void OUT_recompute_actual(void)
 {
-  uint32_t period_clocks;
-  uint8_t prescaler_bits;
-  uint16_t prescaler;
-  uint16_t oc;
+#if OUT_SWEEP
+  sweep_running = 0;
+#endif
+#if OUT_SEQUENCE
+  sequence_running = 0;
+#endif
+  recompute();
+#if OUT_GATE
+  /* Go on gating the timer as it's now set up */
+  gate_settle();
+#endif
+#if OUT_SYNC
+  sync_settle();
+#endif
+#if OUT_SWEEP
+  sweep_settle();
+#endif
+#if OUT_SEQUENCE
+  sequence_settle();
+#endif
+}
+
+static void recompute(void)
+{
+  PLAN_search_t plan;
   uint32_t f_cpu;
-  uint32_t f_period_ns;
-  uint32_t timer_period_ns;
-  uint32_t timer_freq_mHz;
+  uint32_t value;
+#if OUT_DITHER
+  uint16_t fraction = 0;
+#endif
 
   if (freq_mode == OUT_PERIOD_MODE)
   {
-    if (period_ns < OUT_MIN_NON_SQUARE_PERIOD_NS)
+    if (is_sampled() && (period_ns < OUT_MIN_NON_SQUARE_PERIOD_NS))
+    {
+      waveform = OUT_SQUARE;
+    }
+#if OUT_LFSR
+    if ((waveform == OUT_NOISE) && (period_ns < OUT_MIN_NOISE_PERIOD_NS))
     {
       waveform = OUT_SQUARE;
     }
+#endif
   }
   else /* frequency mode */
   {
-    if (freq_mHz > OUT_MAX_NON_SQUARE_FREQUENCY_mHz)
+    if (is_sampled() && (freq_mHz > OUT_MAX_NON_SQUARE_FREQUENCY_mHz))
+    {
+      waveform = OUT_SQUARE;
+    }
+#if OUT_LFSR
+    if ((waveform == OUT_NOISE) && (freq_mHz > OUT_MAX_NOISE_FREQUENCY_mHz))
     {
       waveform = OUT_SQUARE;
     }
+#endif
+  }
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal + 32L*fine_cal);
+
+#if OUT_DITHER
+  TIMSK &= ~(1<<OCIE1B);
+#endif
+#if OUT_POSTSCALE
+  stop_postscale();
+#endif
+#if OUT_LFSR
+  stop_noise();
+#endif
+
+#if OUT_DDS
+  if (is_sampled())
+  {
+#if OUT_CHANNEL_B
+    cli();
+    set_channel_b_mode(OUT_CHANNEL_B_OFF, 0);
+    sei();
+#endif
+    recompute_dds(f_cpu);
+    return;
   }
+  dds_running = 0;
+#endif
 
-  DDRD &= ~((1<<PD0)|(1<<PD1)|(1<<PD2)|(1<<PD3)|(1<<PD4));
+  DDRD &= (uint8_t)~DAC_PINS;
   TIMSK &= (~1<<TOIE1);
+
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    range_limit(&period_ns);
+    value = period_ns;
+  }
+  else
+  {
+#if OUT_POSTSCALE && OUT_GATE
+    /* Bursts and INT0 need the compare A interrupt to themselves */
+    if ((waveform == OUT_SQUARE) && (freq_mHz < 250) && (gate_mode == OUT_GATE_NONE))
+#elif OUT_POSTSCALE
+    if ((waveform == OUT_SQUARE) && (freq_mHz < 250))
+#endif
+#if OUT_POSTSCALE
+    {
+      /* Down to 1 mHz with the postscaler */
+      if (freq_mHz == 0)
+      {
+        freq_mHz = 1;
+      }
+    }
+    else
+#endif
+    {
+      range_limit(&freq_mHz);
+    }
+    value = freq_mHz;
+  }
+
+#if OUT_GATE
+  if ((gate_mode != OUT_GATE_NONE) && !is_sampled())
+  {
+    /* The compare A ISR runs every cycle during a burst */
+    if ((freq_mode == OUT_PERIOD_MODE) && (period_ns < OUT_GATE_MIN_PERIOD_NS))
+    {
+      period_ns = OUT_GATE_MIN_PERIOD_NS;
+      value = period_ns;
+    }
+    else if ((freq_mode == OUT_FREQ_MODE) && (freq_mHz > OUT_GATE_MAX_FREQUENCY_mHz))
+    {
+      freq_mHz = OUT_GATE_MAX_FREQUENCY_mHz;
+      value = freq_mHz;
+    }
+  }
+#endif
+
+  PLAN_set_f_cpu(f_cpu);
+#if OUT_POSTSCALE
+  if ((waveform == OUT_SQUARE) && (freq_mode == OUT_FREQ_MODE) &&
+      PLAN_postscale(&postscale, value, duty_cycle))
+  {
+#if OUT_CHANNEL_B
+    cli();
+    set_channel_b_mode(OUT_CHANNEL_B_OFF, 0);
+    sei();
+#endif
+    start_postscale();
+    period_ns = postscale.period_ns;
+    freq_mHz = postscale.freq_mHz;
+    update_error();
+    sample_rate_mHz = 0;
+    return;
+  }
+#endif
+#if OUT_CHANNEL_B
+  /* OC1B in the same pass as OC1A */
+  PLAN_set_channel_b(channel_b_mode(), channel_b_phase, channel_b_duty);
+#endif
   if (waveform == OUT_SQUARE)
   {
-    timer_period_ns = period_ns;
-    timer_freq_mHz = freq_mHz;
+    /* One timer period per cycle, where the smallest prescaler
+       that fits is already the closest */
+#if OUT_DITHER && OUT_CHANNEL_B
+    if (channel_b_mode() == OUT_CHANNEL_B_OFF)
+    {
+      fraction = PLAN_dither(&plan.timer, freq_mode, value, duty_cycle);
+    }
+    else
+    {
+      /* OCR1B is OC1B's, so there is no dither interrupt */
+      PLAN_timer(&plan.timer, freq_mode, value, duty_cycle);
+    }
+#elif OUT_DITHER
+    fraction = PLAN_dither(&plan.timer, freq_mode, value, duty_cycle);
+#else
+    PLAN_timer(&plan.timer, freq_mode, value, duty_cycle);
+#endif
+    plan.period_ns = plan.timer.period_ns;
+    plan.freq_mHz = plan.timer.freq_mHz;
+  }
+  else if (waveform == OUT_PULSE)
+  {
+    /* The same, with a width in place of the duty cycle */
+    pulse_width_fits = PLAN_pulse(&plan.timer, freq_mode, value, pulse_width_ns, &pulse_width_actual_ns);
+    plan.period_ns = plan.timer.period_ns;
+    plan.freq_mHz = plan.timer.freq_mHz;
+  }
+#if OUT_LFSR
+  else if (waveform == OUT_NOISE)
+  {
+    /* One timer period per bit, with the compare B interrupt
+       at the start of each */
+    PLAN_timer(&plan.timer, freq_mode, value, 500);
+    plan.timer.compare_b = 0;
+    plan.period_ns = plan.timer.period_ns;
+    plan.freq_mHz = plan.timer.freq_mHz;
   }
+#endif
   else
   {
-    timer_period_ns = (period_ns + WAVEFORM_LENGTH/2)/WAVEFORM_LENGTH;
-    timer_freq_mHz = freq_mHz * WAVEFORM_LENGTH;
+    /* Search the table lengths for the closest cycle */
+    PLAN_search(&plan, freq_mode, value, duty_cycle,
+                OUT_MIN_WAVEFORM_LENGTH_BITS, OUT_MAX_WAVEFORM_LENGTH_BITS);
+    table_length_bits = plan.table_length_bits;
+#if OUT_GATE
+    plan.timer.compare = gate_sample_compare(plan.timer.top, plan.timer.clock_select);
+    plan.timer.compare_b = plan.timer.compare;
+#endif
   }
 
-  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal + 32L*fine_cal);
-  f_period_ns = (1000UL*1000UL*1000UL + f_cpu/2) / f_cpu;
+  /* Move the timer over at the end of its current period */
+  cli();
+#if OUT_CHANNEL_B
+  /* Toggling OC1B starts at the opposite level to OC1A for a phase
+     of up to 180 degrees, unless it misses its first toggle */
+  set_channel_b_mode(channel_b_mode(),
+                     ((channel_b_phase != 0) && (channel_b_phase <= 180)) != (plan.timer.compare_b == 0));
+#endif
+#if OUT_DITHER
+  if (fraction != 0)
+  {
+    /* The dither ISR runs at the start of each period,
+       once the retune has put the new TOP in */
+    dither_top = plan.timer.top;
+    dither_fraction = fraction;
+    dither_acc = 0;
+    plan.timer.compare_b = 0;
+  }
+#endif
+#if OUT_LFSR
+  if (waveform == OUT_NOISE)
+  {
+    start_noise();
+  }
+#endif
+#if OUT_DITHER && OUT_LFSR
+  RETUNE_set(&plan.timer, (fraction != 0) || noise_running);
+#elif OUT_DITHER
+  RETUNE_set(&plan.timer, fraction != 0);
+#elif OUT_LFSR
+  RETUNE_set(&plan.timer, noise_running);
+#else
+  RETUNE_set(&plan.timer, 0);
+#endif
+  timer_top = plan.timer.top;
+#if OUT_GATE
+  gate_margin = (GATE_MARGIN >> PLAN_prescaler_shift(plan.timer.clock_select)) + 1;
+  gate_set_compare(plan.timer.compare);
+#endif
 
-  if (freq_mode == OUT_PERIOD_MODE)
+  period_ns = plan.period_ns;
+  freq_mHz = plan.freq_mHz;
+  update_error();
+  if (!is_sampled())
+  {
+    sample_rate_mHz = 0;
+  }
+  else
   {
-    range_limit(&timer_period_ns);
+    sample_rate_mHz = plan.timer.freq_mHz;
+    recompute_waveform(waveform);
+    TIMSK |= 1<<TOIE1;
+    DAC_PINS_OUT();
+  }
+}
+
+#if OUT_DDS
+static void recompute_dds(uint32_t f_cpu)
+{
+  uint32_t sample_freq_mHz;
+  uint32_t tuning_word;
+#if OUT_TWO_TONE
+  uint32_t tuning_word2;
+  uint32_t value;
+#endif
+  PLAN_timer_t timer;
 
-    /* Convert the period in ns to a prescaler setting
-       and a period in CPU clock cycles */
+  /* Timer1 runs at a fixed sample rate, so only the tuning word
+     depends on the requested frequency */
+  sample_freq_mHz = (F_CPU_MUL * f_cpu) / (OUT_DDS_SAMPLE_CLOCKS / F_OUT_DIV);
 
-    /* First convert to CPU clock cycles, since this is the resolution
-       of the timer itself. */
-    period_clocks = (timer_period_ns + f_period_ns/2) / f_period_ns;
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    range_limit(&period_ns);
+    freq_mHz = div_1e12(period_ns);
   }
   else
   {
-    range_limit(&timer_freq_mHz);
+    range_limit(&freq_mHz);
+  }
+
+  /* The tuning word is the fraction of a cycle to advance per sample,
+     scaled so that 2^32 is a whole cycle */
+  tuning_word = div_64_32(freq_mHz, sample_freq_mHz/2, sample_freq_mHz);
+  if (tuning_word == 0)
+  {
+    tuning_word = 1;
+  }
+
+  /* Compute the actual frequency and period */
+  freq_mHz = mul_high_32(tuning_word, sample_freq_mHz);
+  period_ns = div_1e12(freq_mHz);
+  sample_rate_mHz = sample_freq_mHz;
+  update_error();
+
+  if (!dds_running)
+  {
+    /* Switch Timer1 to the fixed sample rate.
+       This only happens when changing from a square wave,
+       so retuning never moves TCNT1 or ICR1. */
+    TIMSK &= ~(1<<TOIE1);
+    timer.clock_select = 1;
+    timer.top = OUT_DDS_SAMPLE_CLOCKS - 1;
+#if OUT_GATE
+    timer.compare = gate_sample_compare(timer.top, timer.clock_select);
+#elif OUT_PWM_DAC
+    timer.compare = TABLE_CENTRE;
+#else
+    timer.compare = PLAN_compare(timer.top, duty_cycle);
+#endif
+    timer.compare_b = timer.compare;
+    cli();
+    dds_phase = 0;
+#if OUT_TWO_TONE
+    dds_phase2 = 0;
+#endif
+    RETUNE_set(&timer, 0);
+    timer_top = timer.top;
+#if OUT_GATE
+    gate_set_compare(timer.compare);
+#endif
+    dds_table_waveform = OUT_SQUARE;
+  }
+
+#if OUT_TWO_TONE
+  /* The second tone, as the first */
+  value = tone2_freq_mHz;
+  range_limit(&value);
+  if (value > OUT_MAX_NON_SQUARE_FREQUENCY_mHz)
+  {
+    value = OUT_MAX_NON_SQUARE_FREQUENCY_mHz;
+  }
+  tone2_freq_mHz = value;
+  tuning_word2 = div_64_32(value, sample_freq_mHz/2, sample_freq_mHz);
+#endif
+
+  /* The ISR reads the tuning word a byte at a time */
+  cli();
+  dds_tuning_word = tuning_word;
+#if OUT_TWO_TONE
+  dds_tuning_word2 = tuning_word2;
+  tone_scale[0] = tone_scale_for(amplitude);
+  tone_scale[1] = tone_scale_for(tone2_amplitude);
+#endif
+  sei();
+
+  if ((dds_table_waveform != waveform) || (dds_table_amplitude != amplitude))
+  {
+    /* Changing the table shape can't be done without a glitch anyway,
+       but leave it alone when only the frequency changed */
+    recompute_waveform(waveform);
+    dds_table_waveform = waveform;
+    dds_table_amplitude = amplitude;
+  }
+
+  if (!dds_running)
+  {
+    dds_running = 1;
+    TIMSK |= 1<<TOIE1;
+#if !OUT_PWM_DAC
+    DAC_PINS_OUT();
+#endif
+  }
+}
+
+#if OUT_TWO_TONE
+/* Returns the tone_scale for an amplitude in percent, where 100% takes
+   the peaks of the shape, 127, to DAC_AMPL steps */
+static uint8_t tone_scale_for(uint8_t percent)
+{
+  return (uint8_t)((percent * (DAC_AMPL * 256UL) + 127UL*100/2) / (127UL*100));
+}
+#endif
+
+/* The DDS calculations need 64-bit intermediate values.
+   These helpers use only 32-bit arithmetic, because the 64-bit
+   routines in libgcc are large and use r2-r17, which would clobber
+   the registers reserved for the sample ISR (OUT_FIXED_REGS). */
 
-    /* Convert the frequency in mHz to a prescaler setting
-       and a period in CPU clock cycles */
+/* Returns ((hi << 32) + lo) / d, where hi < d */
+static uint32_t div_64_32(uint32_t hi, uint32_t lo, uint32_t d)
+{
+  uint8_t i;
+  uint8_t carry;
 
-    /* First convert to CPU clock cycles, since this is the resolution
-       of the timer itself. */
-    period_clocks = (F_CPU_MUL * f_cpu) / ((timer_freq_mHz + F_OUT_DIV/2) / F_OUT_DIV);
+  /* Shift the dividend left one bit at a time, with the remainder
+     in hi and the quotient shifting into lo from the right */
+  for (i = 0; i < 32; i++)
+  {
+    carry = (hi & 0x80000000UL) != 0;
+    hi = (hi << 1) | (lo >> 31);
+    lo <<= 1;
+    if (carry || (hi >= d))
+    {
+      hi -= d;
+      lo |= 1;
+    }
   }
+  return lo;
+}
+
+/* Returns 10^12 / n, rounded, where n > 233.
+   This converts between a frequency in mHz and a period in ns. */
+static uint32_t div_1e12(uint32_t n)
+{
+  uint32_t hi;
+  uint32_t lo;
 
-  /* The period in clock cycles will in general be larger than 16 bits.
-     So determine the smallest prescaler value that produces
-     a clock period that fits in a 16-bit register. */
-  if (period_clocks < 65536)
+  /* 10^12 = 232 * 2^32 + 3567587328 */
+  hi = 232;
+  lo = 3567587328UL + n/2;
+  if (lo < n/2)
   {
-    prescaler = 1;
-    prescaler_bits = (0<<CS12)|(0<<CS11)|(1<<CS10);
+    hi++;
+  }
+  return div_64_32(hi, lo, n);
+}
+
+/* Returns (a * b) / 2^32, rounded */
+static uint32_t mul_high_32(uint32_t a, uint32_t b)
+{
+  uint32_t ll;
+  uint32_t lh;
+  uint32_t hl;
+  uint32_t hh;
+  uint32_t mid;
+
+  ll = (uint32_t)(uint16_t)a * (uint16_t)b;
+  lh = (uint32_t)(uint16_t)a * (uint16_t)(b >> 16);
+  hl = (uint32_t)(uint16_t)(a >> 16) * (uint16_t)b;
+  hh = (uint32_t)(uint16_t)(a >> 16) * (uint16_t)(b >> 16);
+
+  /* Bits 16 to 47 of the product, plus 2^31 for rounding */
+  mid = (ll >> 16) + (lh & 0xFFFF) + (hl & 0xFFFF) + 0x8000;
+
+  return hh + (lh >> 16) + (hl >> 16) + (mid >> 16);
+}
+#endif
+
+#if OUT_CHANNEL_B
+/* Returns the mode OC1B is in use for. It's only there for square waves. */
+static uint8_t channel_b_mode(void)
+{
+  if (waveform != OUT_SQUARE)
+  {
+    return OUT_CHANNEL_B_OFF;
+  }
+  return channel_b;
+}
+
+/* Sets up the outputs for channel B in mode. Toggling them needs CTC mode,
+   where OCR1A and OCR1B aren't double-buffered and a missed toggle would
+   swap OC1B over for good. So the timer is stopped, with OC1A forced low
+   and OC1B to b_high, and the retune that follows restarts it.
+   Call with interrupts disabled. */
+static void set_channel_b_mode(uint8_t mode, uint8_t b_high)
+{
+  uint8_t com_b;
+
+  if ((mode == OUT_CHANNEL_B_PHASE) || (timer_channel_b == OUT_CHANNEL_B_PHASE))
+  {
+    TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
+  }
+
+  if (mode == OUT_CHANNEL_B_PHASE)
+  {
+    /* Forcing a compare in CTC mode clears or sets the output
+       as for a compare match */
+    com_b = (1<<COM1B1)|(b_high<<COM1B0);
+    TCCR1A = (1<<COM1A1)|com_b;
+    TCCR1A = (1<<FOC1A)|(1<<FOC1B)|(1<<COM1A1)|com_b;
+    TCCR1A = (1<<COM1A0)|(1<<COM1B0);
+  }
+  else
+  {
+    com_b = 0;
+    if (mode == OUT_CHANNEL_B_IN_PHASE)
+    {
+      com_b = 1<<COM1B1;
+    }
+    else if (mode == OUT_CHANNEL_B_INVERTED)
+    {
+      com_b = (1<<COM1B1)|(1<<COM1B0);
+    }
+    TCCR1A = (1<<WGM11)|(1<<COM1A1)|com_b;
+  }
+
+  if (mode == OUT_CHANNEL_B_OFF)
+  {
+    DDRB &= ~(1<<PB2);
+  }
+  else
+  {
+    DDRB |= 1<<PB2;
+  }
+  timer_channel_b = mode;
+}
+#endif
+
+#if OUT_POSTSCALE
+/* Starts Timer1 afresh for the postscaler, with a two clock period
+   to lead in to the first part of the cycle */
+static void start_postscale(void)
+{
+  PLAN_timer_t timer;
+
+  timer.clock_select = 5;
+  timer.top = 1;
+  timer.compare = 0;
+  timer.compare_b = 0;
+
+  cli();
+  TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
+  TCCR1A &= ~((1<<COM1A1)|(1<<COM1A0));
+  PORTB &= ~(1<<PB1);
+  postscale_level = 0;
+  postscale_left = 1;
+  postscale_longer = 0;
+  TIFR = 1<<OCF1A;
+  TIMSK |= 1<<OCIE1A;
+  postscale_running = 1;
+
+  /* The timer is stopped, so this restarts it */
+  RETUNE_set(&timer, 0);
+  timer_top = 0xFFFF;
+}
+
+/* Hands PB1 back to OC1A. Stopping the timer makes the next
+   RETUNE_set start it afresh, since ICR1 isn't what it last asked for. */
+static void stop_postscale(void)
+{
+  if (postscale_running)
+  {
+    cli();
+    TIMSK &= ~(1<<OCIE1A);
+    TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
+    TCCR1A |= 1<<COM1A1;
+    sei();
+    postscale_running = 0;
+  }
+}
+#endif
+
+#if OUT_LFSR
+/* Sets the LFSR off from its first state for the PRBS, with the DAC
+   levels for the amplitude, and hands PB1 over from OC1A to the noise
+   ISR, which the retune that follows starts. That ISR tells itself
+   from the dither ISR by the DAC lines being outputs, so they are set
+   up first. Call with interrupts disabled. */
+static void start_noise(void)
+{
+  uint8_t deviation;
+
+  deviation = (uint8_t)((DAC_AMPL * amplitude + 50) / 100);
+  noise_level[0] = DAC_CENTRE - deviation;
+  noise_level[1] = DAC_CENTRE + deviation;
+  lfsr_taps = pgm_read_word(&prbs_taps[prbs]);
+  lfsr_state = 1;
+
+  TCCR1A &= ~((1<<COM1A1)|(1<<COM1A0));
+  PORTB &= ~(1<<PB1);
+  DAC_PINS_OUT();
+  noise_running = 1;
+}
+
+/* Hands PB1 back to OC1A, low for while it's disconnected */
+static void stop_noise(void)
+{
+  if (noise_running)
+  {
+    cli();
+    TIMSK &= ~(1<<OCIE1B);
+    PORTB &= ~(1<<PB1);
+    TCCR1A |= 1<<COM1A1;
+    sei();
+    noise_running = 0;
+  }
+}
+#endif
+
+/* Returns 1 for the waveforms the sample ISR makes from the table,
+   triangle, sine and OUT_ARBITRARY. Square waves and pulses are OC1A
+   on its own. */
+static uint8_t is_sampled(void)
+{
+#if OUT_UPLOAD
+  if (waveform == OUT_ARBITRARY)
+  {
+    return 1;
+  }
+#endif
+  return (waveform == OUT_TRIANGLE) || (waveform == OUT_SINE);
+}
+
+static void range_limit(uint32_t* n)
+{
+  if (*n < 250)
+  {
+    *n = 250;
+  }
+  if (*n > 4UL*1000UL*1000UL*1000UL)
+  {
+    *n = 4UL*1000UL*1000UL*1000UL;
+  }
+}
+
+static void update_error(void)
+{
+  uint32_t actual;
+
+  actual = (freq_mode == OUT_PERIOD_MODE) ? period_ns : freq_mHz;
+  if (actual >= requested)
+  {
+    error_ppm = PLAN_ppm(actual - requested, requested);
+  }
+  else
+  {
+    error_ppm = PLAN_ppm(requested - actual, requested);
+  }
+}
+
+#if OUT_FLASH_TABLE
+static void recompute_waveform(uint8_t shape)
+{
+  const uint8_t* table;
+  uint8_t scale;
+
+  /* Nothing to build, the ISR reads the quarter-wave from flash */
+  if (shape == OUT_TRIANGLE)
+  {
+    table = WAVES_flash_triangle;
+  }
+  else
+  {
+    table = WAVES_flash_sine;
+  }
+  scale = (uint8_t)((DAC_AMPL * 16U * amplitude + 50) / 100);
+
+  /* The ISR reads the table address a byte at a time */
+  cli();
+  flash_table = table;
+  flash_scale = scale;
+#if !OUT_DDS
+  flash_stride = (uint8_t)(1U << (8 - table_length_bits));
+#endif
+  sei();
+}
+#else
+#if !OUT_TWO_TONE
+/* Returns the table entry for a -127 to 127 value of the shape, scaled
+   by scale as worked out in recompute_waveform. It's the size of the
+   deviation from the centre that's rounded, so that a value and its
+   inverse come out symmetrical. */
+static uint8_t table_entry(int8_t value, uint16_t scale)
+{
+  uint8_t deviation;
+
+  deviation = (value < 0) ? -value : value;
+#if OUT_SHAPING
+  /* to 1/2^SHAPING_BITS of a DAC step, or to whole steps with shaping off */
+  if (shaping)
+  {
+    deviation = (uint8_t)(((uint32_t)deviation * scale + (1UL << (14 - SHAPING_BITS))) >> (15 - SHAPING_BITS));
+  }
+  else
+  {
+    deviation = (uint8_t)(((uint32_t)deviation * scale + 16384) >> 15) << SHAPING_BITS;
+  }
+#else
+  deviation = (uint8_t)(((uint32_t)deviation * scale + 16384) >> 15);
+#endif
+  if (value < 0)
+  {
+    deviation = -deviation;
+  }
+
+#if OUT_SHAPING
+  return (DAC_CENTRE << SHAPING_BITS) + deviation;
+#else
+  return TABLE_CENTRE + deviation;
+#endif
+}
+#endif
+
+/* Fills table with 2^table_length_bits samples of shape */
+static void build_waveform(uint8_t* table, uint8_t shape)
+{
+  uint8_t i;
+  uint8_t half;
+  int8_t value;
+  int8_t value2;
+#if !OUT_TWO_TONE
+  uint16_t scale;
+#endif
+  const int8_t* half_wave;
+#if OUT_DAC_TABLES
+  const int8_t* dac_half_wave;
+#endif
+#if OUT_UPLOAD
+  uint8_t stride_bits;
+
+  /* Shorter tables take every 2nd, 4th... sample of the working copy */
+  stride_bits = OUT_MAX_WAVEFORM_LENGTH_BITS - table_length_bits;
+#endif
+
+  half = (1 << table_length_bits) / 2;
+  if (shape == OUT_TRIANGLE)
+  {
+    half_wave = &WAVES_half_triangle[half - (1<<OUT_MIN_WAVEFORM_LENGTH_BITS)/2];
+#if OUT_DAC_TABLES
+    dac_half_wave = &WAVES_dac_half_triangle[half - (1<<OUT_MIN_WAVEFORM_LENGTH_BITS)/2];
+#endif
+  }
+  else
+  {
+    half_wave = &WAVES_half_sine[half - (1<<OUT_MIN_WAVEFORM_LENGTH_BITS)/2];
+#if OUT_DAC_TABLES
+    dac_half_wave = &WAVES_dac_half_sine[half - (1<<OUT_MIN_WAVEFORM_LENGTH_BITS)/2];
+#endif
+  }
+
+#if OUT_DAC_TABLES
+  /* At full amplitude the tables in DAC steps go in as they are, which
+     rounds each sample once rather than the shape and then its scaling */
+  if (((shape == OUT_TRIANGLE) || (shape == OUT_SINE)) && (amplitude == 100)
+#if OUT_SHAPING
+      && !shaping
+#endif
+     )
+  {
+    for (i = 0; i < half; i++)
+    {
+      value = (int8_t)pgm_read_byte(&dac_half_wave[i]);
+#if OUT_SHAPING
+      table[i] = (uint8_t)(DAC_CENTRE + value) << SHAPING_BITS;
+      table[half + i] = (uint8_t)(DAC_CENTRE - value) << SHAPING_BITS;
+#else
+      table[i] = DAC_CENTRE + value;
+      table[half + i] = DAC_CENTRE - value;
+#endif
+    }
+    return;
+  }
+#endif
+
+#if !OUT_TWO_TONE
+  /* Deviation from TABLE_CENTRE in 1/32768ths of a DAC step
+     per unit of the -127 to 127 half-wave values */
+  scale = (uint16_t)((TABLE_AMPL * 32768UL * amplitude + 127UL*100/2) / (127UL*100));
+#endif
+
+  /* The second half of every waveform but OUT_ARBITRARY is the first
+     half inverted, so only the first half needs working out. The tables
+     from gen_waves.pl may be pre-compensated for the RC filter, which
+     leaves them without any symmetry within the half. */
+  for (i = 0; i < half; i++)
+  {
+    switch (shape)
+    {
+    case OUT_SQUARE:
+    default:
+      value = 127;
+      value2 = -value;
+      break;
+
+    case OUT_TRIANGLE:
+    case OUT_SINE:
+      value = (int8_t)pgm_read_byte(&half_wave[i]);
+      value2 = -value;
+      break;
+
+#if OUT_UPLOAD
+    case OUT_ARBITRARY:
+      value = arbitrary_data[i << stride_bits];
+      value2 = arbitrary_data[(half + i) << stride_bits];
+      break;
+#endif
+    }
+
+#if OUT_TWO_TONE
+    /* The sample ISR scales the shape for each tone */
+    table[i] = value;
+    table[half + i] = value2;
+#else
+    /* Scale the data taking the amplitude into account */
+    table[i] = table_entry(value, scale);
+    table[half + i] = table_entry(value2, scale);
+#endif
+  }
+}
+
+static void recompute_waveform(uint8_t shape)
+{
+  build_waveform(waveform_data, shape);
+#if OUT_SEQUENCE
+  /* The sample ISR may still be on a sequence's sine */
+  cli();
+  table_base = waveform_data;
+  sei();
+#endif
+
+#if !OUT_DDS
+  table_mask = (1 << table_length_bits) - 1;
+#endif
+}
+#endif
+
+#if OUT_ISR_ASM && OUT_FIXED_REGS
+
+#if OUT_DDS
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save SREG in r2, push r30, r31                    5
+     4 x (lds, add) of the tuning word to r6-r9       12
+     top bits of phase to table address, ld, out       7
+       plus one lsr per bit of (8 - table length bits)
+     restore r30, r31 and SREG                         5
+     reti                                              4
+                                                      39 + lsr */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "in   r2, __SREG__"         "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // dds_phase (r6-r9) += dds_tuning_word
+    "lds  r30, %[tuning]"       "\n\t"
+    "add  r6, r30"              "\n\t"
+    "lds  r30, %[tuning]+1"     "\n\t"
+    "adc  r7, r30"              "\n\t"
+    "lds  r30, %[tuning]+2"     "\n\t"
+    "adc  r8, r30"              "\n\t"
+    "lds  r30, %[tuning]+3"     "\n\t"
+    "adc  r9, r30"              "\n\t"
+
+    // PORTD = table_base (r4:r5)[top bits of dds_phase]
+    "mov  r30, r9"              "\n\t"
+    ".rept %[shift]"            "\n\t"
+    "lsr  r30"                  "\n\t"
+    ".endr"                     "\n\t"
+    "add  r30, r4"              "\n\t"
+    "mov  r31, r5"              "\n\t"
+    "adc  r31, r3"              "\n\t"
+    "ld   r30, Z"               "\n\t"
+    "out  %[portd], r30"        "\n\t"
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "out  __SREG__, r2"         "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [tuning] "i" (&dds_tuning_word),
+      [shift]  "M" (8 - OUT_MAX_WAVEFORM_LENGTH_BITS),
+      [portd]  "I" (_SFR_IO_ADDR(PORTD))
+  );
+}
+#else
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save SREG in r2, push r30, r31                    5
+     next index in r6, wrapped with the mask in r7     2
+     index to table address, ld, out                   6
+     restore r30, r31 and SREG                         5
+     reti                                              4
+                                                      28 */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "in   r2, __SREG__"         "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // table_index (r6) = (table_index + 1) & table_mask (r7)
+    "inc  r6"                   "\n\t"
+    "and  r6, r7"               "\n\t"
+
+    // PORTD = table_base (r4:r5)[table_index]
+    "movw r30, r4"              "\n\t"
+    "add  r30, r6"              "\n\t"
+    "adc  r31, r3"              "\n\t"
+    "ld   r30, Z"               "\n\t"
+    "out  %[portd], r30"        "\n\t"
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "out  __SREG__, r2"         "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [portd]  "I" (_SFR_IO_ADDR(PORTD))
+  );
+}
+#endif
+
+#elif OUT_ISR_ASM && OUT_FLASH_TABLE
+
+/* Works out the sample for the 8-bit phase in r30 from the quarter-wave
+   table in flash and writes it to PORTD. Needs r1 = 0 on entry,
+   and uses r0, r1, r24, r25, r30, r31 and the T flag.
+     second quarter of the cycle: mirror, index = 128 - phase
+     second half of the cycle: invert, DAC_CENTRE - value
+   25 cycles. */
+#define FLASH_SAMPLE_ASM \
+    "bst  r30, 7"               "\n\t" \
+    "sbrc r30, 6"               "\n\t" \
+    "neg  r30"                  "\n\t" \
+    "andi r30, 0x7F"            "\n\t" \
+    "lds  r24, %[table]"        "\n\t" \
+    "lds  r31, %[table]+1"      "\n\t" \
+    "add  r30, r24"             "\n\t" \
+    "adc  r31, r1"              "\n\t" \
+    "lpm  r24, Z"               "\n\t" \
+    /* r24 = (r24 * flash_scale + 0x800) >> 12 */ \
+    "lds  r25, %[scale]"        "\n\t" \
+    "mul  r24, r25"             "\n\t" \
+    "mov  r24, r1"              "\n\t" \
+    "subi r24, lo8(-(8))"       "\n\t" \
+    "swap r24"                  "\n\t" \
+    "andi r24, 0x0F"            "\n\t" \
+    "brtc 1f"                   "\n\t" \
+    "neg  r24"                  "\n\t" \
+    "1:"                        "\n\t" \
+    "subi r24, lo8(-(%[centre]))" "\n\t" \
+    "out  %[portd], r24"        "\n\t"
+
+#if OUT_DDS
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r0, r1, r24, r25, r30, r31 and SREG,
+       clear r1                                       16
+     4 x (lds, lds, add, sts) for the 32-bit phase    28
+     top byte of phase to r30                          1
+     FLASH_SAMPLE_ASM                                 25
+     restore r0, r1, r24, r25, r30, r31 and SREG      15
+     reti                                              4
+                                                      95 */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r0"                   "\n\t"
+    "in   r0, __SREG__"         "\n\t"
+    "push r0"                   "\n\t"
+    "push r1"                   "\n\t"
+    "clr  r1"                   "\n\t"
+    "push r24"                  "\n\t"
+    "push r25"                  "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // dds_phase += dds_tuning_word, least significant byte first.
+    // lds and sts leave the carry alone.
+    "lds  r24, %[phase]"        "\n\t"
+    "lds  r25, %[tuning]"       "\n\t"
+    "add  r24, r25"             "\n\t"
+    "sts  %[phase], r24"        "\n\t"
+    "lds  r24, %[phase]+1"      "\n\t"
+    "lds  r25, %[tuning]+1"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+1, r24"      "\n\t"
+    "lds  r24, %[phase]+2"      "\n\t"
+    "lds  r25, %[tuning]+2"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+2, r24"      "\n\t"
+    "lds  r24, %[phase]+3"      "\n\t"
+    "lds  r25, %[tuning]+3"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+3, r24"      "\n\t"
+
+    "mov  r30, r24"             "\n\t"
+    FLASH_SAMPLE_ASM
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "pop  r25"                  "\n\t"
+    "pop  r24"                  "\n\t"
+    "pop  r1"                   "\n\t"
+    "pop  r0"                   "\n\t"
+    "out  __SREG__, r0"         "\n\t"
+    "pop  r0"                   "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [phase]  "i" (&dds_phase),
+      [tuning] "i" (&dds_tuning_word),
+      [table]  "i" (&flash_table),
+      [scale]  "i" (&flash_scale),
+      [centre] "M" (DAC_CENTRE),
+      [portd]  "I" (_SFR_IO_ADDR(PORTD))
+  );
+}
+#else
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r0, r1, r24, r25, r30, r31 and SREG,
+       clear r1                                       16
+     phase from TCNT0, add stride, back to TCNT0       5
+     FLASH_SAMPLE_ASM                                 25
+     restore r0, r1, r24, r25, r30, r31 and SREG      15
+     reti                                              4
+                                                      71 */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r0"                   "\n\t"
+    "in   r0, __SREG__"         "\n\t"
+    "push r0"                   "\n\t"
+    "push r1"                   "\n\t"
+    "clr  r1"                   "\n\t"
+    "push r24"                  "\n\t"
+    "push r25"                  "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // TCNT0 is static storage for the phase, which wraps at 256
+    "in   r30, %[tcnt0]"        "\n\t"
+    "lds  r24, %[stride]"       "\n\t"
+    "add  r30, r24"             "\n\t"
+    "out  %[tcnt0], r30"        "\n\t"
+
+    FLASH_SAMPLE_ASM
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "pop  r25"                  "\n\t"
+    "pop  r24"                  "\n\t"
+    "pop  r1"                   "\n\t"
+    "pop  r0"                   "\n\t"
+    "out  __SREG__, r0"         "\n\t"
+    "pop  r0"                   "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [tcnt0]  "I" (_SFR_IO_ADDR(TCNT0)),
+      [stride] "i" (&flash_stride),
+      [table]  "i" (&flash_table),
+      [scale]  "i" (&flash_scale),
+      [centre] "M" (DAC_CENTRE),
+      [portd]  "I" (_SFR_IO_ADDR(PORTD))
+  );
+}
+#endif
+
+#elif OUT_ISR_ASM
+
+#if OUT_SHAPING
+/* Adds the part of a DAC step left over from the last sample to the
+   table value in reg, keeps the part of the sum below a DAC step for the
+   next sample, and shifts reg down to DAC steps. The table never goes
+   above the top DAC step, so the sum fits in a byte. tmp is r16 to r31.
+   7 cycles plus one lsr per bit of (8 - OUT_DAC_BITS). */
+#define SHAPING_ASM(reg, tmp) \
+    "lds  " tmp ", %[error]"    "\n\t" \
+    "add  " reg ", " tmp        "\n\t" \
+    "mov  " tmp ", " reg        "\n\t" \
+    "andi " tmp ", %[fraction]" "\n\t" \
+    "sts  %[error], " tmp       "\n\t" \
+    ".rept %[shaping_bits]"     "\n\t" \
+    "lsr  " reg                 "\n\t" \
+    ".endr"                     "\n\t"
+
+#define SHAPING_ASM_OPERANDS \
+    , [error]        "i" (&shaping_error), \
+      [fraction]     "M" (SHAPING_FRACTION), \
+      [shaping_bits] "M" (SHAPING_BITS)
+#else
+#define SHAPING_ASM(reg, tmp)
+#define SHAPING_ASM_OPERANDS
+#endif
+
+/* Points Z at the table entry for the index in r30. %[data] is the
+   table's address, or in a sequence build table_base, which holds it.
+   3 cycles, or 7 through table_base (OUT_TABLE_BASE_CYCLES more). */
+#if OUT_SEQUENCE
+#define TABLE_ADDRESS_ASM \
+    "lds  r31, %[data]"         "\n\t" \
+    "add  r30, r31"             "\n\t" \
+    "lds  r31, %[data]+1"       "\n\t" \
+    "brcc 9f"                   "\n\t" \
+    "inc  r31"                  "\n\t" \
+    "9:"                        "\n\t"
+#define TABLE_ADDRESS_OPERAND (&table_base)
+#else
+#define TABLE_ADDRESS_ASM \
+    "ldi  r31, 0"               "\n\t" \
+    "subi r30, lo8(-(%[data]))" "\n\t" \
+    "sbci r31, hi8(-(%[data]))" "\n\t"
+#define TABLE_ADDRESS_OPERAND waveform_data
+#endif
+
+#if OUT_TWO_TONE
+/* Looks up the shape for the top byte of a phase in r22 and multiplies
+   it by a tone_scale, leaving the product in r1:r0. Uses r22, r23,
+   r30 and r31.
+   10 cycles, 14 through table_base, plus one lsr per bit of
+   (8 - table length bits). */
+#define TONE_SAMPLE_ASM(scale) \
+    "mov  r30, r22"             "\n\t" \
+    ".rept %[shift]"            "\n\t" \
+    "lsr  r30"                  "\n\t" \
+    ".endr"                     "\n\t" \
+    TABLE_ADDRESS_ASM \
+    "ld   r22, Z"               "\n\t" \
+    "lds  r23, " scale          "\n\t" \
+    "mulsu r22, r23"            "\n\t"
+
+/* Adds a tuning word to a 32-bit phase, leaving the top byte in r22.
+   Uses r22 and r23. 28 cycles. */
+#define TONE_PHASE_ASM(phase, tuning) \
+    "lds  r22, " phase          "\n\t" \
+    "lds  r23, " tuning         "\n\t" \
+    "add  r22, r23"             "\n\t" \
+    "sts  " phase ", r22"       "\n\t" \
+    "lds  r22, " phase "+1"     "\n\t" \
+    "lds  r23, " tuning "+1"    "\n\t" \
+    "adc  r22, r23"             "\n\t" \
+    "sts  " phase "+1, r22"     "\n\t" \
+    "lds  r22, " phase "+2"     "\n\t" \
+    "lds  r23, " tuning "+2"    "\n\t" \
+    "adc  r22, r23"             "\n\t" \
+    "sts  " phase "+2, r22"     "\n\t" \
+    "lds  r22, " phase "+3"     "\n\t" \
+    "lds  r23, " tuning "+3"    "\n\t" \
+    "adc  r22, r23"             "\n\t" \
+    "sts  " phase "+3, r22"     "\n\t"
+
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r0, r1, r18, r19, r22, r23, r30, r31
+       and SREG                                       19
+     TONE_PHASE_ASM and TONE_SAMPLE_ASM for tone 1    38
+     product to r19:r18                                1
+     TONE_PHASE_ASM and TONE_SAMPLE_ASM for tone 2    38
+     add the products, round to DAC steps              4
+     saturate to the DAC's range                       6
+     add DAC_CENTRE, out                               2
+     restore r0, r1, r18, r19, r22, r23, r30, r31
+       and SREG                                       19
+     reti                                              4
+                                                     137 + 2 x lsr
+   That's twice the single tone's 67 + lsr, so the sample rate is half.
+   OUT_SEQUENCE reads the table address from table_base, 8 more. */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r0"                   "\n\t"
+    "in   r0, __SREG__"         "\n\t"
+    "push r0"                   "\n\t"
+    "push r1"                   "\n\t"
+    "push r18"                  "\n\t"
+    "push r19"                  "\n\t"
+    "push r22"                  "\n\t"
+    "push r23"                  "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // r19:r18 = shape[dds_phase] * tone_scale[0]
+    TONE_PHASE_ASM("%[phase]", "%[tuning]")
+    TONE_SAMPLE_ASM("%[scale]")
+    "movw r18, r0"              "\n\t"
+
+    // + shape[dds_phase2] * tone_scale[1], rounded to the high byte
+    TONE_PHASE_ASM("%[phase2]", "%[tuning2]")
+    TONE_SAMPLE_ASM("%[scale]+1")
+    "add  r18, r0"              "\n\t"
+    "adc  r19, r1"              "\n\t"
+    "subi r18, 0x80"            "\n\t"
+    "sbci r19, 0xFF"            "\n\t"
+
+    // Saturate to -DAC_CENTRE .. DAC_CENTRE - 1, i.e. the whole DAC
+    "cpi  r19, %[centre]"       "\n\t"
+    "brlt 1f"                   "\n\t"
+    "ldi  r19, %[centre]-1"     "\n\t"
+    "1:"                        "\n\t"
+    "cpi  r19, lo8(-(%[centre]))" "\n\t"
+    "brge 2f"                   "\n\t"
+    "ldi  r19, lo8(-(%[centre]))" "\n\t"
+    "2:"                        "\n\t"
+    "subi r19, lo8(-(%[centre]))" "\n\t"
+    "out  %[portd], r19"        "\n\t"
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "pop  r23"                  "\n\t"
+    "pop  r22"                  "\n\t"
+    "pop  r19"                  "\n\t"
+    "pop  r18"                  "\n\t"
+    "pop  r1"                   "\n\t"
+    "pop  r0"                   "\n\t"
+    "out  __SREG__, r0"         "\n\t"
+    "pop  r0"                   "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [phase]   "i" (&dds_phase),
+      [tuning]  "i" (&dds_tuning_word),
+      [phase2]  "i" (&dds_phase2),
+      [tuning2] "i" (&dds_tuning_word2),
+      [scale]   "i" (tone_scale),
+      [data]    "i" (TABLE_ADDRESS_OPERAND),
+      [shift]   "M" (8 - OUT_MAX_WAVEFORM_LENGTH_BITS),
+      [centre]  "M" (DAC_CENTRE),
+      [portd]   "I" (_SFR_IO_ADDR(PORTD))
+  );
+}
+#elif OUT_DDS
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r24, r25, r30, r31 and SREG                 11
+     4 x (lds, lds, add, sts) for the 32-bit phase    28
+     top bits of phase to table address, ld, out       7
+       plus one lsr per bit of (8 - table length bits)
+     restore r24, r25, r30, r31 and SREG              11
+     reti                                              4
+                                                      67 + lsr
+   OUT_SHAPING adds SHAPING_ASM before the out: 74 + lsr + lsr.
+   OUT_PWM_DAC writes OCR1A in place of PORTD, 2 more: 69 + lsr.
+   OUT_SEQUENCE reads the table address from table_base, 4 more. */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r24"                  "\n\t"
+    "in   r24, __SREG__"        "\n\t"
+    "push r24"                  "\n\t"
+    "push r25"                  "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // dds_phase += dds_tuning_word, least significant byte first.
+    // lds and sts leave the carry alone.
+    "lds  r24, %[phase]"        "\n\t"
+    "lds  r25, %[tuning]"       "\n\t"
+    "add  r24, r25"             "\n\t"
+    "sts  %[phase], r24"        "\n\t"
+    "lds  r24, %[phase]+1"      "\n\t"
+    "lds  r25, %[tuning]+1"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+1, r24"      "\n\t"
+    "lds  r24, %[phase]+2"      "\n\t"
+    "lds  r25, %[tuning]+2"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+2, r24"      "\n\t"
+    "lds  r24, %[phase]+3"      "\n\t"
+    "lds  r25, %[tuning]+3"     "\n\t"
+    "adc  r24, r25"             "\n\t"
+    "sts  %[phase]+3, r24"      "\n\t"
+
+    // PORTD = table[top bits of dds_phase]
+    "mov  r30, r24"             "\n\t"
+    ".rept %[shift]"            "\n\t"
+    "lsr  r30"                  "\n\t"
+    ".endr"                     "\n\t"
+    TABLE_ADDRESS_ASM
+    "ld   r24, Z"               "\n\t"
+#if OUT_PWM_DAC
+    // OCR1A = the sample, high byte first. Timer1 takes it at BOTTOM,
+    // for the next period.
+    "ldi  r25, 0"               "\n\t"
+    "out  %[ocr1ah], r25"       "\n\t"
+    "out  %[ocr1al], r24"       "\n\t"
+#else
+    SHAPING_ASM("r24", "r25")
+    "out  %[portd], r24"        "\n\t"
+#endif
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "pop  r25"                  "\n\t"
+    "pop  r24"                  "\n\t"
+    "out  __SREG__, r24"        "\n\t"
+    "pop  r24"                  "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [phase]  "i" (&dds_phase),
+      [tuning] "i" (&dds_tuning_word),
+      [data]   "i" (TABLE_ADDRESS_OPERAND),
+      [shift]  "M" (8 - OUT_MAX_WAVEFORM_LENGTH_BITS),
+      [portd]  "I" (_SFR_IO_ADDR(PORTD)),
+      [ocr1ah] "I" (_SFR_IO_ADDR(OCR1AH)),
+      [ocr1al] "I" (_SFR_IO_ADDR(OCR1AL))
+      SHAPING_ASM_OPERANDS
+  );
+}
+#else
+/* Worst-case cycles per sample (OUT_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r30, r31 and SREG                            7
+     next index from TCNT0, wrapped, back to TCNT0     6
+     index to table address, ld, out                   6
+     restore r30, r31 and SREG                         7
+     reti                                              4
+                                                      36
+   OUT_SHAPING adds SHAPING_ASM before the out: 43 + lsr.
+   OUT_SEQUENCE reads the table address from table_base, 4 more. */
+ISR(TIMER1_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r30"                  "\n\t"
+    "in   r30, __SREG__"        "\n\t"
+    "push r30"                  "\n\t"
+    "push r31"                  "\n\t"
+
+    // TCNT0 is static storage for the waveform index
+    "in   r30, %[tcnt0]"        "\n\t"
+    "inc  r30"                  "\n\t"
+    "lds  r31, %[mask]"         "\n\t"
+    "and  r30, r31"             "\n\t"
+    "out  %[tcnt0], r30"        "\n\t"
+
+    // PORTD = table[index]
+    TABLE_ADDRESS_ASM
+    "ld   r30, Z"               "\n\t"
+    SHAPING_ASM("r30", "r31")
+    "out  %[portd], r30"        "\n\t"
+
+    "pop  r31"                  "\n\t"
+    "pop  r30"                  "\n\t"
+    "out  __SREG__, r30"        "\n\t"
+    "pop  r30"                  "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [tcnt0] "I" (_SFR_IO_ADDR(TCNT0)),
+      [mask]  "i" (&table_mask),
+      [data]  "i" (TABLE_ADDRESS_OPERAND),
+      [portd] "I" (_SFR_IO_ADDR(PORTD))
+      SHAPING_ASM_OPERANDS
+  );
+}
+#endif
+
+#else /* C sample ISR */
+
+/* From a table value to DAC steps, the same way as SHAPING_ASM */
+#if OUT_SHAPING
+static inline uint8_t dac_steps(uint8_t value)
+{
+  value += shaping_error;
+  shaping_error = value & SHAPING_FRACTION;
+  return value >> SHAPING_BITS;
+}
+#elif !OUT_FLASH_TABLE
+static inline uint8_t dac_steps(uint8_t value)
+{
+  return value;
+}
+#endif
+
+/* The table the sample ISR reads, which a sequence switches */
+#if OUT_SEQUENCE && !OUT_FLASH_TABLE
+#define SAMPLE_TABLE table_base
+#else
+#define SAMPLE_TABLE waveform_data
+#endif
+
+#if OUT_FLASH_TABLE
+/* Works out the sample for an 8-bit phase from the quarter-wave
+   table in flash, the same way as FLASH_SAMPLE_ASM */
+static inline uint8_t flash_sample(uint8_t phase)
+{
+  uint8_t index;
+  uint8_t value;
+
+  index = phase;
+  if (index & 0x40)
+  {
+    index = -index;
+  }
+  index &= 0x7F;
+  value = pgm_read_byte(flash_table + index);
+  value = (uint8_t)(((uint16_t)value * flash_scale + 0x800) >> 12);
+  if (phase & 0x80)
+  {
+    return DAC_CENTRE - value;
+  }
+  return DAC_CENTRE + value;
+}
+#endif
+
+#if OUT_DDS && OUT_FLASH_TABLE
+/* Worst-case cycles per sample (OUT_ISR_CYCLES), estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18-r21, r24-r27, r30, r31
+       and SREG                                       54
+     clear r1                                          1
+     load, add and store the 32-bit phase             28
+     flash_sample and out                             30
+     reti                                              4
+                                                     123 */
+ISR(TIMER1_OVF_vect)
+{
+  uint32_t phase;
+  phase = dds_phase + dds_tuning_word;
+  dds_phase = phase;
+  PORTD = flash_sample((uint8_t)(phase >> 24));
+}
+#elif OUT_FLASH_TABLE
+/* Worst-case cycles per sample (OUT_ISR_CYCLES), estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18, r19, r24, r25, r30, r31
+       and SREG                                       38
+     clear r1                                          1
+     phase from TCNT0, add stride, back to TCNT0       5
+     flash_sample and out                             30
+     reti                                              4
+                                                      84 */
+ISR(TIMER1_OVF_vect)
+{
+  uint8_t phase = TCNT0; // TCNT0 is static storage for the phase
+  phase += flash_stride;
+  TCNT0 = phase;
+  PORTD = flash_sample(phase);
+}
+#elif OUT_TWO_TONE
+/* Worst-case cycles per sample (OUT_ISR_CYCLES), estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18-r27, r30, r31 and SREG      66
+     clear r1                                          1
+     load, add and store both 32-bit phases           56
+     two lookups of the shape, and multiplies         20
+       plus one lsr each per bit of (8 - table length bits)
+     add, round, saturate, add DAC_CENTRE, out        15
+     reti                                              4
+                                                     168 + 2 x lsr
+   OUT_SEQUENCE reads the table address from table_base, estimated
+   as 4 more per lookup. */
+ISR(TIMER1_OVF_vect)
+{
+  uint32_t phase;
+  int16_t sum;
+  int8_t steps;
+
+  phase = dds_phase + dds_tuning_word;
+  dds_phase = phase;
+  sum = (int8_t)SAMPLE_TABLE[(uint8_t)(phase >> 24) >> (8 - OUT_MAX_WAVEFORM_LENGTH_BITS)] * tone_scale[0];
+  phase = dds_phase2 + dds_tuning_word2;
+  dds_phase2 = phase;
+  sum += (int8_t)SAMPLE_TABLE[(uint8_t)(phase >> 24) >> (8 - OUT_MAX_WAVEFORM_LENGTH_BITS)] * tone_scale[1];
+
+  /* Round to DAC steps and saturate */
+  steps = (int8_t)((uint16_t)(sum + 0x80) >> 8);
+  if (steps >= DAC_CENTRE)
+  {
+    steps = DAC_CENTRE - 1;
+  }
+  if (steps < -DAC_CENTRE)
+  {
+    steps = -DAC_CENTRE;
+  }
+  PORTD = DAC_CENTRE + steps;
+}
+#elif OUT_DDS
+/* Worst-case cycles per sample (OUT_ISR_CYCLES), from the -Os code:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18-r21, r24-r27, r30, r31
+       and SREG                                       54
+     clear r1                                          1
+     load phase and tuning word (8 x lds)             16
+     32-bit add                                        4
+     store phase (4 x sts)                             8
+     top bits of phase to table address, ld, out       7
+       plus one lsr per bit of (8 - table length bits)
+     reti                                              4
+                                                     100 + lsr
+   OUT_SHAPING adds dac_steps, estimated as SHAPING_ASM: 107 + lsr + lsr.
+   OUT_PWM_DAC writes OCR1A in place of PORTD, 1 more: 101 + lsr.
+   OUT_SEQUENCE reads the table address from table_base, estimated
+   as 4 more. */
+ISR(TIMER1_OVF_vect)
+{
+  uint32_t phase;
+  phase = dds_phase + dds_tuning_word;
+  dds_phase = phase;
+#if OUT_PWM_DAC
+  /* Timer1 takes it at BOTTOM, for the next period */
+  OCR1A = SAMPLE_TABLE[(uint8_t)(phase >> 24) >> (8 - OUT_MAX_WAVEFORM_LENGTH_BITS)];
+#else
+  PORTD = dac_steps(SAMPLE_TABLE[(uint8_t)(phase >> 24) >> (8 - OUT_MAX_WAVEFORM_LENGTH_BITS)]);
+#endif
+}
+#else
+/* Worst-case cycles per sample (OUT_ISR_CYCLES), from the -Os code:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r24, r25, r30, r31 and SREG     30
+     clear r1                                          1
+     next index from TCNT0, wrapped, back to TCNT0     6
+     index to table address, ld, out                   7
+     reti                                              4
+                                                      54
+   OUT_SHAPING adds dac_steps, estimated as SHAPING_ASM: 61 + lsr.
+   OUT_SEQUENCE reads the table address from table_base, estimated
+   as 4 more. */
+ISR(TIMER1_OVF_vect)
+{
+  uint8_t next_index = TCNT0; // TCNT0 is static storage for the waveform index
+  next_index++;
+  next_index &= table_mask;
+  TCNT0 = next_index;
+  PORTD = dac_steps(SAMPLE_TABLE[next_index]);
+}
+#endif
+
+#endif
+
+#if OUT_LFSR
+
+/* The noise ISR runs at BOTTOM with OCR1B at 0, so each bit starts a
+   fixed time into its Timer1 period. The bit coming out of the LFSR
+   goes to PB1 and picks the DAC level. */
+#if OUT_ISR_ASM
+/* Ends in reti, so that the dither ISR can run it in its place.
+   Worst-case cycles per bit (OUT_NOISE_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r29-r31 and SREG                             9
+     lfsr_state shifted right, the bit out to carry    6
+     a 1: taps, PB1 and the level (a 0 takes 6)       13
+     level to the DAC, lfsr_state back                 5
+     restore r29-r31 and SREG                          9
+     reti                                              4
+                                                      52
+   With OUT_DITHER telling it from the dither ISR takes 2 more. */
+#define NOISE_ASM \
+    "push r30"                  "\n\t" \
+    "in   r30, __SREG__"        "\n\t" \
+    "push r30"                  "\n\t" \
+    "push r31"                  "\n\t" \
+    "push r29"                  "\n\t" \
+                                         \
+    "lds  r30, %[state]"        "\n\t" \
+    "lds  r31, %[state]+1"      "\n\t" \
+    "lsr  r31"                  "\n\t" \
+    "ror  r30"                  "\n\t" \
+    "brcc 8f"                   "\n\t" \
+                                         \
+    "lds  r29, %[taps]"         "\n\t" \
+    "eor  r30, r29"             "\n\t" \
+    "lds  r29, %[taps]+1"       "\n\t" \
+    "eor  r31, r29"             "\n\t" \
+    "sbi  %[portb], %[pb1]"     "\n\t" \
+    "lds  r29, %[level]+1"      "\n\t" \
+    "rjmp 9f"                   "\n\t" \
+    "8:"                        "\n\t" \
+    "cbi  %[portb], %[pb1]"     "\n\t" \
+    "lds  r29, %[level]"        "\n\t" \
+    "9:"                        "\n\t" \
+    "out  %[portd], r29"        "\n\t" \
+    "sts  %[state], r30"        "\n\t" \
+    "sts  %[state]+1, r31"      "\n\t" \
+                                         \
+    "pop  r29"                  "\n\t" \
+    "pop  r31"                  "\n\t" \
+    "pop  r30"                  "\n\t" \
+    "out  __SREG__, r30"        "\n\t" \
+    "pop  r30"                  "\n\t" \
+    "reti"                      "\n\t"
+
+#define NOISE_ASM_OPERANDS \
+    [state] "i" (&lfsr_state), \
+    [taps]  "i" (&lfsr_taps), \
+    [level] "i" (noise_level), \
+    [portb] "I" (_SFR_IO_ADDR(PORTB)), \
+    [pb1]   "I" (PB1), \
+    [portd] "I" (_SFR_IO_ADDR(PORTD))
+
+#if !OUT_DITHER
+ISR(TIMER1_COMPB_vect, ISR_NAKED)
+{
+  asm volatile(
+    NOISE_ASM
+    :
+    : NOISE_ASM_OPERANDS
+  );
+}
+#endif
+#else
+/* Worst-case cycles per bit (OUT_NOISE_ISR_CYCLES), estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18, r19, r24, r25 and SREG     30
+     clear r1                                          1
+     lfsr_state shifted right, the bit out tested      8
+     a 1: taps, PB1 and the level to the DAC          12
+     lfsr_state back                                   4
+     reti                                              4
+                                                      65
+   With OUT_DITHER it runs inside the dither ISR, which saves more
+   registers and has to tell the two apart: 76. */
+#if OUT_DITHER
+static inline void noise_step(void)
+#else
+ISR(TIMER1_COMPB_vect)
+#endif
+{
+  uint16_t state;
+
+  state = lfsr_state;
+  if (state & 1)
+  {
+    state = (state >> 1) ^ lfsr_taps;
+    PORTB |= 1<<PB1;
+    PORTD = noise_level[1];
+  }
+  else
+  {
+    state >>= 1;
+    PORTB &= ~(1<<PB1);
+    PORTD = noise_level[0];
+  }
+  lfsr_state = state;
+}
+#endif
+
+#endif
+
+#if OUT_DITHER
+
+/* The dither ISR picks TOP for the period that has just started, since
+   ICR1 isn't double-buffered with TOP=ICR1. If it's already too close to
+   TOP when it gets to run, say behind the UI interrupt, writing a TOP below
+   TCNT1 would run the counter up to 0xFFFF. So then it leaves ICR1 and the
+   accumulator alone for that period, losing up to a clock of phase. */
+#if OUT_ISR_ASM
+// CPU cycles from reading TCNT1 to the write to ICR1, plus 1
+#define DITHER_MARGIN 34
+
+/* Worst-case cycles per period (OUT_DITHER_ISR_CYCLES):
+     interrupt response + rjmp in the vector table     6
+     save r24-r27 and SREG                            11
+     read TCNT1, compare with dither_top - margin     11
+     dither_acc += dither_fraction                    14
+     dither_top, plus 1 on a carry                     7
+     write ICR1                                        2
+     restore r24-r27 and SREG                         11
+     reti                                              4
+                                                      66
+   With OUT_LFSR telling it from the noise ISR takes 3 more. */
+ISR(TIMER1_COMPB_vect, ISR_NAKED)
+{
+  asm volatile(
+#if OUT_LFSR
+    // The DAC lines are only outputs while it's the noise ISR
+    "sbis %[ddrd], %[pd0]"      "\n\t"
+    "rjmp 3f"                   "\n\t"
+    NOISE_ASM
+    "3:"                        "\n\t"
+#endif
+    "push r24"                  "\n\t"
+    "in   r24, __SREG__"        "\n\t"
+    "push r24"                  "\n\t"
+    "push r25"                  "\n\t"
+    "push r26"                  "\n\t"
+    "push r27"                  "\n\t"
+
+    // Too late if TCNT1 >= dither_top - margin. Low byte first.
+    "in   r26, %[tcntl]"        "\n\t"
+    "in   r27, %[tcnth]"        "\n\t"
+    "lds  r24, %[top]"          "\n\t"
+    "lds  r25, %[top]+1"        "\n\t"
+    "sbiw r24, %[margin]"       "\n\t"
+    "cp   r26, r24"             "\n\t"
+    "cpc  r27, r25"             "\n\t"
+    "brsh 2f"                   "\n\t"
+
+    // dither_acc += dither_fraction.
+    // lds and sts leave the carry alone.
+    "lds  r24, %[acc]"          "\n\t"
+    "lds  r26, %[fraction]"     "\n\t"
+    "add  r24, r26"             "\n\t"
+    "sts  %[acc], r24"          "\n\t"
+    "lds  r25, %[acc]+1"        "\n\t"
+    "lds  r26, %[fraction]+1"   "\n\t"
+    "adc  r25, r26"             "\n\t"
+    "sts  %[acc]+1, r25"        "\n\t"
+
+    // ICR1 = dither_top + carry, high byte first
+    "lds  r24, %[top]"          "\n\t"
+    "lds  r25, %[top]+1"        "\n\t"
+    "brcc 1f"                   "\n\t"
+    "adiw r24, 1"               "\n\t"
+    "1:"                        "\n\t"
+    "out  %[icrh], r25"         "\n\t"
+    "out  %[icrl], r24"         "\n\t"
+
+    "2:"                        "\n\t"
+    "pop  r27"                  "\n\t"
+    "pop  r26"                  "\n\t"
+    "pop  r25"                  "\n\t"
+    "pop  r24"                  "\n\t"
+    "out  __SREG__, r24"        "\n\t"
+    "pop  r24"                  "\n\t"
+    "reti"                      "\n\t"
+    :
+    : [top]      "i" (&dither_top),
+      [fraction] "i" (&dither_fraction),
+      [acc]      "i" (&dither_acc),
+      [margin]   "I" (DITHER_MARGIN),
+      [tcntl]    "I" (_SFR_IO_ADDR(TCNT1L)),
+      [tcnth]    "I" (_SFR_IO_ADDR(TCNT1H)),
+      [icrl]     "I" (_SFR_IO_ADDR(ICR1L)),
+      [icrh]     "I" (_SFR_IO_ADDR(ICR1H))
+#if OUT_LFSR
+      , [ddrd]   "I" (_SFR_IO_ADDR(DDRD)),
+      [pd0]      "I" (PD0),
+      NOISE_ASM_OPERANDS
+#endif
+  );
+}
+#else
+// CPU cycles from reading TCNT1 to the write to ICR1, with room to spare
+#define DITHER_MARGIN 48
+
+/* Worst-case cycles per period (OUT_DITHER_ISR_CYCLES), estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18-r21, r24, r25 and SREG      38
+     clear r1                                          1
+     read TCNT1, compare with dither_top - margin     12
+     dither_acc += dither_fraction, carry to TOP      15
+     write ICR1                                        4
+     reti                                              4
+                                                      80
+   With OUT_LFSR telling it from the noise ISR takes 3 more. */
+ISR(TIMER1_COMPB_vect)
+{
+  uint16_t top;
+  uint16_t acc;
+
+#if OUT_LFSR
+  /* The DAC lines are only outputs while it's the noise ISR */
+  if (DDRD & (1<<PD0))
+  {
+    noise_step();
+    return;
+  }
+#endif
+
+  top = dither_top;
+  if (TCNT1 >= top - DITHER_MARGIN)
+  {
+    return;
+  }
+  acc = dither_acc + dither_fraction;
+  if (acc < dither_fraction)
+  {
+    top++;
+  }
+  dither_acc = acc;
+  ICR1 = top;
+}
+#endif
+
+#endif
+
+#if OUT_POSTSCALE
+
+/* Runs at BOTTOM with OCR1A at 0, and sets TOP for the period that has
+   just started, which only needs to happen within a prescaled clock
+   (1024 CPU cycles). At the end of a part of the cycle it moves PB1 on
+   to the other one, unless that's empty (0% or 100% duty cycle).
+   Worst-case cycles per Timer1 period, estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18, r19, r24, r25, r30, r31
+       and SREG                                       38
+     clear r1                                          1
+     count down postscale_left                        10
+     next part: level, PB1, count and longer          30
+     TOP, plus 1 while postscale_longer is non-zero   20
+     write ICR1                                        4
+     reti                                              4
+                                                     113
+   Timer1 periods are at least 65536 / 2 prescaled clocks, apart from
+   the whole of a part shorter than that, so this takes a few ppm of the
+   CPU on average, and 113 cycles in 1024 at worst for a one clock part.
+   With OUT_GATE it shares the interrupt with the gate ISR below. */
+#if OUT_GATE
+static inline void postscale_step(void)
+#else
+ISR(TIMER1_COMPA_vect)
+#endif
+{
+  uint8_t level;
+  uint16_t top;
+
+  level = postscale_level;
+  if (--postscale_left == 0)
+  {
+    if (postscale.periods[level ^ 1] != 0)
+    {
+      level ^= 1;
+      postscale_level = level;
+    }
+#if OUT_GATE
+    if (level && gate_running)
+#else
+    if (level)
+#endif
+    {
+      PORTB |= 1<<PB1;
+    }
+    else
+    {
+      PORTB &= ~(1<<PB1);
+    }
+    postscale_left = postscale.periods[level];
+    postscale_longer = postscale.longer[level];
+  }
+
+  top = postscale.top[level];
+  if (postscale_longer != 0)
+  {
+    postscale_longer--;
+    top++;
+  }
+  ICR1 = top;
+}
+
+#endif
+
+#if OUT_GATE || OUT_SYNC
+
+/* Has the sample ISR put out the first sample of the table next */
+static inline void restart_table(void)
+{
+#if OUT_DDS
+  dds_phase = 0 - dds_tuning_word;
+#if OUT_TWO_TONE
+  dds_phase2 = 0 - dds_tuning_word2;
+#endif
+#elif OUT_FLASH_TABLE
+  TCNT0 = 0 - flash_stride;
+#elif OUT_FIXED_REGS
+  table_index = table_mask;
+#else
+  TCNT0 = table_mask;
+#endif
+}
+
+#endif
+
+#if OUT_GATE
+
+/* Returns the compare for triangle and sine waves, which puts the gate
+   ISR just far enough ahead of TOP to see the last sample of a cycle
+   before the next one goes out. Stopping there cuts that sample short
+   by no more than the lead. */
+static uint16_t gate_sample_compare(uint16_t top, uint8_t clock_select)
+{
+  uint16_t lead;
+
+  lead = ((OUT_GATE_ISR_CYCLES + GATE_MARGIN) >> PLAN_prescaler_shift(clock_select)) + 1;
+  if (top <= lead)
+  {
+    return 0;
+  }
+  return top - lead;
+}
+
+/* Sets the window after the compare match in which OC1A can be switched
+   over, for the timer_top last set up. With no low part, or one too short
+   for the margin, it's anywhere or to the end of the period. */
+static void gate_set_compare(uint16_t compare)
+{
+  uint16_t last_count;
+
+  last_count = timer_top;
+  if (compare >= timer_top)
+  {
+    compare = 0;
+  }
+  else if (timer_top - compare > gate_margin)
+  {
+    last_count = timer_top - gate_margin;
+  }
+  cli();
+  gate_compare = compare;
+  gate_last_count = last_count;
+  sei();
+}
+
+/* Picks the gating up again after the timer has been set up afresh.
+   Output that is running goes on as it is; a burst ends at the end of
+   the current cycle, and in OUT_GATE_INT0 the output follows INT0 from
+   the next cycle. */
+static void gate_settle(void)
+{
+  uint8_t target;
+  uint8_t run;
+  uint8_t active;
+
+  target = is_sampled() ? GATE_TABLE : GATE_OC1A;
+#if OUT_POSTSCALE
+  if (postscale_running)
+  {
+    target = GATE_PB1;
+  }
+#endif
+#if OUT_LFSR
+  if (noise_running)
+  {
+    target = GATE_FIXED;
+  }
+#endif
+#if OUT_CHANNEL_B
+  if (timer_channel_b == OUT_CHANNEL_B_PHASE)
+  {
+    target = GATE_FIXED;
+  }
+#endif
+
+  cli();
+  if (target != GATE_PB1)
+  {
+    TIMSK &= ~(1<<OCIE1A);
+  }
+  GICR &= ~(1<<INT0);
+  gate_state = GATE_IDLE;
+  gate_target = target;
+
+  run = on;
+  if (gate_mode == OUT_GATE_BURST)
+  {
+    run = 0;
+  }
+  else if ((gate_mode == OUT_GATE_INT0) && (target == GATE_OC1A))
+  {
+    run = on && gate_running;
+  }
+
+  if ((target == GATE_OC1A) || (target == GATE_TABLE))
+  {
+    /* Setting the timer up may have connected OC1A or started the
+       sample ISR, whether the output was on or not */
+    if (target == GATE_OC1A)
+    {
+      active = TCCR1A & (1<<COM1A1);
+    }
+    else
+    {
+      active = TIMSK & (1<<TOIE1);
+    }
+    if (!active)
+    {
+      gate_output(0);
+      if (run)
+      {
+        gate_arm(GATE_START);
+      }
+    }
+    else if (!run)
+    {
+      if (gate_running)
+      {
+        /* Finish the cycle */
+        gate_arm(GATE_STOP);
+      }
+      else
+      {
+        gate_output(0);
+      }
+    }
+    else
+    {
+      gate_running = 1;
+    }
+  }
+  else
+  {
+    /* Not gated at a cycle boundary, and no bursts */
+    if ((target == GATE_FIXED) || (gate_mode == OUT_GATE_BURST))
+    {
+      run = 1;
+    }
+    gate_output(run);
+  }
+  if (gate_mode == OUT_GATE_BURST)
+  {
+    /* A burst ends here */
+    on = gate_state == GATE_STOP;
+  }
+
+  if ((gate_mode != OUT_GATE_NONE) && (target == GATE_OC1A))
+  {
+    /* PD2 is free for INT0, pulled up, when the DAC lines are inputs */
+    PORTD |= 1<<PD2;
+    GIFR = 1<<INTF0;
+    if (gate_mode == OUT_GATE_BURST)
+    {
+      /* Falling edge */
+      MCUCR = (MCUCR & ~(1<<ISC00)) | (1<<ISC01);
+      GICR |= 1<<INT0;
+    }
+    else if (on)
+    {
+      /* Any change */
+      MCUCR = (MCUCR & ~(1<<ISC01)) | (1<<ISC00);
+      GICR |= 1<<INT0;
+      gate_follow_int0();
+    }
+  }
+  sei();
+}
+
+/* Has the compare A ISR do state at the next compare match.
+   Call with interrupts disabled. */
+static void gate_arm(uint8_t state)
+{
+  gate_state = state;
+  TIFR = 1<<OCF1A;
+  TIMSK |= 1<<OCIE1A;
+}
+
+/* Starts or stops the output at the next cycle boundary as INT0 is
+   held low or not. Call with interrupts disabled. */
+static void gate_follow_int0(void)
+{
+  gate_arm((PIND & (1<<PD2)) ? GATE_STOP : GATE_START);
+}
+
+/* Turns the output on or off straight away. Starting the sample ISR
+   goes back to the first sample of the table, which goes out at the
+   next TOP. Call with interrupts disabled. */
+static void gate_output(uint8_t run)
+{
+  gate_running = run;
+  switch (gate_target)
+  {
+  case GATE_OC1A:
+    if (run)
+    {
+      TCCR1A |= 1<<COM1A1;
+    }
+    else
+    {
+      TCCR1A &= ~(1<<COM1A1);
+    }
+    break;
+
+  case GATE_TABLE:
+    if (run)
+    {
+      restart_table();
+      TIFR = 1<<TOV1;
+      TIMSK |= 1<<TOIE1;
+    }
+    else
+    {
+      TIMSK &= ~(1<<TOIE1);
+      PORTD = DAC_CENTRE;
+    }
+    break;
+
+  case GATE_PB1:
+    /* The postscaler sets PB1 again at the next high part */
+    if (!run)
+    {
+      PORTB &= ~(1<<PB1);
+    }
+    break;
+  }
+}
+
+/* Runs at the compare match, while there is something to start, count
+   or stop, and only every period during a burst.
+   For OC1A the compare match has just ended a cycle, and OC1A is
+   disconnected while it's low, so the output stops exactly at the end of
+   the cycle. That needs this to get in before TCNT1 is within GATE_MARGIN
+   cycles of TOP; if it doesn't, one more cycle goes out.
+   For triangle and sine waves the compare match comes just before TOP
+   (gate_sample_compare), with the last sample of the cycle on the DAC;
+   stopping then cuts that sample short by at most the lead, and puts out
+   the centre. If this comes after TOP, the first sample of the next cycle
+   is already out, and it stops straight after that instead.
+   Worst-case cycles per Timer1 period while counting, estimated for -Os:
+     interrupt response + rjmp in the vector table     6
+     push/pop r0, r1, r18-r21, r24, r25, r30, r31
+       and SREG                                       46
+     clear r1                                          1
+     postscale_running, gate_state and gate_target     9
+     TCNT1 against the window, or the table index     12
+       or 10 more for the DDS phase
+     count down gate_cycles_left                      12
+     reti                                              4
+                                                90 or 100 */
+static inline void gate_step(void)
+{
+  uint8_t state;
+  uint8_t cycle_end;
+  uint8_t in_window;
+  uint16_t count;
+#if OUT_DDS
+  uint32_t phase;
+#else
+  uint8_t index;
+  uint8_t last;
+#endif
+
+  state = gate_state;
+  if (gate_target == GATE_TABLE)
+  {
+#if OUT_DDS
+    /* The phase wraps round at the next sample, or already has
+       if this comes after TOP */
+    phase = dds_phase;
+    if (TCNT1 < gate_compare)
+    {
+      cycle_end = (phase < dds_tuning_word);
+    }
+    else
+    {
+      cycle_end = (phase > ~dds_tuning_word);
+    }
+#else
+#if OUT_FLASH_TABLE
+    index = TCNT0;
+    last = 0 - flash_stride;
+#elif OUT_FIXED_REGS
+    index = table_index;
+    last = table_mask;
+#else
+    index = TCNT0;
+    last = table_mask;
+#endif
+    if (TCNT1 < gate_compare)
+    {
+      /* Behind TOP, so the next sample is already out */
+      last = 0;
+    }
+    cycle_end = (index == last);
+#endif
+    in_window = 1;
+  }
+  else
+  {
+    count = TCNT1;
+    cycle_end = 1;
+    in_window = (count > gate_compare) && (count <= gate_last_count);
+  }
+
+  if (state == GATE_COUNT)
+  {
+    if (!cycle_end)
+    {
+      return;
+    }
+    if (gate_cycles_left > 1)
+    {
+      gate_cycles_left--;
+      return;
+    }
+    gate_state = GATE_STOP;
+    state = GATE_STOP;
+  }
+
+  if (state == GATE_STOP)
+  {
+    if (gate_running)
+    {
+      if (!(cycle_end && in_window))
+      {
+        return;
+      }
+      gate_output(0);
+    }
+    if (gate_mode == OUT_GATE_BURST)
+    {
+      on = 0;
+    }
+  }
+  else /* GATE_START */
+  {
+    if (!in_window)
+    {
+      return;
+    }
+    if (!gate_running)
+    {
+      gate_output(1);
+    }
+    if (gate_mode == OUT_GATE_BURST)
+    {
+      gate_cycles_left = burst_cycles;
+      gate_state = GATE_COUNT;
+      return;
+    }
+  }
+  gate_state = GATE_IDLE;
+  TIMSK &= ~(1<<OCIE1A);
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+#if OUT_POSTSCALE
+  if (postscale_running)
+  {
+    postscale_step();
+    return;
+  }
+#endif
+  gate_step();
+}
+
+#if OUT_SYNC
+static inline void sync_step(void);
+#endif
+
+/* INT0 triggers a burst on a falling edge, or starts and stops the
+   output on any change in OUT_GATE_INT0. Only used for square waves
+   and pulses. */
+ISR(INT0_vect)
+{
+#if OUT_SYNC
+  if (sync_source == SYNC_INT0)
+  {
+    sync_step();
+    return;
+  }
+#endif
+  if (gate_mode == OUT_GATE_BURST)
+  {
+    if (!on)
+    {
+      on = 1;
+      gate_arm(GATE_START);
+    }
+  }
+  else
+  {
+    gate_follow_int0();
+  }
+}
+
+#endif
+
+#if OUT_SYNC
+
+/* Sets up the sync input for the waveform as it's now set up. INT0 is
+   only free for it when the DAC lines are inputs and gating doesn't
+   use it. */
+static void sync_settle(void)
+{
+  uint8_t source;
+
+  source = SYNC_NONE;
+  if (sync_on)
+  {
+    source = is_sampled() ? SYNC_COMPARATOR : SYNC_INT0;
+#if OUT_POSTSCALE
+    if (postscale_running)
+    {
+      source = SYNC_NONE;
+    }
+#endif
+#if OUT_LFSR
+    /* Noise has no start of a cycle */
+    if (noise_running)
+    {
+      source = SYNC_NONE;
+    }
+#endif
+#if OUT_CHANNEL_B
+    /* A missed toggle would swap OC1B over */
+    if (timer_channel_b == OUT_CHANNEL_B_PHASE)
+    {
+      source = SYNC_NONE;
+    }
+#endif
+#if OUT_GATE
+    if ((source == SYNC_INT0) && (gate_mode != OUT_GATE_NONE))
+    {
+      source = SYNC_NONE;
+    }
+#endif
+  }
+
+  cli();
+  if (sync_source == SYNC_INT0)
+  {
+    GICR &= ~(1<<INT0);
+  }
+  if (source == SYNC_INT0)
+  {
+    /* Rising edge, pulled up */
+    PORTD |= 1<<PD2;
+    MCUCR |= (1<<ISC01)|(1<<ISC00);
+    GIFR = 1<<INTF0;
+    GICR |= 1<<INT0;
+  }
+  if (source == SYNC_COMPARATOR)
+  {
+    /* AIN1 (PD7) against the bandgap on AIN0: the comparator output
+       falls as AIN1 rises through it. The edge is set before the
+       interrupt is enabled, so as not to trigger it. */
+    ACSR = (1<<ACBG)|(1<<ACIS1);
+    ACSR = (1<<ACBG)|(1<<ACI)|(1<<ACIE)|(1<<ACIS1);
+  }
+  else
+  {
+    ACSR = 0;
+  }
+  sync_source = source;
+  sei();
+}
+
+/* Runs the timer up to TOP, from a fresh prescaler, so that the next
+   period starts exactly two timer clocks after the write to TCNT1, with
+   OC1A rising or the first sample of the table going out. The cycle in
+   progress is cut short. TCNT1 stops at TOP - 1 rather than TOP, as
+   writing it blocks the compare on the next timer clock.
+   From the edge to the write to TCNT1, for the C ISR at -Os:
+     interrupt response + rjmp in the vector table     6
+     push r0, r1, r24, r25 and SREG, clear r1         11
+     read ICR1, less 1, write TCNT1                    6
+                                                      23 */
+static inline void sync_step(void)
+{
+  TCNT1 = ICR1 - 1;
+  SFIOR |= 1<<PSR10;
+  if (sync_source == SYNC_COMPARATOR)
+  {
+    restart_table();
+  }
+}
+
+ISR(ANA_COMP_vect)
+{
+  sync_step();
+}
+
+#if !OUT_GATE
+ISR(INT0_vect)
+{
+  sync_step();
+}
+#endif
+
+#endif
+
+#if OUT_SWEEP
+
+/* Works out the Timer1 settings for every step of the sweep, from the
+   frequency just set up to the stop frequency, and starts it from the
+   first step. Square waves and pulses have one timer period per step;
+   triangle and sine waves a table length that fits the highest
+   frequency, as the table can't be rebuilt between steps. Periods aren't
+   dithered, since there is nothing to work out the dither from. */
+static void sweep_settle(void)
+{
+  PLAN_search_t plan;
+  uint32_t start;
+  uint32_t stop;
+  uint32_t value;
+  uint32_t width_ns;
+  uint8_t i;
+
+#if OUT_SEQUENCE
+  if ((sweep_mode == OUT_SWEEP_OFF) || (sweep_steps < 2) || (sequence_mode != OUT_SEQUENCE_OFF))
+#else
+  if ((sweep_mode == OUT_SWEEP_OFF) || (sweep_steps < 2))
+#endif
+  {
+    DDRB &= ~(1<<PB7);
+    return;
+  }
+#if OUT_POSTSCALE
+  if (postscale_running)
+  {
+    return;
+  }
+#endif
+#if OUT_LFSR
+  if (noise_running)
+  {
+    return;
+  }
+#endif
+#if OUT_CHANNEL_B
+  /* Every change in that mode restarts the timer */
+  if (timer_channel_b == OUT_CHANNEL_B_PHASE)
+  {
+    return;
+  }
+#endif
+
+  start = freq_mHz;
+  stop = sweep_stop_mHz;
+  range_limit(&stop);
+  if (is_sampled() && (stop > OUT_MAX_NON_SQUARE_FREQUENCY_mHz))
+  {
+    stop = OUT_MAX_NON_SQUARE_FREQUENCY_mHz;
+  }
+#if OUT_GATE
+  if ((gate_mode != OUT_GATE_NONE) && !is_sampled() && (stop > OUT_GATE_MAX_FREQUENCY_mHz))
+  {
+    stop = OUT_GATE_MAX_FREQUENCY_mHz;
+  }
+#endif
+
+#if OUT_DITHER
+  TIMSK &= ~(1<<OCIE1B);
+#endif
+
+#if OUT_DDS
+  if (dds_running)
+  {
+    for (i = 0; i < sweep_steps; i++)
+    {
+      value = PLAN_sweep_value(start, stop, i, sweep_steps - 1, sweep_mode == OUT_SWEEP_LOG);
+      sweep_table[i].tuning_word = div_64_32(value, sample_rate_mHz/2, sample_rate_mHz);
+      if (sweep_table[i].tuning_word == 0)
+      {
+        sweep_table[i].tuning_word = 1;
+      }
+    }
+  }
+  else
+#endif
+  {
+#if !OUT_DDS
+    if (is_sampled())
+    {
+      /* The longest table the highest frequency allows */
+      PLAN_search(&plan, OUT_FREQ_MODE, (stop > start) ? stop : start, duty_cycle,
+                  OUT_MIN_WAVEFORM_LENGTH_BITS, OUT_MAX_WAVEFORM_LENGTH_BITS);
+      if (plan.table_length_bits != table_length_bits)
+      {
+        table_length_bits = plan.table_length_bits;
+        recompute_waveform(waveform);
+      }
+    }
+#endif
+    for (i = 0; i < sweep_steps; i++)
+    {
+      value = PLAN_sweep_value(start, stop, i, sweep_steps - 1, sweep_mode == OUT_SWEEP_LOG);
+      if (waveform == OUT_SQUARE)
+      {
+        PLAN_timer(&plan.timer, OUT_FREQ_MODE, value, duty_cycle);
+      }
+      else if (waveform == OUT_PULSE)
+      {
+        PLAN_pulse(&plan.timer, OUT_FREQ_MODE, value, pulse_width_ns, &width_ns);
+      }
+      else
+      {
+        PLAN_search(&plan, OUT_FREQ_MODE, value, duty_cycle, table_length_bits, table_length_bits);
+#if OUT_GATE
+        plan.timer.compare = gate_sample_compare(plan.timer.top, plan.timer.clock_select);
+#endif
+      }
+      sweep_table[i].timer.top = plan.timer.top;
+      sweep_table[i].timer.compare = plan.timer.compare;
+      sweep_table[i].timer.clock_select = plan.timer.clock_select;
+    }
+  }
+
+  /* PB7 marks the first step */
+  PORTB &= ~(1<<PB7);
+  DDRB |= 1<<PB7;
+
+  sweep_dwell_ticks = (uint16_t)(((uint32_t)sweep_dwell_ms * OUT_TICK_HZ + 500) / 1000);
+  if (sweep_dwell_ticks == 0)
+  {
+    sweep_dwell_ticks = 1;
+  }
+  sweep_step = 0;
+  sweep_commit();
+  sweep_running = 1;
+}
+
+/* Puts the current step into Timer1 at the end of its period,
+   and starts its dwell time. It's called from OUT_tick, so the retune
+   runs in the capture interrupt rather than polling for TOP. */
+static void sweep_commit(void)
+{
+  PLAN_timer_t timer;
+  timer_step_t* step;
+
+  step = &sweep_table[sweep_step];
+#if OUT_DDS
+  if (dds_running)
+  {
+    /* The ISR reads the tuning word a byte at a time */
+    cli();
+    dds_tuning_word = step->tuning_word;
+    sei();
+  }
+  else
+#endif
+  {
+    timer.clock_select = step->timer.clock_select;
+    timer.top = step->timer.top;
+    timer.compare = step->timer.compare;
+    timer.compare_b = timer.compare;
+#if OUT_CHANNEL_B
+    if (timer_channel_b == OUT_CHANNEL_B_IN_PHASE)
+    {
+      timer.compare_b = PLAN_compare(timer.top, channel_b_duty);
+    }
+#endif
+    cli();
+    RETUNE_set_async(&timer, 0);
+    timer_top = timer.top;
+#if OUT_GATE
+    gate_margin = (GATE_MARGIN >> PLAN_prescaler_shift(timer.clock_select)) + 1;
+    gate_set_compare(timer.compare);
+#endif
+  }
+
+  if (sweep_step == 0)
+  {
+    PORTB |= 1<<PB7;
+  }
+  else
+  {
+    PORTB &= ~(1<<PB7);
+  }
+  sweep_ticks_left = sweep_dwell_ticks;
+}
+
+#endif
+
+#if OUT_SEQUENCE
+
+/* Reads the segments from STORE and works out the Timer1 settings for
+   each, then starts playing from the first. Frequencies outside the
+   range of a segment's waveform are brought into it. */
+static void sequence_settle(void)
+{
+  STORE_segment_t segment;
+  PLAN_search_t plan;
+  sequence_segment_t* entry;
+  uint32_t f_cpu;
+  uint32_t highest;
+  uint32_t width_ns;
+#if OUT_DDS
+  uint32_t sample_freq_mHz;
+#endif
+  uint8_t i;
+
+  sequence_length = 0;
+  if (sequence_mode == OUT_SEQUENCE_OFF)
+  {
+    return;
+  }
+#if OUT_GATE
+  if (gate_mode != OUT_GATE_NONE)
+  {
+    return;
+  }
+#endif
+
+  /* Every segment takes over the whole of Timer1 */
+#if OUT_DITHER
+  TIMSK &= ~(1<<OCIE1B);
+#endif
+#if OUT_POSTSCALE
+  stop_postscale();
+#endif
+#if OUT_LFSR
+  stop_noise();
+#endif
+#if OUT_CHANNEL_B
+  cli();
+  set_channel_b_mode(OUT_CHANNEL_B_OFF, 0);
+  sei();
+  PLAN_set_channel_b(OUT_CHANNEL_B_OFF, 0, 0);
+#endif
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal + 32L*fine_cal);
+  PLAN_set_f_cpu(f_cpu);
+
+  /* The frequencies go in the table for now */
+  highest = 0;
+  for (i = 0; i < OUT_SEQUENCE_MAX_SEGMENTS; i++)
+  {
+    STORE_get_segment(i, &segment);
+    /* Noise needs the compare B interrupt, so it ends a sequence too */
+    if ((segment.waveform > OUT_PULSE) || (segment.duration_ms == 0))
+    {
+      break;
+    }
+    entry = &sequence_table[i];
+    entry->waveform = segment.waveform;
+    entry->ticks = (uint16_t)(((uint32_t)segment.duration_ms * OUT_TICK_HZ + 500) / 1000);
+    if (entry->ticks == 0)
+    {
+      entry->ticks = 1;
+    }
+    range_limit(&segment.freq_mHz);
+    if ((segment.waveform == OUT_TRIANGLE) || (segment.waveform == OUT_SINE))
+    {
+      if (segment.freq_mHz > OUT_MAX_NON_SQUARE_FREQUENCY_mHz)
+      {
+        segment.freq_mHz = OUT_MAX_NON_SQUARE_FREQUENCY_mHz;
+      }
+      if (segment.freq_mHz > highest)
+      {
+        highest = segment.freq_mHz;
+      }
+    }
+    entry->step.tuning_word = segment.freq_mHz;
+  }
+  if (i == 0)
+  {
+    return;
+  }
+  sequence_length = i;
+
+#if OUT_DDS
+  /* The sample rate for triangle and sine waves */
+  sequence_dds_timer.timer.clock_select = 1;
+  sequence_dds_timer.timer.top = OUT_DDS_SAMPLE_CLOCKS - 1;
+#if OUT_PWM_DAC
+  sequence_dds_timer.timer.compare = TABLE_CENTRE;
+#else
+  sequence_dds_timer.timer.compare = PLAN_compare(OUT_DDS_SAMPLE_CLOCKS - 1, duty_cycle);
+#endif
+  sample_freq_mHz = (F_CPU_MUL * f_cpu) / (OUT_DDS_SAMPLE_CLOCKS / F_OUT_DIV);
+#if OUT_TWO_TONE
+  /* Segments are single tones */
+  cli();
+  tone_scale[0] = tone_scale_for(amplitude);
+  tone_scale[1] = 0;
+  sei();
+#endif
+#else
+  if (highest != 0)
+  {
+    /* The longest table the highest frequency allows */
+    PLAN_search(&plan, OUT_FREQ_MODE, highest, duty_cycle,
+                OUT_MIN_WAVEFORM_LENGTH_BITS, OUT_MAX_WAVEFORM_LENGTH_BITS);
+    table_length_bits = plan.table_length_bits;
+  }
+#endif
+
+  for (i = 0; i < sequence_length; i++)
+  {
+    entry = &sequence_table[i];
+#if OUT_DDS
+    if ((entry->waveform == OUT_TRIANGLE) || (entry->waveform == OUT_SINE))
+    {
+      entry->step.tuning_word = div_64_32(entry->step.tuning_word, sample_freq_mHz/2, sample_freq_mHz);
+      if (entry->step.tuning_word == 0)
+      {
+        entry->step.tuning_word = 1;
+      }
+      continue;
+    }
+#endif
+    if (entry->waveform == OUT_SQUARE)
+    {
+      PLAN_timer(&plan.timer, OUT_FREQ_MODE, entry->step.tuning_word, duty_cycle);
+    }
+    else if (entry->waveform == OUT_PULSE)
+    {
+      PLAN_pulse(&plan.timer, OUT_FREQ_MODE, entry->step.tuning_word, pulse_width_ns, &width_ns);
+    }
+    else
+    {
+      PLAN_search(&plan, OUT_FREQ_MODE, entry->step.tuning_word, duty_cycle,
+                  table_length_bits, table_length_bits);
+    }
+    entry->step.timer.top = plan.timer.top;
+    entry->step.timer.compare = plan.timer.compare;
+    entry->step.timer.clock_select = plan.timer.clock_select;
+  }
+
+#if OUT_FLASH_TABLE
+  sequence_shape = OUT_SQUARE;
+#else
+  if (highest != 0)
+  {
+    /* Both tables, so that a switch between them only moves table_base */
+    recompute_waveform(OUT_TRIANGLE);
+    build_waveform(sequence_sine_data, OUT_SINE);
+  }
+#endif
+#if OUT_DDS
+  /* Whatever the table holds when the sequence stops, build it again */
+  dds_table_waveform = OUT_SQUARE;
+#endif
+  sequence_segment = 0;
+  sequence_commit();
+  sequence_running = 1;
+}
+
+/* Switches to the current segment: its waveform at once, and its
+   Timer1 settings at the end of the current period. It's called from
+   OUT_tick, so the tables are all built beforehand, and the retune
+   runs in the capture interrupt rather than polling for TOP. */
+static void sequence_commit(void)
+{
+  PLAN_timer_t timer;
+  sequence_segment_t* entry;
+  const timer_step_t* step;
+  uint8_t shape;
+
+  entry = &sequence_table[sequence_segment];
+  shape = entry->waveform;
+  step = &entry->step;
+
+  if ((shape == OUT_TRIANGLE) || (shape == OUT_SINE))
+  {
+#if OUT_FLASH_TABLE
+    if (shape != sequence_shape)
+    {
+      /* Only points the ISR at the other quarter-wave */
+      recompute_waveform(shape);
+      sequence_shape = shape;
+    }
+#else
+    cli();
+    table_base = (shape == OUT_SINE) ? sequence_sine_data : waveform_data;
+    sei();
+#endif
+#if OUT_DDS
+    cli();
+    dds_tuning_word = step->tuning_word;
+    sei();
+    if (dds_running)
+    {
+      /* Timer1 is already at the sample rate */
+      sequence_ticks_left = entry->ticks;
+      return;
+    }
+    dds_running = 1;
+    step = &sequence_dds_timer;
+#endif
+    cli();
+    TIMSK |= 1<<TOIE1;
+    sei();
+#if !OUT_PWM_DAC
+    DAC_PINS_OUT();
+#endif
   }
-  else if ((period_clocks + 4) <= 65536*8)
+  else
   {
-    prescaler = 8;
-    prescaler_bits = (0<<CS12)|(1<<CS11)|(0<<CS10);
-    period_clocks = (period_clocks + 4) / 8;
+#if OUT_DDS
+    dds_running = 0;
+#endif
+    cli();
+    TIMSK &= ~(1<<TOIE1);
+    sei();
+    DDRD &= (uint8_t)~DAC_PINS;
   }
-  else if ((period_clocks + 32) <= 65536*64)
+
+  timer.clock_select = step->timer.clock_select;
+  timer.top = step->timer.top;
+  timer.compare = step->timer.compare;
+  timer.compare_b = timer.compare;
+  cli();
+  RETUNE_set_async(&timer, 0);
+  timer_top = timer.top;
+  sequence_ticks_left = entry->ticks;
+}
+
+#endif
+
+void OUT_tick(void)
+{
+#if OUT_SWEEP
+  if (sweep_running && (--sweep_ticks_left == 0))
   {
-    prescaler = 64;
-    prescaler_bits = (0<<CS12)|(1<<CS11)|(1<<CS10);
-    period_clocks = (period_clocks + 32) / 64;
+    if (sweep_step < sweep_steps - 1)
+    {
+      sweep_step++;
+    }
+    else
+    {
+      sweep_step = 0;
+    }
+    sweep_commit();
   }
-  else if ((period_clocks + 128) <= 65536*256)
+#endif
+#if OUT_SEQUENCE
+  if (!sequence_running)
   {
-    prescaler = 156;
-    prescaler_bits = (1<<CS12)|(0<<CS11)|(0<<CS10);
-    period_clocks = (period_clocks + 128) / 256;
+    return;
   }
-  else
+  if (--sequence_ticks_left != 0)
   {
-    prescaler = 1024;
-    prescaler_bits = (1<<CS12)|(0<<CS11)|(1<<CS10);
-    period_clocks = (period_clocks + 512) / 1024;
-    if (period_clocks > 65536)
-    {
-      period_clocks = 65536;
-    }
+    return;
   }
-
-  /* Set up the timer accordingly */
-  TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
-  TCCR1B |= prescaler_bits;
-  oc = (uint16_t)((period_clocks * duty_cycle + 50) / 100);
-  if (oc > 0)
+  if (sequence_segment < sequence_length - 1)
   {
-    oc--;
+    sequence_segment++;
   }
-  cli();
-  OCR1A = 0;
-  ICR1 = (uint16_t)period_clocks - 1;
-  TCNT1 = 0;
-  OCR1A = oc;
-  sei();
-
-  // Compute the actual period
-  timer_period_ns = period_clocks * prescaler * f_period_ns;
-
-  // Compute the actual frequency
-  timer_freq_mHz = (F_CPU_MUL * f_cpu) / ((period_clocks * prescaler + F_OUT_DIV/2) / F_OUT_DIV);
-
-  if (waveform == OUT_SQUARE)
+  else if (sequence_mode == OUT_SEQUENCE_LOOP)
   {
-    period_ns = timer_period_ns;
-    freq_mHz = timer_freq_mHz;
+    sequence_segment = 0;
   }
   else
   {
-    period_ns = timer_period_ns * WAVEFORM_LENGTH;
-    freq_mHz = timer_freq_mHz / WAVEFORM_LENGTH;
-    recompute_waveform();
-    TIMSK |= 1<<TOIE1;
-    DDRD |= (1<<PD0)|(1<<PD1)|(1<<PD2)|(1<<PD3)|(1<<PD4);
+    /* Hold the last one */
+    sequence_running = 0;
+    return;
   }
+  sequence_commit();
+#endif
 }
 
-static void range_limit(uint32_t* n)
+void OUT_set_freq_mode(uint8_t new_value)
 {
-  if (*n < 250)
-  {
-    *n = 250;
-  }
-  if (*n > 4UL*1000UL*1000UL*1000UL)
-  {
-    *n = 4UL*1000UL*1000UL*1000UL;
-  }
+  freq_mode = new_value;
+  requested = (freq_mode == OUT_PERIOD_MODE) ? period_ns : freq_mHz;
 }
-
-static void recompute_waveform(void)
+uint8_t OUT_get_freq_mode(void)
 {
-  uint8_t i;
-  uint8_t half_inverse_symmetrical;
-  uint8_t quadrant_symmetrical;
+  return freq_mode;
+}
 
-  switch (waveform)
+void OUT_set_on(uint8_t new_value)
+{
+#if OUT_GATE
+  cli();
+  if ((gate_target == GATE_PB1) || (gate_target == GATE_FIXED))
   {
-  case OUT_SQUARE:
-  default:
-    for (i = 0; i < WAVEFORM_LENGTH/4; i++)
+    /* Not at a cycle boundary, and no bursts */
+    if (gate_mode != OUT_GATE_BURST)
     {
-      waveform_data[i] = DAC_CENTRE + DAC_AMPL;
+      on = new_value;
+      gate_output(on);
     }
-    quadrant_symmetrical = 1;
-    half_inverse_symmetrical = 1;
-    break;
-
-  case OUT_TRIANGLE:
-    for (i = 0; i <= WAVEFORM_LENGTH/4; i++)
+  }
+  else if (gate_mode == OUT_GATE_BURST)
+  {
+    if (new_value && !on)
     {
-      waveform_data[i] = DAC_CENTRE + DAC_AMPL * (int)i / (WAVEFORM_LENGTH/4);
+      on = 1;
+      gate_arm(GATE_START);
     }
-    for (i = 1; i < WAVEFORM_LENGTH/4; i++)
+    else if (!new_value && on)
     {
-      waveform_data[WAVEFORM_LENGTH/4 + i] = waveform_data[WAVEFORM_LENGTH/4+1 - i];
+      /* Cut the burst short at the end of this cycle */
+      gate_arm(GATE_STOP);
     }
-    quadrant_symmetrical = 0;
-    half_inverse_symmetrical = 1;
-    break;
-
-  case OUT_SINE:
-    waveform_data[0] = (uint16_t)(DAC_CENTRE + SIN__1_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[1] = (uint16_t)(DAC_CENTRE + SIN__3_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[2] = (uint16_t)(DAC_CENTRE + SIN__5_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[3] = (uint16_t)(DAC_CENTRE + SIN__7_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[4] = (uint16_t)(DAC_CENTRE + SIN__9_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[5] = (uint16_t)(DAC_CENTRE + SIN_11_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[6] = (uint16_t)(DAC_CENTRE + SIN_13_OVER_32_PI * DAC_AMPL + 0.5);
-    waveform_data[7] = (uint16_t)(DAC_CENTRE + SIN_15_OVER_32_PI * DAC_AMPL + 0.5);
-    half_inverse_symmetrical = 1;
-    quadrant_symmetrical = 1;
-    break;
   }
-
-  if (quadrant_symmetrical)
+  else if ((gate_mode == OUT_GATE_INT0) && (gate_target == GATE_OC1A))
   {
-    /* second quadrant is the reverse of the first quadrant */
-    for (i = 0; i < WAVEFORM_LENGTH/4; i++)
+    on = new_value;
+    if (on)
     {
-      waveform_data[WAVEFORM_LENGTH/4 + i] = waveform_data[WAVEFORM_LENGTH/4-1 - i];
+      GIFR = 1<<INTF0;
+      GICR |= 1<<INT0;
+      gate_follow_int0();
     }
-  }
-
-  if (half_inverse_symmetrical)
-  {
-    /* second half is the reverse of the first half,
-       mirrored about the time axis */
-    for (i = 0; i < WAVEFORM_LENGTH/2; i++)
+    else
     {
-      waveform_data[WAVEFORM_LENGTH - 1 - i] = DAC_CENTRE - (waveform_data[i] - DAC_CENTRE);
+      GICR &= ~(1<<INT0);
+      gate_arm(GATE_STOP);
     }
   }
+  else
+  {
+    on = new_value;
+    gate_arm(on ? GATE_START : GATE_STOP);
+  }
+  sei();
+#else
+  on = new_value;
+#endif
+}
+uint8_t OUT_get_on(void)
+{
+  return on;
+}
+
+#if OUT_SYNC
+void OUT_set_sync(uint8_t new_value)
+{
+  sync_on = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_sync(void)
+{
+  return sync_on;
+}
+#endif
+
+#if OUT_GATE
+void OUT_set_gate(uint8_t new_value)
+{
+  gate_mode = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_gate(void)
+{
+  return gate_mode;
+}
 
-  /* Scale the data taking the amplitude into account */
-  for (i = 0; i < WAVEFORM_LENGTH; i++)
+void OUT_set_burst_cycles(uint16_t new_value)
+{
+  if (new_value == 0)
   {
-    waveform_data[i] = (uint16_t)(((int32_t)waveform_data[i] - DAC_CENTRE) * amplitude / 100 + DAC_CENTRE);
+    new_value = 1;
   }
+  burst_cycles = new_value;
+}
+uint16_t OUT_get_burst_cycles(void)
+{
+  return burst_cycles;
 }
+#endif
 
-ISR(TIMER1_OVF_vect)
+#if OUT_SEQUENCE
+void OUT_set_sequence(uint8_t new_value)
 {
-  uint8_t next_index = TCNT0; // TCNT0 is static storage for the waveform index
-  next_index++;
-  next_index %= WAVEFORM_LENGTH;
-  TCNT0 = next_index;
-  PORTD = waveform_data[next_index];
+  sequence_mode = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_sequence(void)
+{
+  return sequence_mode;
 }
 
-void OUT_set_freq_mode(uint8_t new_value)
+uint8_t OUT_get_sequence_segment(void)
 {
-  freq_mode = new_value;
+  return (sequence_length != 0) ? sequence_segment : 0;
 }
-uint8_t OUT_get_freq_mode(void)
+uint8_t OUT_get_sequence_length(void)
 {
-  return freq_mode;
+  return sequence_length;
 }
+#endif
 
-void OUT_set_on(uint8_t new_value)
+#if OUT_SWEEP
+void OUT_set_sweep(uint8_t new_value)
 {
-  on = new_value; // TODO
+  sweep_mode = new_value;
+  OUT_recompute_actual();
 }
-uint8_t OUT_get_on(void)
+uint8_t OUT_get_sweep(void)
 {
-  return on;
+  return sweep_mode;
+}
+
+void OUT_set_sweep_stop_mHz(uint32_t new_value)
+{
+  sweep_stop_mHz = new_value;
+  OUT_recompute_actual();
+}
+uint32_t OUT_get_sweep_stop_mHz(void)
+{
+  return sweep_stop_mHz;
+}
+
+void OUT_set_sweep_steps(uint8_t new_value)
+{
+  if (new_value < 2)
+  {
+    new_value = 2;
+  }
+  if (new_value > OUT_SWEEP_MAX_STEPS)
+  {
+    new_value = OUT_SWEEP_MAX_STEPS;
+  }
+  sweep_steps = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_sweep_steps(void)
+{
+  return sweep_steps;
+}
+
+void OUT_set_sweep_dwell_ms(uint16_t new_value)
+{
+  if (new_value > 60000)
+  {
+    new_value = 60000;
+  }
+  sweep_dwell_ms = new_value;
+  OUT_recompute_actual();
+}
+uint16_t OUT_get_sweep_dwell_ms(void)
+{
+  return sweep_dwell_ms;
+}
+
+uint8_t OUT_get_sweep_step(void)
+{
+  return sweep_running ? sweep_step : 0;
 }
+#endif
 
 void OUT_set_fine_cal(int8_t new_value)
 {
@@ -357,23 +3476,46 @@ void OUT_set_waveform(uint8_t new_value)
 {
   waveform = new_value;
 
-  if (waveform != OUT_SQUARE)
+  if (is_sampled())
   {
     if (freq_mode == OUT_PERIOD_MODE)
     {
       while (period_ns < OUT_MIN_NON_SQUARE_PERIOD_NS)
       {
         period_ns *= 10;
+        requested = period_ns;
+      }
+    }
+    else /* frequency mode */
+    {
+      while (freq_mHz > OUT_MAX_NON_SQUARE_FREQUENCY_mHz)
+      {
+        freq_mHz /= 10;
+        requested = freq_mHz;
+      }
+    }
+  }
+#if OUT_LFSR
+  else if (waveform == OUT_NOISE)
+  {
+    if (freq_mode == OUT_PERIOD_MODE)
+    {
+      while (period_ns < OUT_MIN_NOISE_PERIOD_NS)
+      {
+        period_ns *= 10;
+        requested = period_ns;
       }
     }
     else /* frequency mode */
     {
-      if (freq_mHz > OUT_MAX_NON_SQUARE_FREQUENCY_mHz)
+      while (freq_mHz > OUT_MAX_NOISE_FREQUENCY_mHz)
       {
         freq_mHz /= 10;
+        requested = freq_mHz;
       }
     }
   }
+#endif
 
   OUT_recompute_actual();
 }
@@ -385,6 +3527,7 @@ uint8_t OUT_get_waveform(void)
 void OUT_set_freq_mHz(uint32_t new_value)
 {
   freq_mHz = new_value;
+  requested = new_value;
 }
 uint32_t OUT_get_freq_mHz(void)
 {
@@ -394,20 +3537,163 @@ uint32_t OUT_get_freq_mHz(void)
 void OUT_set_period_ns(uint32_t new_value)
 {
   period_ns = new_value;
+  requested = new_value;
 }
 uint32_t OUT_get_period_ns(void)
 {
   return period_ns;
 }
 
-void OUT_set_duty_cycle_percent(uint8_t new_value)
+void OUT_set_duty_cycle_permille(uint16_t new_value)
 {
+  uint16_t compare;
+
   duty_cycle = new_value;
+  if (waveform == OUT_PULSE)
+  {
+    /* Set by the width instead */
+    return;
+  }
+#if OUT_LFSR
+  if (waveform == OUT_NOISE)
+  {
+    return;
+  }
+#endif
+#if OUT_CHANNEL_B
+  if (channel_b_mode() == OUT_CHANNEL_B_INVERTED)
+  {
+    /* OC1B follows OC1A */
+    OUT_recompute_actual();
+    return;
+  }
+  if (channel_b_mode() == OUT_CHANNEL_B_PHASE)
+  {
+    /* Both are at 50% while toggling */
+    return;
+  }
+#endif
+#if OUT_POSTSCALE
+  if (postscale_running)
+  {
+    /* The parts of the cycle are counted in software */
+    OUT_recompute_actual();
+    return;
+  }
+#endif
+
+#if OUT_GATE
+  if (is_sampled())
+  {
+    /* OCR1A is where the gate ISR runs */
+    return;
+  }
+#endif
+#if OUT_PWM_DAC
+  if (is_sampled())
+  {
+    /* OCR1A is the DAC */
+    return;
+  }
+#endif
+#if OUT_SWEEP
+  if (sweep_running)
+  {
+    /* Every step has its own compare */
+    OUT_recompute_actual();
+    return;
+  }
+#endif
+#if OUT_SEQUENCE
+  if (sequence_length != 0)
+  {
+    /* So does every segment */
+    OUT_recompute_actual();
+    return;
+  }
+#endif
+
+  /* Only OCR1A changes, so there is nothing to plan again */
+  compare = PLAN_compare(timer_top, duty_cycle);
+  cli();
+  RETUNE_set_compare(compare);
+#if OUT_GATE
+  gate_set_compare(compare);
+#endif
 }
-uint8_t OUT_get_duty_cycle_percent(void)
+uint16_t OUT_get_duty_cycle_permille(void)
 {
   return duty_cycle;
 }
+uint8_t OUT_get_duty_cycle_fine(void)
+{
+  return timer_top >= 999;
+}
+
+void OUT_set_pulse_width_ns(uint32_t new_value)
+{
+  /* As it is, until it's planned as a pulse */
+  pulse_width_ns = new_value;
+  pulse_width_actual_ns = new_value;
+  pulse_width_fits = 1;
+  OUT_recompute_actual();
+}
+uint32_t OUT_get_pulse_width_ns(void)
+{
+  return pulse_width_ns;
+}
+uint32_t OUT_get_pulse_width_actual_ns(void)
+{
+  return pulse_width_actual_ns;
+}
+uint8_t OUT_get_pulse_width_fits(void)
+{
+  return pulse_width_fits;
+}
+
+#if OUT_CHANNEL_B
+void OUT_set_channel_b(uint8_t new_value)
+{
+  channel_b = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_channel_b(void)
+{
+  return channel_b;
+}
+
+void OUT_set_channel_b_phase_degrees(uint16_t new_value)
+{
+  channel_b_phase = new_value;
+  OUT_recompute_actual();
+}
+uint16_t OUT_get_channel_b_phase_degrees(void)
+{
+  return channel_b_phase;
+}
+
+void OUT_set_channel_b_duty_cycle_permille(uint16_t new_value)
+{
+  channel_b_duty = new_value;
+  OUT_recompute_actual();
+}
+uint16_t OUT_get_channel_b_duty_cycle_permille(void)
+{
+  return channel_b_duty;
+}
+#endif
+
+#if OUT_LFSR
+void OUT_set_prbs(uint8_t new_value)
+{
+  prbs = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_prbs(void)
+{
+  return prbs;
+}
+#endif
 
 void OUT_set_amplitude_percent(uint8_t new_value)
 {
@@ -419,3 +3705,80 @@ uint8_t OUT_get_amplitude_percent(void)
   return amplitude;
 }
 
+#if OUT_SHAPING
+void OUT_set_shaping(uint8_t new_value)
+{
+  shaping = new_value;
+#if OUT_DDS
+  dds_table_waveform = OUT_SQUARE;   // so that recompute_dds builds it again
+#endif
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_shaping(void)
+{
+  return shaping;
+}
+#endif
+
+#if OUT_UPLOAD
+void OUT_set_arbitrary(const int8_t* samples)
+{
+  uint16_t i;
+
+  for (i = 0; i < MAX_WAVEFORM_LENGTH; i++)
+  {
+    arbitrary_data[i] = (samples[i] == -128) ? -127 : samples[i];
+  }
+  STORE_set_arbitrary(arbitrary_data);
+
+  if (waveform == OUT_ARBITRARY)
+  {
+#if OUT_DDS
+    dds_table_waveform = OUT_SQUARE;   // so that recompute_dds builds it again
+#endif
+    OUT_recompute_actual();
+  }
+}
+#endif
+
+#if OUT_TWO_TONE
+void OUT_set_tone2_freq_mHz(uint32_t new_value)
+{
+  tone2_freq_mHz = new_value;
+  OUT_recompute_actual();
+}
+uint32_t OUT_get_tone2_freq_mHz(void)
+{
+  return tone2_freq_mHz;
+}
+
+void OUT_set_tone2_amplitude_percent(uint8_t new_value)
+{
+  tone2_amplitude = new_value;
+  OUT_recompute_actual();
+}
+uint8_t OUT_get_tone2_amplitude_percent(void)
+{
+  return tone2_amplitude;
+}
+#endif
+
+uint32_t OUT_get_sample_rate_mHz(void)
+{
+  return sample_rate_mHz;
+}
+
+uint16_t OUT_get_table_length(void)
+{
+  if (sample_rate_mHz == 0)
+  {
+    return 0;
+  }
+  return 1U << table_length_bits;
+}
+
+uint16_t OUT_get_error_ppm(void)
+{
+  return error_ppm;
+}
+
@@ -9,24 +9,433 @@ extern "C" {
 #define OUT_SQUARE   0
 #define OUT_TRIANGLE 1
 #define OUT_SINE     2
-#define OUT_WAVEFORM_LAST  2
+#define OUT_PULSE    3
+#define OUT_NOISE    4  /* OUT_LFSR only */
+#define OUT_ARBITRARY (4 + OUT_LFSR)  /* OUT_UPLOAD only, after OUT_NOISE */
 
 #define OUT_PERIOD_MODE 0
 #define OUT_FREQ_MODE   1
 
-#define OUT_MAX_NON_SQUARE_FREQUENCY_mHz (50UL*1000UL*1000UL)
+#ifndef OUT_DDS
+#define OUT_DDS 0
+#endif
+
+#ifndef OUT_ISR_ASM
+#define OUT_ISR_ASM 0
+#endif
+
+#ifndef OUT_FIXED_REGS
+#define OUT_FIXED_REGS 0
+#endif
+
+#ifndef OUT_FLASH_TABLE
+#define OUT_FLASH_TABLE 0
+#endif
+
+#ifndef OUT_DITHER
+#define OUT_DITHER 0
+#endif
+
+#ifndef OUT_POSTSCALE
+#define OUT_POSTSCALE 1
+#endif
+
+#ifndef OUT_CHANNEL_B
+#define OUT_CHANNEL_B 0
+#endif
+
+#ifndef OUT_GATE
+#define OUT_GATE 0
+#endif
+
+#ifndef OUT_SYNC
+#define OUT_SYNC 0
+#endif
+
+#ifndef OUT_SWEEP
+#define OUT_SWEEP 0
+#endif
+
+#ifndef OUT_SWEEP_MAX_STEPS
+#define OUT_SWEEP_MAX_STEPS 16
+#endif
+
+#ifndef OUT_TWO_TONE
+#define OUT_TWO_TONE 0
+#endif
+
+#ifndef OUT_SEQUENCE
+#define OUT_SEQUENCE 0
+#endif
+
+#ifndef OUT_SEQUENCE_MAX_SEGMENTS
+#define OUT_SEQUENCE_MAX_SEGMENTS 8
+#endif
+
+#ifndef OUT_LFSR
+#define OUT_LFSR 0
+#endif
+
+/* Width of the R-2R DAC on PD0 upwards: 5, 6 or 8 bits */
+#ifndef OUT_DAC_BITS
+#define OUT_DAC_BITS 5
+#endif
+
+#ifndef OUT_SHAPING
+#define OUT_SHAPING 0
+#endif
+
+#ifndef OUT_PWM_DAC
+#define OUT_PWM_DAC 0
+#endif
+
+/* Timer1 period of OUT_PWM_DAC in CPU clock cycles, which is also the
+   number of duty cycles it has for samples, up to 256 */
+#ifndef OUT_PWM_DAC_LEVELS
+#define OUT_PWM_DAC_LEVELS 256
+#endif
+
+/* What each DAC width rules out */
+#if (OUT_DAC_BITS != 5) && (OUT_DAC_BITS != 6) && (OUT_DAC_BITS != 8)
+  #error OUT_DAC_BITS must be 5, 6 or 8
+#endif
+
+#if OUT_FLASH_TABLE && (OUT_DAC_BITS != 5)
+  #error OUT_FLASH_TABLE scales the table in 1/16ths of a step of the 5-bit DAC (OUT_DAC_BITS = 5)
+#endif
+
+#if OUT_TWO_TONE && (OUT_DAC_BITS == 8)
+  #error OUT_TWO_TONE needs OUT_DAC_BITS = 5 or 6, for tone_scale to fit in a byte
+#endif
+
+#if OUT_SHAPING && (OUT_DAC_BITS == 8)
+  #error OUT_SHAPING needs OUT_DAC_BITS = 5 or 6, to leave bits below a DAC step in the table
+#endif
+
+#if OUT_SYNC && (OUT_DAC_BITS == 8)
+  #error OUT_SYNC needs OUT_DAC_BITS = 5 or 6, as 8 takes the comparator input AIN1 (PD7)
+#endif
+
+/* Whether the triangle and sine tables from gen_waves.pl come in DAC
+   steps as well, for full amplitude. OUT_PWM_DAC and OUT_TWO_TONE
+   scale the shape at any amplitude, and OUT_FLASH_TABLE has its own. */
+#define OUT_DAC_TABLES (!OUT_FLASH_TABLE && !OUT_PWM_DAC && !OUT_TWO_TONE)
+
+#ifndef OUT_UPLOAD
+#define OUT_UPLOAD 0
+#endif
+
+/* Baud rate the USART receives uploaded waveforms at (OUT_UPLOAD) */
+#ifndef OUT_UPLOAD_BAUD
+#define OUT_UPLOAD_BAUD 9600
+#endif
+
+#if OUT_UPLOAD
+#define OUT_WAVEFORM_LAST  OUT_ARBITRARY
+#elif OUT_LFSR
+#define OUT_WAVEFORM_LAST  OUT_NOISE
+#else
+#define OUT_WAVEFORM_LAST  OUT_PULSE
+#endif
+
+/* Rate the UI interrupt calls OUT_tick at. Segments of a sequence
+   are timed in these ticks. */
+#if OUT_SEQUENCE
+#define OUT_TICK_HZ 1000
+#else
+#define OUT_TICK_HZ 50
+#endif
+
+/* Second square wave output on OC1B (PB2), for square waves
+   in the timer's own range (OUT_CHANNEL_B). It shares TOP with OC1A. */
+#define OUT_CHANNEL_B_OFF      0
+#define OUT_CHANNEL_B_IN_PHASE 1  /* rises with OC1A, with its own duty cycle */
+#define OUT_CHANNEL_B_INVERTED 2  /* the complement of OC1A */
+#define OUT_CHANNEL_B_PHASE    3  /* both at 50%, OC1B lagging by a phase */
+#define OUT_CHANNEL_B_LAST     3
+
+/* How OUT_set_on runs the output (OUT_GATE). It always starts and
+   stops at the end of a cycle. */
+#define OUT_GATE_NONE  0  /* runs while on */
+#define OUT_GATE_BURST 1  /* each trigger outputs a burst of cycles */
+#define OUT_GATE_INT0  2  /* runs while on and INT0 (PD2) is held low */
+#define OUT_GATE_LAST  2
+
+/* How a sweep spaces its steps (OUT_SWEEP) */
+#define OUT_SWEEP_OFF    0
+#define OUT_SWEEP_LINEAR 1  /* evenly in frequency */
+#define OUT_SWEEP_LOG    2  /* evenly in log frequency, as octaves or decades */
+#define OUT_SWEEP_LAST   2
+
+/* How a sequence plays (OUT_SEQUENCE) */
+#define OUT_SEQUENCE_OFF  0
+#define OUT_SEQUENCE_ONCE 1  /* through once, holding the last segment */
+#define OUT_SEQUENCE_LOOP 2  /* over and over */
+#define OUT_SEQUENCE_LAST 2
+
+/* Length of the LFSR behind OUT_NOISE (OUT_LFSR), as the PRBS it
+   puts out, which repeats every 2^n - 1 bits */
+#define OUT_PRBS7  0  /* x^7 + x^6 + 1 */
+#define OUT_PRBS9  1  /* x^9 + x^5 + 1 */
+#define OUT_PRBS11 2  /* x^11 + x^9 + 1 */
+#define OUT_PRBS15 3  /* x^15 + x^14 + 1 */
+#define OUT_PRBS_LAST 3
+
+/* Number of samples in one cycle of the waveform table, as powers of 2.
+   The table engine uses the longest table that keeps the sample rate
+   within OUT_MAX_SAMPLE_RATE_mHz; DDS always uses the longest table.
+   With OUT_FLASH_TABLE the longest table is always 256 samples. */
+#define OUT_MIN_WAVEFORM_LENGTH_BITS 4
+#ifndef OUT_MAX_WAVEFORM_LENGTH_BITS
+#define OUT_MAX_WAVEFORM_LENGTH_BITS 7
+#endif
+
+/* Extra cycles per table lookup in the sample ISR when it reads the
+   table address from table_base, which a sequence switches between the
+   triangle and sine tables, rather than using a fixed address */
+#if OUT_SEQUENCE && !OUT_FIXED_REGS && !OUT_FLASH_TABLE
+  #define OUT_TABLE_BASE_CYCLES 4
+#else
+  #define OUT_TABLE_BASE_CYCLES 0
+#endif
+
+/* Worst-case CPU cycles per sample spent in the sample ISR,
+   from the interrupt request to the end of reti.
+   The breakdown is next to each ISR in out.c. */
+#if OUT_TWO_TONE && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (137 + 2 * (8 - OUT_MAX_WAVEFORM_LENGTH_BITS) + 2 * OUT_TABLE_BASE_CYCLES)
+#elif OUT_TWO_TONE
+  #define OUT_ISR_CYCLES (168 + 2 * (8 - OUT_MAX_WAVEFORM_LENGTH_BITS) + 2 * OUT_TABLE_BASE_CYCLES)
+#elif OUT_DDS && OUT_FIXED_REGS
+  #define OUT_ISR_CYCLES (39 + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS)
+#elif OUT_FIXED_REGS
+  #define OUT_ISR_CYCLES 28
+#elif OUT_FLASH_TABLE && OUT_DDS && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES 95
+#elif OUT_FLASH_TABLE && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES 71
+#elif OUT_FLASH_TABLE && OUT_DDS
+  #define OUT_ISR_CYCLES 123
+#elif OUT_FLASH_TABLE
+  #define OUT_ISR_CYCLES 84
+#elif OUT_PWM_DAC && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (69 + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_PWM_DAC
+  #define OUT_ISR_CYCLES (101 + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_SHAPING && OUT_DDS && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (74 + 8 - OUT_DAC_BITS + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_SHAPING && OUT_DDS
+  #define OUT_ISR_CYCLES (107 + 8 - OUT_DAC_BITS + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_SHAPING && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (43 + 8 - OUT_DAC_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_SHAPING
+  #define OUT_ISR_CYCLES (61 + 8 - OUT_DAC_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_DDS && OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (67 + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_DDS
+  #define OUT_ISR_CYCLES (100 + 8 - OUT_MAX_WAVEFORM_LENGTH_BITS + OUT_TABLE_BASE_CYCLES)
+#elif OUT_ISR_ASM
+  #define OUT_ISR_CYCLES (36 + OUT_TABLE_BASE_CYCLES)
+#else
+  #define OUT_ISR_CYCLES (54 + OUT_TABLE_BASE_CYCLES)
+#endif
+
+/* Largest share of the CPU the sample ISR may take.
+   The rest is left for the main loop and the UI interrupt. */
+#define OUT_MAX_ISR_LOAD_PERCENT 50
+
+/* Worst-case CPU cycles per Timer1 period spent in the compare A ISR
+   that counts cycles while gating the output (OUT_GATE). During a burst
+   of a triangle or sine wave it runs once per sample along with the
+   sample ISR. The breakdown is next to it in out.c. */
+#if OUT_GATE && OUT_DDS
+  #define OUT_GATE_ISR_CYCLES 100
+#elif OUT_GATE
+  #define OUT_GATE_ISR_CYCLES 90
+#else
+  #define OUT_GATE_ISR_CYCLES 0
+#endif
+
+/* Worst-case CPU cycles per bit spent in the compare B ISR that steps
+   the LFSR for OUT_NOISE (OUT_LFSR). With OUT_DITHER it shares the
+   interrupt with the dither ISR. The breakdown is next to it in out.c. */
+#if OUT_LFSR && OUT_ISR_ASM && OUT_DITHER
+  #define OUT_NOISE_ISR_CYCLES 54
+#elif OUT_LFSR && OUT_ISR_ASM
+  #define OUT_NOISE_ISR_CYCLES 52
+#elif OUT_LFSR && OUT_DITHER
+  #define OUT_NOISE_ISR_CYCLES 76
+#elif OUT_LFSR
+  #define OUT_NOISE_ISR_CYCLES 65
+#else
+  #define OUT_NOISE_ISR_CYCLES 0
+#endif
+#define OUT_NOISE_MIN_CLOCKS (OUT_NOISE_ISR_CYCLES * 100 / OUT_MAX_ISR_LOAD_PERCENT)
+
+/* Shortest Timer1 period in CPU clock cycles between samples */
+#define OUT_MIN_SAMPLE_CLOCKS ((OUT_ISR_CYCLES + OUT_GATE_ISR_CYCLES) * 100 / OUT_MAX_ISR_LOAD_PERCENT)
+#define OUT_MIN_SAMPLE_PERIOD_NS ((uint32_t)(1e9 * OUT_MIN_SAMPLE_CLOCKS / F_CPU + 0.5))
+#define OUT_MAX_SAMPLE_RATE_mHz (F_CPU / OUT_MIN_SAMPLE_CLOCKS * 1000UL)
+
+/* Worst-case CPU cycles per Timer1 period spent in the ISR that dithers
+   ICR1 for square waves (OUT_DITHER). The breakdown is next to it in out.c. */
+#if OUT_ISR_ASM && OUT_LFSR
+  #define OUT_DITHER_ISR_CYCLES 69
+#elif OUT_ISR_ASM
+  #define OUT_DITHER_ISR_CYCLES 66
+#elif OUT_LFSR
+  #define OUT_DITHER_ISR_CYCLES 83
+#else
+  #define OUT_DITHER_ISR_CYCLES 80
+#endif
+
+/* Shortest square wave period in CPU clock cycles that gets dithered,
+   with the same limit on the ISR's share of the CPU as for samples.
+   Longer periods up to 65535 clocks with no prescaler are dithered too. */
+#define OUT_DITHER_MIN_CLOCKS (OUT_DITHER_ISR_CYCLES * 100 / OUT_MAX_ISR_LOAD_PERCENT)
+
+/* Shortest square wave period in CPU clock cycles that can be gated,
+   with the same limit on the compare A ISR's share of the CPU during
+   a burst. Gated square waves and pulses go up to this frequency. */
+#define OUT_GATE_MIN_CLOCKS (OUT_GATE_ISR_CYCLES * 100 / OUT_MAX_ISR_LOAD_PERCENT)
+#define OUT_GATE_MIN_PERIOD_NS ((uint32_t)(1e9 * OUT_GATE_MIN_CLOCKS / F_CPU + 0.5))
+#define OUT_GATE_MAX_FREQUENCY_mHz (F_CPU / OUT_GATE_MIN_CLOCKS * 1000UL)
+
+#if OUT_DDS
+
+/* Timer1 period in CPU clock cycles between DDS samples.
+   This is fixed, so the sample rate is F_CPU / OUT_DDS_SAMPLE_CLOCKS.
+   Gating leaves the time for its ISR on top, and so do the lookups
+   through table_base in a sequence build. OUT_PWM_DAC trades the
+   sample rate for levels. */
+#if OUT_PWM_DAC
+  #define OUT_DDS_SAMPLE_CLOCKS OUT_PWM_DAC_LEVELS
+#elif OUT_TWO_TONE && OUT_ISR_ASM
+  #define OUT_DDS_SAMPLE_CLOCKS (280 + 4 * OUT_TABLE_BASE_CYCLES + OUT_GATE_MIN_CLOCKS)
+#elif OUT_TWO_TONE
+  #define OUT_DDS_SAMPLE_CLOCKS (340 + 4 * OUT_TABLE_BASE_CYCLES + OUT_GATE_MIN_CLOCKS)
+#elif OUT_FIXED_REGS
+  #define OUT_DDS_SAMPLE_CLOCKS (100 + OUT_GATE_MIN_CLOCKS)
+#elif OUT_ISR_ASM && !OUT_FLASH_TABLE
+  #define OUT_DDS_SAMPLE_CLOCKS (160 + 2 * OUT_TABLE_BASE_CYCLES + OUT_GATE_MIN_CLOCKS)
+#elif OUT_ISR_ASM
+  #define OUT_DDS_SAMPLE_CLOCKS (200 + OUT_GATE_MIN_CLOCKS)
+#else
+  #define OUT_DDS_SAMPLE_CLOCKS (250 + 2 * OUT_TABLE_BASE_CYCLES + OUT_GATE_MIN_CLOCKS)
+#endif
+
+/* Fewest samples per cycle of the output waveform */
+#define OUT_DDS_MIN_SAMPLES_PER_CYCLE 8
+
+#define OUT_MAX_NON_SQUARE_FREQUENCY_mHz (F_CPU / OUT_DDS_SAMPLE_CLOCKS * 1000UL / OUT_DDS_MIN_SAMPLES_PER_CYCLE)
+
+#else
+
+/* One table sample per Timer1 period, using the shortest table */
+#define OUT_MAX_NON_SQUARE_FREQUENCY_mHz (OUT_MAX_SAMPLE_RATE_mHz >> OUT_MIN_WAVEFORM_LENGTH_BITS)
+
+#endif
 
 #define OUT_MIN_NON_SQUARE_PERIOD_NS ((uint32_t)(1e12 / OUT_MAX_NON_SQUARE_FREQUENCY_mHz + 0.5))
 
+/* Highest bit rate of OUT_NOISE (OUT_LFSR), one bit per Timer1 period.
+   The noise ISR has a limit of its own, so that it doesn't hold the
+   table engine's sample rate down; with DDS it's the fixed sample rate,
+   as long as the noise ISR fits in it. */
+#if OUT_DDS && (OUT_DDS_SAMPLE_CLOCKS >= OUT_NOISE_MIN_CLOCKS)
+  #define OUT_MAX_NOISE_FREQUENCY_mHz (F_CPU / OUT_DDS_SAMPLE_CLOCKS * 1000UL)
+#else
+  #define OUT_MAX_NOISE_FREQUENCY_mHz (F_CPU / OUT_NOISE_MIN_CLOCKS * 1000UL)
+#endif
+#define OUT_MIN_NOISE_PERIOD_NS ((uint32_t)(1e12 / OUT_MAX_NOISE_FREQUENCY_mHz + 0.5))
+
 void OUT_init(void);
 
 void OUT_cyclic(void);
 
+/* Called from the UI interrupt at OUT_TICK_HZ, with interrupts enabled */
+void OUT_tick(void);
+
 void OUT_recompute_actual(void);
 
+/* Turns the output on or off at the end of the current cycle.
+   In OUT_GATE_BURST, 1 triggers a burst, and it reads 1 until the burst
+   is over. Off holds OC1A low, or the DAC at its centre. */
 void OUT_set_on(uint8_t new_value);
 uint8_t OUT_get_on(void);
 
+#if OUT_SYNC
+/* With 1, a rising edge at the sync input restarts the waveform at the
+   start of a cycle: INT0 (PD2) for square waves and pulses, and AIN1
+   (PD7, against the 1.23 V bandgap) for triangle and sine waves, whose
+   DAC has PD2. Not while gating uses INT0, below the prescaler's range,
+   or with OC1B toggling against OC1A, and only for square waves and
+   pulses when the DAC has PD7 as well (OUT_DAC_BITS = 8). */
+void OUT_set_sync(uint8_t new_value);
+uint8_t OUT_get_sync(void);
+#endif
+
+#if OUT_SWEEP
+/* One of OUT_SWEEP_*. A sweep goes from the frequency set to the stop
+   frequency in the number of steps, both ends included, holding each
+   step for the dwell time, and then starts again; PB7 is high during
+   the first step. The Timer1 settings for all of them are worked out
+   when it starts, which it does again whenever any setting changes.
+   Triangle and sine waves keep the table length of the highest
+   frequency throughout. Not below the prescaler's range, with OC1B
+   toggling against OC1A, or while a sequence plays. */
+void OUT_set_sweep(uint8_t new_value);
+uint8_t OUT_get_sweep(void);
+void OUT_set_sweep_stop_mHz(uint32_t new_value);
+uint32_t OUT_get_sweep_stop_mHz(void);
+/* From 2 to OUT_SWEEP_MAX_STEPS */
+void OUT_set_sweep_steps(uint8_t new_value);
+uint8_t OUT_get_sweep_steps(void);
+/* Rounded to ticks of the UI interrupt, up to 60 s */
+void OUT_set_sweep_dwell_ms(uint16_t new_value);
+uint16_t OUT_get_sweep_dwell_ms(void);
+/* The step going out, from 0, or 0 when not sweeping */
+uint8_t OUT_get_sweep_step(void);
+#endif
+
+#if OUT_SEQUENCE
+/* One of OUT_SEQUENCE_*. Plays the segments in STORE from the first,
+   each with its own waveform and frequency for its duration, in place
+   of the waveform and frequency set; the rest of the settings apply to
+   all of them. The Timer1 settings for every segment are worked out
+   when it starts, which it does again whenever any setting changes, and
+   each goes in at the end of a period once its tick comes. Triangle and
+   sine waves keep the table length of the highest frequency among them.
+   It doesn't play while gating is on, and OC1B is off while it plays. */
+void OUT_set_sequence(uint8_t new_value);
+uint8_t OUT_get_sequence(void);
+/* The segment going out, from 0, and the number of them, both 0 when
+   not playing */
+uint8_t OUT_get_sequence_segment(void);
+uint8_t OUT_get_sequence_length(void);
+#endif
+
+#if OUT_LFSR
+/* One of OUT_PRBS_*, for OUT_NOISE. The frequency set is the bit rate.
+   Each bit puts the DAC at the top or bottom of the amplitude and PB1
+   high or low, where OC1A is for the other waveforms. Noise isn't gated,
+   synced, swept or played in a sequence. */
+void OUT_set_prbs(uint8_t new_value);
+uint8_t OUT_get_prbs(void);
+#endif
+
+#if OUT_GATE
+/* One of OUT_GATE_*. A falling edge on INT0 triggers a burst too.
+   PD2 is a DAC line for triangle and sine waves, so INT0 only works for
+   square waves and pulses; triangle and sine waves run in OUT_GATE_INT0
+   as in OUT_GATE_NONE. Changing any setting ends a burst. */
+void OUT_set_gate(uint8_t new_value);
+uint8_t OUT_get_gate(void);
+/* Cycles per burst, from 1 to 65535 */
+void OUT_set_burst_cycles(uint16_t new_value);
+uint16_t OUT_get_burst_cycles(void);
+#endif
+
 void OUT_set_fine_cal(int8_t new_value);
 int8_t OUT_get_fine_cal(void);
 
@@ -45,12 +454,80 @@ uint32_t OUT_get_freq_mHz(void);
 void OUT_set_period_ns(uint32_t new_value);
 uint32_t OUT_get_period_ns(void);
 
-void OUT_set_duty_cycle_percent(uint8_t new_value);
-uint8_t OUT_get_duty_cycle_percent(void);
+/* Duty cycle in 0.1% steps from 0 to 1000. A new one takes effect at the
+   start of the next timer period, without recomputing anything else. */
+void OUT_set_duty_cycle_permille(uint16_t new_value);
+uint16_t OUT_get_duty_cycle_permille(void);
+/* Returns 1 if the timer period is long enough for 0.1% steps,
+   i.e. at least 1000 clocks, and 0 if only 1% steps are meaningful */
+uint8_t OUT_get_duty_cycle_fine(void);
+
+/* Width of the high part of OUT_PULSE in ns, up to 4*10^9, which
+   takes the place of the duty cycle. The actual width is rounded to a
+   timer clock; it doesn't fit when it's below one timer clock or
+   isn't at least one shorter than the period. */
+void OUT_set_pulse_width_ns(uint32_t new_value);
+uint32_t OUT_get_pulse_width_ns(void);
+uint32_t OUT_get_pulse_width_actual_ns(void);
+uint8_t OUT_get_pulse_width_fits(void);
+
+#if OUT_CHANNEL_B
+/* Second square wave output on OC1B, one of OUT_CHANNEL_B_*.
+   The phase is from 0 to 359 degrees and the duty cycle in 0.1% steps
+   from 0 to 1000; each only applies in its own mode. Both outputs come
+   from the same timer settings, so OC1B takes no CPU time of its own. */
+void OUT_set_channel_b(uint8_t new_value);
+uint8_t OUT_get_channel_b(void);
+void OUT_set_channel_b_phase_degrees(uint16_t new_value);
+uint16_t OUT_get_channel_b_phase_degrees(void);
+void OUT_set_channel_b_duty_cycle_permille(uint16_t new_value);
+uint16_t OUT_get_channel_b_duty_cycle_permille(void);
+#endif
 
 void OUT_set_amplitude_percent(uint8_t new_value);
 uint8_t OUT_get_amplitude_percent(void);
 
+#if OUT_SHAPING
+/* 1 to carry the part of each triangle or sine sample below a DAC step
+   on to the next sample, so that the DAC dithers between the two steps
+   either side and averages out at the value in between, with the
+   rounding noise pushed up towards the sample rate for the RC filter;
+   0 to round each sample to a DAC step. The sample ISR takes the same
+   time either way. */
+void OUT_set_shaping(uint8_t new_value);
+uint8_t OUT_get_shaping(void);
+#endif
+
+#if OUT_TWO_TONE
+/* Second tone added to triangle and sine waves, of the same shape.
+   The amplitudes of the two add up, and where they add up to more than
+   100% the peaks are clipped. 0% turns it off. */
+void OUT_set_tone2_freq_mHz(uint32_t new_value);
+uint32_t OUT_get_tone2_freq_mHz(void);
+void OUT_set_tone2_amplitude_percent(uint8_t new_value);
+uint8_t OUT_get_tone2_amplitude_percent(void);
+#endif
+
+#if OUT_UPLOAD
+/* The shape of OUT_ARBITRARY, 2^OUT_MAX_WAVEFORM_LENGTH_BITS samples
+   from -127 to 127 over one cycle (-128 counts as -127). They're copied,
+   so samples can be reused as soon as this returns, and stored in EEPROM
+   for the next power-up. The table is built again from them straight
+   away if OUT_ARBITRARY is playing. */
+void OUT_set_arbitrary(const int8_t* samples);
+#endif
+
+/* Rate at which the sample ISR runs for triangle and sine waves,
+   and the number of samples per cycle. Both are 0 for square waves.
+   With OUT_PWM_DAC the sample rate is the PWM carrier on OC1A, each
+   sample one of OUT_PWM_DAC_LEVELS duty cycles. */
+uint32_t OUT_get_sample_rate_mHz(void);
+uint16_t OUT_get_table_length(void);
+
+/* How far the actual frequency or period is from the one last set,
+   in parts per million, at most 65535 */
+uint16_t OUT_get_error_ppm(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,766 @@
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "out.h"
+#include "plan.h"
+
+/* The AVR has no divide instruction, and each 32-bit division in libgcc
+   takes about 600 cycles. The planner divides by multiplying with a
+   reciprocal instead, then corrects the quotient by at most a few steps,
+   so the results are exactly those of integer division. */
+
+/* Length of a CPU clock cycle in ns at the nominal F_CPU */
+#define F_PERIOD_NS_NOMINAL ((1000000000UL + F_CPU/2) / F_CPU)
+
+/* The calibration moves f_cpu by 2048 Hz per medium step
+   and 32 Hz per fine step, each from -128 to 127 */
+#define F_CPU_CAL_MIN (F_CPU - 2048UL*128 - 32UL*128)
+#define F_CPU_CAL_MAX (F_CPU + 2048UL*127 + 32UL*127)
+
+/* Reciprocals of the clock cycle length in ns, (2^32 - 1) / n,
+   for n from F_PERIOD_NS_NOMINAL - 8 to F_PERIOD_NS_NOMINAL + 8 */
+#define RECIP_FIRST (F_PERIOD_NS_NOMINAL - 8)
+#define RECIP(i) (0xFFFFFFFFUL / (RECIP_FIRST + (i)))
+
+#if ((1000000000UL + F_CPU_CAL_MAX/2) / F_CPU_CAL_MAX) < RECIP_FIRST
+  #error The calibration range needs a longer clock period reciprocal table
+#endif
+#if ((1000000000UL + F_CPU_CAL_MIN/2) / F_CPU_CAL_MIN) > RECIP_FIRST + 16
+  #error The calibration range needs a longer clock period reciprocal table
+#endif
+
+static const uint32_t f_period_recip_table[17] PROGMEM =
+{
+  RECIP(0), RECIP(1), RECIP(2), RECIP(3), RECIP(4), RECIP(5),
+  RECIP(6), RECIP(7), RECIP(8), RECIP(9), RECIP(10), RECIP(11),
+  RECIP(12), RECIP(13), RECIP(14), RECIP(15), RECIP(16)
+};
+
+/* Number of leading zero bits in a 4-bit value, 1 to 15 */
+static const uint8_t leading_zeros[16] PROGMEM =
+{
+  4, 3, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* 2^15 / d for d in the middle of each 1/32 step from 0.5 to 1 */
+static const uint16_t recip_seed[16] PROGMEM =
+{
+  63550, 59919, 56680, 53773, 51150, 48771, 46603, 44620,
+  42799, 41121, 39569, 38130, 36792, 35545, 34380, 33288
+};
+
+/* Settings that only change with the calibration */
+static uint32_t f_cpu_cached;
+static uint32_t f_cpu_mul;        // F_CPU_MUL * f_cpu
+static uint32_t f_period_ns;      // CPU clock cycle length, rounded
+static uint32_t f_period_recip;   // (2^32 - 1) / f_period_ns
+
+// Second output on OC1B, as last set by PLAN_set_channel_b
+static uint8_t channel_b_mode = OUT_CHANNEL_B_OFF;
+static uint16_t channel_b_phase;
+static uint16_t channel_b_duty;
+
+// 2^(2^-k) for k = 1 to 16, with 31 fraction bits
+static const uint32_t exp2_table[16] PROGMEM =
+{
+  0xB504F334UL, 0x9837F052UL, 0x8B95C1E4UL, 0x85AAC368UL,
+  0x82CD8699UL, 0x8164D1F4UL, 0x80B1ED50UL, 0x8058D7D3UL,
+  0x802C6437UL, 0x8016302FUL, 0x800B179DUL, 0x80058BAFUL,
+  0x8002C5D0UL, 0x800162E6UL, 0x8000B173UL, 0x800058B9UL
+};
+
+/* log2 of the prescaler for each clock select value from 1 */
+static const uint8_t prescaler_shift[5] PROGMEM =
+{
+  0, 3, 6, 8, 10
+};
+
+static void set_timer(PLAN_timer_t* timer, uint8_t clock_select, uint32_t period_clocks, uint16_t duty_cycle_permille);
+static uint16_t phase_compare(uint16_t top, uint16_t phase_degrees);
+static uint32_t mul_high(uint32_t a, uint32_t b);
+static uint32_t log2_q16(uint32_t x);
+static uint32_t exp2_q16(uint32_t l);
+static uint32_t reciprocal(uint32_t d);
+static uint32_t div_recip(uint32_t x, uint32_t d, uint32_t recip);
+static uint32_t div_f_cpu(uint32_t d, uint8_t frac_bits);
+
+void PLAN_set_f_cpu(uint32_t f_cpu)
+{
+  uint32_t n;
+  uint32_t limit;
+
+  if (f_cpu == f_cpu_cached)
+  {
+    return;
+  }
+  f_cpu_cached = f_cpu;
+  f_cpu_mul = F_CPU_MUL * f_cpu;
+
+  /* f_period_ns = (10^9 + f_cpu/2) / f_cpu, which is the largest n
+     with n * f_cpu <= limit. Calibration keeps it close to nominal. */
+  limit = 1000000000UL + f_cpu/2;
+  n = F_PERIOD_NS_NOMINAL;
+  while (n * f_cpu > limit)
+  {
+    n--;
+  }
+  while ((n + 1) * f_cpu <= limit)
+  {
+    n++;
+  }
+  f_period_ns = n;
+  f_period_recip = pgm_read_dword(&f_period_recip_table[n - RECIP_FIRST]);
+}
+
+void PLAN_set_channel_b(uint8_t mode, uint16_t phase_degrees, uint16_t duty_cycle_permille)
+{
+  channel_b_mode = mode;
+  channel_b_phase = phase_degrees;
+  channel_b_duty = duty_cycle_permille;
+}
+
+void PLAN_timer(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille)
+{
+  uint32_t period_clocks;
+  uint8_t prescaler_bits;
+
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    /* Convert the period in ns to CPU clock cycles,
+       since this is the resolution of the timer itself */
+    period_clocks = div_recip(value + f_period_ns/2, f_period_ns, f_period_recip);
+  }
+  else
+  {
+    period_clocks = div_f_cpu(value, 0);
+  }
+
+  if (channel_b_mode == OUT_CHANNEL_B_PHASE)
+  {
+    /* Each output toggles once per timer period */
+    period_clocks = (period_clocks + 1) / 2;
+    if (period_clocks < 2)
+    {
+      period_clocks = 2;
+    }
+  }
+
+  /* The period in clock cycles will in general be larger than 16 bits.
+     So determine the smallest prescaler value that produces
+     a clock period that fits in a 16-bit register. */
+  if (period_clocks < 65536)
+  {
+    prescaler_bits = 1;
+  }
+  else if ((period_clocks + 4) <= 65536*8)
+  {
+    prescaler_bits = 2;
+    period_clocks = (period_clocks + 4) / 8;
+  }
+  else if ((period_clocks + 32) <= 65536*64)
+  {
+    prescaler_bits = 3;
+    period_clocks = (period_clocks + 32) / 64;
+  }
+  else if ((period_clocks + 128) <= 65536*256)
+  {
+    prescaler_bits = 4;
+    period_clocks = (period_clocks + 128) / 256;
+  }
+  else
+  {
+    prescaler_bits = 5;
+    period_clocks = (period_clocks + 512) / 1024;
+    if (period_clocks > 65536)
+    {
+      period_clocks = 65536;
+    }
+  }
+
+  set_timer(timer, prescaler_bits, period_clocks, duty_cycle_permille);
+}
+
+uint8_t PLAN_pulse(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint32_t width_ns,
+                   uint32_t* actual_width_ns)
+{
+  uint32_t width;
+  uint8_t shift;
+  uint8_t fits = 1;
+
+  PLAN_timer(timer, freq_mode, value, 0);
+  shift = pgm_read_byte(&prescaler_shift[timer->clock_select - 1]);
+
+  /* Width in CPU clock cycles, then in prescaled clocks, rounded */
+  width = div_recip(width_ns + f_period_ns/2, f_period_ns, f_period_recip);
+  width = (width + ((1UL << shift) >> 1)) >> shift;
+
+  /* OC1A is high for compare + 1 of the top + 1 clocks,
+     and has to go low for at least one of them */
+  if (width == 0)
+  {
+    width = 1;
+    fits = 0;
+  }
+  if (width > timer->top)
+  {
+    width = timer->top;
+    fits = 0;
+  }
+
+  timer->compare = (uint16_t)(width - 1);
+  timer->compare_b = timer->compare;
+  *actual_width_ns = (width << shift) * f_period_ns;
+  return fits;
+}
+
+/* The achievable cycle lengths with a table of 2^b samples and a prescaler
+   of 2^s are the multiples of 2^(b+s) clocks. Each larger prescaler's
+   multiples are a subset of the smaller one's, so for each table length
+   only the smallest prescaler that fits needs trying. A shorter table
+   likewise never does worse, so the search starts from the longest
+   and only moves on for a strictly smaller error, stopping at an exact
+   match. That's at most one candidate per table length. */
+void PLAN_search(PLAN_search_t* plan, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille,
+                 uint8_t min_bits, uint8_t max_bits)
+{
+  uint32_t ideal;       // cycle length in 1/64ths of a clock
+  uint32_t q;
+  uint32_t rem;
+  uint32_t period_clocks;
+  uint32_t error;
+  uint32_t best_error;
+  uint32_t best_period_clocks;
+  uint8_t best_clock_select;
+  uint8_t best_bits;
+  uint8_t bits;
+  uint8_t clock_select;
+  uint8_t shift;
+
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    q = div_recip(value, f_period_ns, f_period_recip);
+    rem = value - q * f_period_ns;
+    ideal = (q << 6) + div_recip((rem << 6) + f_period_ns/2, f_period_ns, f_period_recip);
+  }
+  else
+  {
+    ideal = div_f_cpu(value, 6);
+  }
+
+  best_error = 0xFFFFFFFFUL;
+  best_period_clocks = 0;
+  best_clock_select = 0;
+  best_bits = min_bits;
+  bits = max_bits + 1;
+  do
+  {
+    bits--;
+
+    /* Smallest prescaler for which the rounded sample period fits */
+    clock_select = 0;
+    do
+    {
+      clock_select++;
+      shift = pgm_read_byte(&prescaler_shift[clock_select - 1]) + bits + 6;
+      period_clocks = (ideal + (1UL << (shift - 1))) >> shift;
+    } while ((period_clocks > 65536) && (clock_select < 5));
+    if (period_clocks > 65536)
+    {
+      period_clocks = 65536;
+    }
+
+    /* Skip table lengths that sample faster than the ISR can keep up */
+    if ((bits > min_bits) &&
+        ((period_clocks << (shift - bits - 6)) < OUT_MIN_SAMPLE_CLOCKS))
+    {
+      continue;
+    }
+
+    if ((period_clocks << shift) >= ideal)
+    {
+      error = (period_clocks << shift) - ideal;
+    }
+    else
+    {
+      error = ideal - (period_clocks << shift);
+    }
+    if (error < best_error)
+    {
+      best_error = error;
+      best_period_clocks = period_clocks;
+      best_clock_select = clock_select;
+      best_bits = bits;
+    }
+  } while ((best_error != 0) && (bits > min_bits));
+
+  set_timer(&plan->timer, best_clock_select, best_period_clocks, duty_cycle_permille);
+  plan->table_length_bits = best_bits;
+  plan->period_ns = plan->timer.period_ns << best_bits;
+  plan->freq_mHz = div_f_cpu(best_period_clocks << (pgm_read_byte(&prescaler_shift[best_clock_select - 1]) + best_bits), 0);
+}
+
+uint16_t PLAN_dither(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille)
+{
+  uint32_t ideal;       // timer period in 1/65536ths of a clock
+  uint32_t q;
+  uint32_t rem;
+
+  PLAN_timer(timer, freq_mode, value, duty_cycle_permille);
+  if (timer->clock_select != 1)
+  {
+    return 0;
+  }
+
+  /* Less than 65536 clocks, so this fits in 32 bits */
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    q = div_recip(value, f_period_ns, f_period_recip);
+    rem = value - q * f_period_ns;
+    ideal = (q << 16) + div_recip((rem << 16) + f_period_ns/2, f_period_ns, f_period_recip);
+  }
+  else
+  {
+    ideal = div_f_cpu(value, 16);
+  }
+  if ((ideal >> 16) < OUT_DITHER_MIN_CLOCKS)
+  {
+    return 0;
+  }
+
+  set_timer(timer, 1, ideal >> 16, duty_cycle_permille);
+
+  // The average period and frequency
+  timer->period_ns = mul_high(ideal, f_period_ns << 16);
+  timer->freq_mHz = div_f_cpu(ideal, 16);
+
+  return (uint16_t)ideal;
+}
+
+/* Returns 10^6 * error / value, for value > 0, or 65535 if that's more.
+   The fraction error / value is worked out a bit at a time. */
+uint16_t PLAN_ppm(uint32_t error, uint32_t value)
+{
+  uint32_t frac;
+  uint8_t i;
+
+  if (error > (value >> 4))
+  {
+    return 0xFFFF;
+  }
+
+  /* frac = error * 2^32 / value, at most 2^28 */
+  frac = 0;
+  for (i = 0; i < 32; i++)
+  {
+    frac <<= 1;
+    if (error >= value - error)
+    {
+      error -= value - error;
+      frac++;
+    }
+    else
+    {
+      error += error;
+    }
+  }
+  return (uint16_t)mul_high(frac, 1000000UL);
+}
+
+uint8_t PLAN_prescaler_shift(uint8_t clock_select)
+{
+  return pgm_read_byte(&prescaler_shift[clock_select - 1]);
+}
+
+uint16_t PLAN_compare(uint16_t top, uint16_t duty_cycle_permille)
+{
+  uint32_t oc;
+
+  /* OC1A is high for compare + 1 of the top + 1 clocks */
+  oc = div_recip(((uint32_t)top + 1) * duty_cycle_permille + 500, 1000, 0xFFFFFFFFUL / 1000);
+  if (oc > 0)
+  {
+    oc--;
+  }
+  return (uint16_t)oc;
+}
+
+uint8_t PLAN_postscale(PLAN_postscale_t* plan, uint32_t freq_mHz, uint16_t duty_cycle_permille)
+{
+  uint32_t ticks;
+  uint32_t part_ticks;
+  uint32_t q;
+  uint32_t rem;
+  uint32_t base;
+  uint16_t periods;
+  uint8_t part;
+
+  if ((freq_mHz == 0) || (freq_mHz >= (1UL << 22)))
+  {
+    return 0;
+  }
+
+  /* The cycle in clocks of the 1024 prescaler */
+  ticks = div_f_cpu(freq_mHz << 10, 0);
+  if (ticks <= 65536)
+  {
+    return 0;
+  }
+
+  /* The high part is duty_cycle_permille / 1000 of the cycle, rounded.
+     ticks * duty_cycle_permille may not fit, so take the thousands
+     and the remainder separately. */
+  q = div_recip(ticks, 1000, 0xFFFFFFFFUL / 1000);
+  rem = ticks - q * 1000;
+  part_ticks = q * duty_cycle_permille +
+               div_recip(rem * duty_cycle_permille + 500, 1000, 0xFFFFFFFFUL / 1000);
+
+  for (part = 1; ; part--)
+  {
+    periods = (uint16_t)((part_ticks + 0xFFFF) >> 16);
+    plan->periods[part] = periods;
+    plan->top[part] = 0;
+    plan->longer[part] = 0;
+    if (periods != 0)
+    {
+      base = PLAN_div(part_ticks, periods);
+      plan->top[part] = (uint16_t)(base - 1);
+      plan->longer[part] = (uint16_t)(part_ticks - base * periods);
+    }
+    if (part == 0)
+    {
+      break;
+    }
+    part_ticks = ticks - part_ticks;
+  }
+
+  /* More than 65536 * 1024 clocks is always more than 4.29 s */
+  plan->period_ns = 0xFFFFFFFFUL;
+  plan->freq_mHz = (div_f_cpu(ticks, 0) + 512) >> 10;
+  return 1;
+}
+
+uint32_t PLAN_div(uint32_t n, uint32_t d)
+{
+  return div_recip(n, d, reciprocal(d));
+}
+
+uint32_t PLAN_sweep_value(uint32_t start, uint32_t stop, uint8_t step, uint8_t last_step, uint8_t log)
+{
+  uint32_t from;
+  uint32_t to;
+  uint32_t span;
+  uint32_t q;
+  uint32_t offset;
+
+  if (step == 0)
+  {
+    return start;
+  }
+  if (step >= last_step)
+  {
+    return stop;
+  }
+
+  from = start;
+  to = stop;
+  if (log)
+  {
+    from = log2_q16(start);
+    to = log2_q16(stop);
+  }
+
+  /* span * step / last_step, where span * step can overflow
+     for a linear sweep */
+  span = (to >= from) ? to - from : from - to;
+  q = PLAN_div(span, last_step);
+  offset = q * step + PLAN_div((span - q * last_step) * step, last_step);
+  from = (to >= from) ? from + offset : from - offset;
+
+  if (log)
+  {
+    /* log2 rounds down, which can take a step just past an end
+       when the ends are close */
+    from = exp2_q16(from);
+    if ((from < start) == (start < stop))
+    {
+      from = start;
+    }
+    if ((from > stop) == (start < stop))
+    {
+      from = stop;
+    }
+  }
+  return from;
+}
+
+/* Sets the timer registers and actual period for a timer period
+   of period_clocks prescaled clocks */
+static void set_timer(PLAN_timer_t* timer, uint8_t clock_select, uint32_t period_clocks, uint16_t duty_cycle_permille)
+{
+  uint8_t shift;
+
+  shift = pgm_read_byte(&prescaler_shift[clock_select - 1]);
+
+  timer->clock_select = clock_select;
+  timer->top = (uint16_t)period_clocks - 1;
+  timer->compare = PLAN_compare(timer->top, duty_cycle_permille);
+  timer->compare_b = timer->compare;
+
+  switch (channel_b_mode)
+  {
+  case OUT_CHANNEL_B_IN_PHASE:
+    timer->compare_b = PLAN_compare(timer->top, channel_b_duty);
+    break;
+
+  case OUT_CHANNEL_B_PHASE:
+    /* A timer period is half a cycle, i.e. 180 degrees */
+    timer->compare = timer->top;
+    timer->compare_b = phase_compare(timer->top, channel_b_phase);
+    shift++;
+    break;
+
+  default:
+    break;
+  }
+
+  // Compute the actual period
+  timer->period_ns = (period_clocks << shift) * f_period_ns;
+
+  // Compute the actual frequency
+  timer->freq_mHz = div_f_cpu(period_clocks << shift, 0);
+}
+
+/* Returns OCR1B for OC1B to toggle phase_degrees after OC1A in CTC mode,
+   taken modulo 180 from 1 to 180 degrees, rounded to the nearest clock
+   but at least 1 */
+static uint16_t phase_compare(uint16_t top, uint16_t phase_degrees)
+{
+  uint32_t lag;
+
+  while (phase_degrees > 180)
+  {
+    phase_degrees -= 180;
+  }
+  if (phase_degrees == 0)
+  {
+    phase_degrees = 180;
+  }
+  lag = div_recip(((uint32_t)top + 1) * phase_degrees + 90, 180, 0xFFFFFFFFUL / 180);
+  if (lag == 0)
+  {
+    lag = 1;
+  }
+  return (uint16_t)(lag - 1);
+}
+
+/* Returns 1000 * 2^frac_bits * f_cpu / d, rounded, for d >= 2.
+   1000 * f_cpu doesn't fit in 32 bits, so divide F_CPU_MUL * f_cpu
+   and carry on a bit at a time for the factor F_OUT_DIV that's left,
+   and frac_bits more. Dividing d by F_OUT_DIV instead would lose
+   up to 25% when d is 3. */
+static uint32_t div_f_cpu(uint32_t d, uint8_t frac_bits)
+{
+  uint32_t q;
+  uint32_t rem;
+  uint8_t i;
+
+  /* One step per bit of F_OUT_DIV, then frac_bits more */
+  for (i = F_OUT_DIV; i > 1; i >>= 1)
+  {
+    frac_bits++;
+  }
+
+  q = PLAN_div(f_cpu_mul, d);
+  rem = f_cpu_mul - q * d;
+  for (; frac_bits > 0; frac_bits--)
+  {
+    q <<= 1;
+    if (rem >= d - rem)
+    {
+      rem -= d - rem;
+      q++;
+    }
+    else
+    {
+      rem += rem;
+    }
+  }
+
+  /* Round to nearest */
+  if (rem >= d - rem)
+  {
+    q++;
+  }
+  return q;
+}
+
+/* Returns (a * b) / 2^32, rounded down */
+static uint32_t mul_high(uint32_t a, uint32_t b)
+{
+  uint32_t ll;
+  uint32_t lh;
+  uint32_t hl;
+  uint32_t hh;
+  uint32_t mid;
+
+  ll = (uint32_t)(uint16_t)a * (uint16_t)b;
+  lh = (uint32_t)(uint16_t)a * (uint16_t)(b >> 16);
+  hl = (uint32_t)(uint16_t)(a >> 16) * (uint16_t)b;
+  hh = (uint32_t)(uint16_t)(a >> 16) * (uint16_t)(b >> 16);
+
+  /* Bits 16 to 47 of the product */
+  mid = (ll >> 16) + (lh & 0xFFFF) + (hl & 0xFFFF);
+
+  return hh + (lh >> 16) + (hl >> 16) + (mid >> 16);
+}
+
+/* Returns log2(x) with 16 fraction bits, for x > 0. x is shifted up
+   to a mantissa in [1, 2) with 31 fraction bits, and squaring that gives
+   one bit of the fraction at a time: the next bit is 1 when the square
+   is 2 or more, and then the square is halved. */
+static uint32_t log2_q16(uint32_t x)
+{
+  uint32_t result;
+  uint16_t bit;
+  uint8_t n;
+
+  n = 31;
+  while (!(x & 0x80000000UL))
+  {
+    x <<= 1;
+    n--;
+  }
+  result = (uint32_t)n << 16;
+
+  for (bit = 0x8000; bit != 0; bit >>= 1)
+  {
+    /* The square with 30 fraction bits is its half with 31 */
+    x = mul_high(x, x);
+    if (x & 0x80000000UL)
+    {
+      result |= bit;
+    }
+    else
+    {
+      x <<= 1;
+    }
+  }
+  return result;
+}
+
+/* Returns 2^l, rounded, for l with 16 fraction bits below 32 * 2^16.
+   The fraction comes from multiplying together 2^(2^-k) for each bit k
+   of it that is set. */
+static uint32_t exp2_q16(uint32_t l)
+{
+  uint32_t m;
+  uint16_t bit;
+  uint8_t k;
+  uint8_t shift;
+
+  m = 0x80000000UL;
+  k = 0;
+  for (bit = 0x8000; bit != 0; bit >>= 1)
+  {
+    if (l & bit)
+    {
+      m = mul_high(m, pgm_read_dword(&exp2_table[k])) << 1;
+    }
+    k++;
+  }
+
+  shift = 31 - (uint8_t)(l >> 16);
+  if (shift == 0)
+  {
+    return m;
+  }
+  return ((m >> (shift - 1)) + 1) >> 1;
+}
+
+/* Returns at most 2^32 / d, and at least 2^32 / d - 8, for d > 0.
+   d is first shifted up to dn in [2^31, 2^32), then Newton's method
+   refines y = 2^63 / dn from a table: twice in 16 bits, once in 32.
+   Each step y' = y * (2 - dn * y / 2^63) roughly doubles the number
+   of correct bits, and never overshoots. */
+static uint32_t reciprocal(uint32_t d)
+{
+  uint8_t shift;
+  uint8_t zeros;
+  uint8_t i;
+  uint16_t d16;
+  uint32_t y16;
+  uint32_t y;
+  uint32_t dy;
+  uint32_t t;
+
+  /* Normalise, a byte at a time and then with a table */
+  shift = 0;
+  while (d < 0x01000000UL)
+  {
+    d <<= 8;
+    shift += 8;
+  }
+  if (d < 0x10000000UL)
+  {
+    d <<= 4;
+    shift += 4;
+  }
+  zeros = pgm_read_byte(&leading_zeros[d >> 28]);
+  d <<= zeros;
+  shift += zeros;
+
+  /* 2^15 / (d / 2^32) to about 5 bits, then 2 steps in 16 bits */
+  y16 = pgm_read_word(&recip_seed[(uint8_t)(d >> 27) & 15]);
+  d16 = (uint16_t)(d >> 16);
+  for (i = 0; i < 2; i++)
+  {
+    dy = d16 * y16;
+    y16 = (y16 * (uint16_t)((0UL - dy) >> 16)) >> 15;
+    if (y16 > 0xFFFF)
+    {
+      y16 = 0xFFFF;
+    }
+  }
+
+  /* One step in 32 bits, where dy is dn * y / 2^32, about 2^31 */
+  y = y16 << 16;
+  dy = mul_high(d, y);
+  if (dy <= 0x80000000UL)
+  {
+    t = mul_high(y, (0x80000000UL - dy) << 1);
+    if (t > 0xFFFFFFFFUL - y)
+    {
+      y = 0xFFFFFFFFUL;
+    }
+    else
+    {
+      y += t;
+    }
+  }
+  else
+  {
+    y -= mul_high(y, (dy - 0x80000000UL) << 1);
+  }
+
+  /* Allow for rounding in the steps above */
+  y -= 4;
+
+  return y >> (31 - shift);
+}
+
+/* Returns x / d rounded down, where recip is at most 2^32 / d
+   and not much less */
+static uint32_t div_recip(uint32_t x, uint32_t d, uint32_t recip)
+{
+  uint32_t q;
+  uint32_t rem;
+
+  q = mul_high(x, recip);
+  rem = x - q * d;
+  while (rem >= d)
+  {
+    q++;
+    rem -= d;
+  }
+  return q;
+}
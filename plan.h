@@ -0,0 +1,145 @@
+#ifndef __PLAN_H_
+#define __PLAN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The period in clock cycles from frequency in mHz
+// is p = F_CPU / (f / 1000) i.e. p = (1000 * F_CPU) / f
+// but 1000 * F_CPU may overflow a 32-bit integer
+// so find the smallest power of 2 k such that
+// (1000/k) * F_CPU does not overflow
+// i.e. (1000/k) * F_CPU < 0xFFFFFFFF
+// or (1000/k) < 0xFFFFFFFF/F_CPU
+// Then p = (1000/k * F_CPU) / (f/k)
+#if 1000 < 0xFFFFFFFF/F_CPU
+  #define F_CPU_MUL 1000
+  #define F_OUT_DIV 1
+#elif 500 < 0xFFFFFFFF/F_CPU
+  #define F_CPU_MUL 500
+  #define F_OUT_DIV 2
+#elif 250 < 0xFFFFFFFF/F_CPU
+  #define F_CPU_MUL 250
+  #define F_OUT_DIV 4
+#elif 125 < 0xFFFFFFFF/F_CPU
+  #define F_CPU_MUL 125
+  #define F_OUT_DIV 8
+#else
+  #error Cannot compute frequency scaling parameters
+#endif
+
+/* Timer1 settings for one period of the timer */
+typedef struct
+{
+  uint8_t clock_select;   /* CS12:CS10 in TCCR1B */
+  uint16_t top;           /* ICR1 */
+  uint16_t compare;       /* OCR1A */
+  uint16_t compare_b;     /* OCR1B, the same as compare with channel B off */
+  uint32_t period_ns;     /* actual period */
+  uint32_t freq_mHz;      /* actual frequency */
+} PLAN_timer_t;
+
+/* Timer1 settings and waveform table length for a whole output cycle */
+typedef struct
+{
+  PLAN_timer_t timer;         /* one timer period, i.e. one sample */
+  uint8_t table_length_bits;  /* 2^table_length_bits timer periods per cycle */
+  uint32_t period_ns;         /* actual period of the cycle */
+  uint32_t freq_mHz;          /* actual frequency of the cycle */
+} PLAN_search_t;
+
+/* Timer1 settings for a square wave too slow for the prescaler alone.
+   Timer1 runs with the 1024 prescaler and an interrupt at each BOTTOM
+   counts its periods, switching the output between the low [0] and
+   high [1] part of the cycle. Each part is split into as few timer
+   periods of at most 65536 prescaled clocks as it takes, the first
+   longer[] of them one clock longer than top[] + 1. */
+typedef struct
+{
+  uint16_t periods[2];    /* timer periods per part, 0 for an empty part */
+  uint16_t top[2];        /* ICR1 */
+  uint16_t longer[2];     /* periods with ICR1 at top + 1 */
+  uint32_t period_ns;     /* actual period, at most 0xFFFFFFFF */
+  uint32_t freq_mHz;      /* actual frequency */
+} PLAN_postscale_t;
+
+/* Sets the calibrated CPU clock frequency in Hz.
+   Only does any work when it changed. */
+void PLAN_set_f_cpu(uint32_t f_cpu);
+
+/* Sets up the second output on OC1B for the plans that follow, with
+   mode one of OUT_CHANNEL_B_*. With OUT_CHANNEL_B_PHASE, PLAN_timer plans
+   a timer period of half the cycle for CTC mode, where both outputs
+   toggle: OC1A at TOP, and OC1B compare_b + 1 clocks later. That is the
+   phase modulo 180 degrees; OC1B starts at the same level as OC1A for
+   a phase of 0 or above 180, and at the opposite level otherwise.
+   A compare_b of 0 misses its first toggle after TCNT1 is written,
+   which swaps the two.
+   Only PLAN_timer takes account of channel B; PLAN_dither and PLAN_search
+   need it off. */
+void PLAN_set_channel_b(uint8_t mode, uint16_t phase_degrees, uint16_t duty_cycle_permille);
+
+/* Works out the Timer1 settings for a timer period of value ns
+   (OUT_PERIOD_MODE) or a timer frequency of value mHz (OUT_FREQ_MODE).
+   value must be from 250 to 4*10^9, or in OUT_FREQ_MODE down to
+   wherever PLAN_postscale returns 0. */
+void PLAN_timer(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille);
+
+/* Like PLAN_timer, but with OC1A high for width_ns rather than a share
+   of the period. The smallest prescaler that fits the period also gives
+   the finest steps of width, one prescaled clock. Sets actual_width_ns to
+   the width rounded to that. Returns 1 if the width fits, or 0 if it had
+   to be made one prescaled clock, or one less than the period.
+   width_ns must be at most 4*10^9. */
+uint8_t PLAN_pulse(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint32_t width_ns,
+                   uint32_t* actual_width_ns);
+
+/* Like PLAN_timer, but when the timer period is from OUT_DITHER_MIN_CLOCKS
+   to 65535 clocks with no prescaler, rounds the period down and returns
+   the fraction of a clock left over in 1/65536ths. Periods of top + 1 and
+   top + 2 clocks in that proportion average out to value, and the actual
+   period and frequency are the average ones. Otherwise returns 0
+   and the settings from PLAN_timer. */
+uint16_t PLAN_dither(PLAN_timer_t* timer, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille);
+
+/* Works out the Timer1 settings and table length for an output cycle
+   of value ns (OUT_PERIOD_MODE) or value mHz (OUT_FREQ_MODE), with a
+   table of 2^min_bits to 2^max_bits samples. Picks the settings with
+   the smallest error, and of those the longest table. Table lengths
+   above 2^min_bits that would sample faster than OUT_MIN_SAMPLE_CLOCKS
+   are left out. Both are 0 for square waves.
+   value must be from 250 to 4*10^9. */
+void PLAN_search(PLAN_search_t* plan, uint8_t freq_mode, uint32_t value, uint16_t duty_cycle_permille,
+                 uint8_t min_bits, uint8_t max_bits);
+
+/* Works out the postscaler settings for a square wave of freq_mHz mHz.
+   Returns 1 if the cycle is longer than 65536 clocks with the 1024
+   prescaler, otherwise 0 and PLAN_timer can do it on its own. */
+uint8_t PLAN_postscale(PLAN_postscale_t* plan, uint32_t freq_mHz, uint16_t duty_cycle_permille);
+
+/* Returns the error as parts per million of value, at most 65535 */
+uint16_t PLAN_ppm(uint32_t error, uint32_t value);
+
+/* Returns the OCR1A value for a duty cycle in 0.1% steps from 0 to 1000
+   with ICR1 at top, rounded to the nearest clock. It only multiplies,
+   so a new duty cycle takes a few hundred cycles rather than a plan. */
+uint16_t PLAN_compare(uint16_t top, uint16_t duty_cycle_permille);
+
+/* Returns log2 of the Timer1 prescaler for clock_select from 1 to 5 */
+uint8_t PLAN_prescaler_shift(uint8_t clock_select);
+
+/* Returns n / d rounded down, for d > 0, without dividing */
+uint32_t PLAN_div(uint32_t n, uint32_t d);
+
+/* Returns the value for step of a sweep from start (step 0) to stop
+   (last_step), from 1 to 4*10^9. With log set the steps are spaced
+   evenly in log2 of the value, to about 100 ppm; otherwise evenly in the
+   value itself. The ends are exact. */
+uint32_t PLAN_sweep_value(uint32_t start, uint32_t stop, uint8_t step, uint8_t last_step, uint8_t log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "plan.h"
+#include "retune.h"
+
+/* A retune changes the Timer1 settings in two steps, so that every
+   period has both the old compare and TOP, or both the new ones:
+     1. write the new compares to OCR1A and OCR1B, which are
+        double-buffered and only take effect at the next TOP
+     2. just after that TOP, write ICR1 and the prescaler for the period
+        that has just started. ICR1 isn't double-buffered with TOP=ICR1,
+        and has to be written before the counter gets anywhere near
+        the new TOP, or it would run on to 0xFFFF.
+   With TOP=ICR1 the input capture flag is set at TOP, so the input
+   capture interrupt runs the steps. For short periods, polling TCNT1
+   with interrupts disabled takes its place, as long as the old period
+   is short too. TCNT1 is only ever written just after BOTTOM, so the
+   output stays in phase. */
+
+#define CLOCK_SELECT_MASK ((1<<CS12)|(1<<CS11)|(1<<CS10))
+
+// Slowest prescaler, /8, whose clock at TOP is waited out
+#define WAIT_CLOCK_SELECT 2
+
+enum
+{
+  RETUNE_IDLE,
+  RETUNE_COMPARE,   // next step is writing the compare
+  RETUNE_TOP        // new compare is in OCR1A, next step is writing ICR1
+};
+
+static volatile uint8_t state;
+
+// Settings being changed to
+static PLAN_timer_t target;
+static uint8_t target_dither;
+
+// Settings to change to next, when they came in after the target's
+// compare was already written
+static PLAN_timer_t next;
+static uint8_t next_dither;
+static uint8_t next_valid;
+
+// Length of a period with the settings last asked for, in CPU clocks,
+// and their prescaler
+static uint32_t period_clocks;
+static uint8_t clock_select;
+
+static void post(const PLAN_timer_t* timer, uint8_t dither);
+static void step(void);
+static void commit(void);
+static void restart(const PLAN_timer_t* timer, uint8_t dither);
+static void wait_for_bottom(void);
+static void end_top(void);
+static uint8_t set(const PLAN_timer_t* timer, uint8_t dither, uint8_t may_poll);
+
+uint8_t RETUNE_set(const PLAN_timer_t* timer, uint8_t dither)
+{
+  return set(timer, dither, 1);
+}
+
+uint8_t RETUNE_set_async(const PLAN_timer_t* timer, uint8_t dither)
+{
+  return set(timer, dither, 0);
+}
+
+static uint8_t set(const PLAN_timer_t* timer, uint8_t dither, uint8_t may_poll)
+{
+  uint32_t old_clocks;
+  uint8_t old_clock_select;
+  uint8_t running;
+  uint32_t shortest;
+  uint8_t shift;
+  uint8_t glitch_free = 1;
+
+  old_clocks = period_clocks;
+  old_clock_select = clock_select;
+  period_clocks = ((uint32_t)timer->top + 1) << PLAN_prescaler_shift(timer->clock_select);
+  clock_select = timer->clock_select;
+
+  TIMSK &= ~(1<<OCIE1B);
+  running = (TCCR1B & CLOCK_SELECT_MASK) >> CS10;
+  if (running == 0)
+  {
+    restart(timer, dither);
+    sei();
+    return 0;
+  }
+
+  /* The change has to be made before the counter reaches the new TOP.
+     With a new prescaler, the new compare also counts with the old one
+     until then, so it has to come later still. The old one is either the
+     one last asked for, or the one running if that change hasn't got as
+     far as the compare. */
+  shortest = (old_clocks < period_clocks) ? old_clocks : period_clocks;
+  if ((clock_select != old_clock_select) || (clock_select != running))
+  {
+    shift = PLAN_prescaler_shift(clock_select);
+    if (PLAN_prescaler_shift(old_clock_select) < shift)
+    {
+      shift = PLAN_prescaler_shift(old_clock_select);
+    }
+    if (PLAN_prescaler_shift(running) < shift)
+    {
+      shift = PLAN_prescaler_shift(running);
+    }
+    if (((uint32_t)timer->compare << shift) < shortest)
+    {
+      shortest = (uint32_t)timer->compare << shift;
+    }
+    /* OC1B too, unless OCR1B is only there for the dither interrupt */
+    if (!dither && (((uint32_t)timer->compare_b << shift) < shortest))
+    {
+      shortest = (uint32_t)timer->compare_b << shift;
+    }
+  }
+
+  if (shortest >= RETUNE_MIN_CLOCKS)
+  {
+    post(timer, dither);
+  }
+  else if (may_poll && (state == RETUNE_IDLE) &&
+           (old_clocks <= RETUNE_SYNC_MAX_CLOCKS) &&
+           (shortest >= RETUNE_SYNC_MIN_CLOCKS))
+  {
+    /* Up to a period to the TOP for the compare, if it's too late to
+       write it now, and another to the TOP it takes effect at */
+    post(timer, dither);
+    while (state != RETUNE_IDLE)
+    {
+      wait_for_bottom();
+      step();
+    }
+  }
+  else
+  {
+    glitch_free = 0;
+  }
+
+  if (!glitch_free)
+  {
+    restart(timer, dither);
+  }
+  sei();
+  return glitch_free;
+}
+
+uint8_t RETUNE_set_compare(uint16_t compare)
+{
+  PLAN_timer_t timer;
+
+  if (state == RETUNE_IDLE)
+  {
+    OCR1A = compare;
+    sei();
+    return 1;
+  }
+
+  /* Otherwise it belongs to the settings still on their way in */
+  if (next_valid)
+  {
+    timer = next;
+    timer.compare = compare;
+    return RETUNE_set(&timer, next_dither);
+  }
+  timer = target;
+  timer.compare = compare;
+  return RETUNE_set(&timer, target_dither);
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+  step();
+}
+
+/* Starts a retune, or queues it behind the one under way */
+static void post(const PLAN_timer_t* timer, uint8_t dither)
+{
+  if (state == RETUNE_TOP)
+  {
+    next = *timer;
+    next_dither = dither;
+    next_valid = 1;
+    return;
+  }
+
+  target = *timer;
+  target_dither = dither;
+  next_valid = 0;
+  if (state == RETUNE_IDLE)
+  {
+    /* Early enough in the period to write the compare now */
+    if (TCNT1 < ICR1/2)
+    {
+      OCR1A = target.compare;
+      OCR1B = target.compare_b;
+      state = RETUNE_TOP;
+    }
+    else
+    {
+      state = RETUNE_COMPARE;
+    }
+    TIFR = 1<<ICF1;
+    TIMSK |= 1<<TICIE1;
+  }
+}
+
+/* The next step of the retune, at TOP */
+static void step(void)
+{
+  /* The counter stays at TOP for a whole prescaled clock, which is only
+     waited out up to /8 */
+  if (TCNT1 == ICR1)
+  {
+    if ((TCCR1B & CLOCK_SELECT_MASK) > (WAIT_CLOCK_SELECT << CS10))
+    {
+      end_top();
+    }
+    while (TCNT1 == ICR1)
+    {
+    }
+  }
+
+  if (state == RETUNE_TOP)
+  {
+    /* The new compare took effect at this TOP */
+    commit();
+    state = RETUNE_IDLE;
+    if (next_valid)
+    {
+      target = next;
+      target_dither = next_dither;
+      next_valid = 0;
+      state = RETUNE_COMPARE;
+    }
+    else if (target_dither)
+    {
+      TIFR = 1<<OCF1B;
+      TIMSK |= 1<<OCIE1B;
+    }
+  }
+
+  if (state == RETUNE_COMPARE)
+  {
+    OCR1A = target.compare;
+    OCR1B = target.compare_b;
+    state = RETUNE_TOP;
+  }
+  else if (state == RETUNE_IDLE)
+  {
+    TIMSK &= ~(1<<TICIE1);
+  }
+}
+
+/* Writes ICR1 and the prescaler just after TOP */
+static void commit(void)
+{
+  uint8_t running;
+  uint32_t count;
+
+  running = (TCCR1B & CLOCK_SELECT_MASK) >> CS10;
+  if (running == target.clock_select)
+  {
+    ICR1 = target.top;
+    return;
+  }
+
+  /* Stop the timer and carry the few clocks since BOTTOM over to the new
+     prescaler, then restart it from the beginning of a prescaled clock */
+  TCCR1B &= ~CLOCK_SELECT_MASK;
+  count = (uint32_t)TCNT1 << PLAN_prescaler_shift(running);
+  count >>= PLAN_prescaler_shift(target.clock_select);
+  if (count >= target.top)
+  {
+    /* Already as long as a whole new period, so end it now */
+    count = target.top - 1;
+  }
+  TCNT1 = (uint16_t)count;
+  ICR1 = target.top;
+  SFIOR |= 1<<PSR10;
+  TCCR1B |= target.clock_select << CS10;
+}
+
+/* Ends the TOP the counter is sitting at with a prescaler slower than
+   /8, rather than waiting up to 1024 cycles for its next clock. With
+   /1 the counter goes to BOTTOM at once, and then the prescaler starts
+   over from there, so the period that has just ended is cut short by
+   less than one of its prescaled clocks. */
+static void end_top(void)
+{
+  uint8_t running;
+
+  running = TCCR1B & CLOCK_SELECT_MASK;
+  TCCR1B = (TCCR1B & ~CLOCK_SELECT_MASK) | (1<<CS10);
+  while (TCNT1 == ICR1)
+  {
+  }
+  TCCR1B &= ~CLOCK_SELECT_MASK;
+  TCNT1 = 0;
+  SFIOR |= 1<<PSR10;
+  TCCR1B |= running;
+}
+
+/* Sets up the timer from scratch, abandoning any retune under way */
+static void restart(const PLAN_timer_t* timer, uint8_t dither)
+{
+  state = RETUNE_IDLE;
+  next_valid = 0;
+  TIMSK &= ~(1<<TICIE1);
+
+  /* Stopped while the registers are written, so that it starts
+     from BOTTOM with all of them in place */
+  TCCR1B &= ~CLOCK_SELECT_MASK;
+  OCR1A = 0;
+  ICR1 = timer->top;
+  TCNT1 = 0;
+  OCR1A = timer->compare;
+  OCR1B = timer->compare_b;
+  TCCR1B |= timer->clock_select << CS10;
+
+  if (dither)
+  {
+    TIFR = 1<<OCF1B;
+    TIMSK |= 1<<OCIE1B;
+  }
+}
+
+/* Returns just after the counter next goes back to BOTTOM */
+static void wait_for_bottom(void)
+{
+  uint16_t last;
+  uint16_t count;
+
+  last = TCNT1;
+  while ((count = TCNT1) >= last)
+  {
+    last = count;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef __RETUNE_H_
+#define __RETUNE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shortest Timer1 period in CPU clock cycles, before and after a retune,
+   for which the TOP interrupt makes the change. It must be longer than
+   the worst-case latency of that interrupt plus its time to the ICR1
+   write, including the time other interrupts keep interrupts disabled.
+   When the prescaler changes, the new compare in clocks of the faster
+   of the two prescalers has to be at least as long too. */
+#define RETUNE_MIN_CLOCKS 256
+
+/* The same, for polling TCNT1 with interrupts disabled instead */
+#define RETUNE_SYNC_MIN_CLOCKS 64
+
+/* Longest period before the retune, in CPU clock cycles, for which
+   polling is used. It keeps interrupts disabled for up to two of these
+   periods, so anything longer restarts the timer. */
+#define RETUNE_SYNC_MAX_CLOCKS 256
+
+/* Moves Timer1 to new settings at the end of a period, so that OC1A
+   never sees a truncated or stretched one. With dither set, starts the
+   compare B interrupt once they are in effect. Call with interrupts
+   disabled; they are enabled on return.
+   Returns 0 if the timer had to be restarted instead, when the timer
+   wasn't running or a period or the compare is too short. */
+uint8_t RETUNE_set(const PLAN_timer_t* timer, uint8_t dither);
+
+/* The same, for interrupts that must not be held up: it never polls,
+   and restarts the timer where RETUNE_set would poll. */
+uint8_t RETUNE_set_async(const PLAN_timer_t* timer, uint8_t dither);
+
+/* Changes only the compare of the settings last asked for, through the
+   buffered OCR1A, so it takes effect at the next TOP that has their ICR1.
+   Call with interrupts disabled; they are enabled on return.
+   Returns 0 if the timer had to be restarted, as RETUNE_set. */
+uint8_t RETUNE_set_compare(uint16_t compare);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
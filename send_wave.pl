@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+
+sub usage
+{
+  my $msg = shift || '';
+  print <<"END";
+send_wave.pl - upload an arbitrary waveform to siggen1 (OUT_UPLOAD)
+Usage: perl send_wave.pl samples.txt bits device [baud]
+
+Reads one cycle of samples from -127 to 127 from samples.txt, separated
+by white space, resamples them to 2^bits, which must be the build's
+OUT_MAX_WAVEFORM_LENGTH_BITS, and sends them in a frame as upload.h
+describes. device is set to baud (default 9600), 8N1, with stty;
+use - to write the frame to stdout instead.
+
+$msg
+END
+  exit(1);
+}
+
+my $in_fn = $ARGV[0];
+my $bits = $ARGV[1];
+my $device = $ARGV[2];
+my $baud = $ARGV[3] || 9600;
+$in_fn or usage('No samples file specified');
+defined $bits or usage('No table length specified');
+$device or usage('No device specified');
+($bits >= 4) && ($bits <= 8)
+  or usage('The table length must be between 2^4 and 2^8');
+
+open(my $in, '<', $in_fn) or die "Can't open $in_fn: $!";
+my @samples = map { split ' ' } <$in>;
+close($in);
+(@samples >= 2) or usage('Need at least 2 samples');
+
+# Linear interpolation round the cycle, clamped to the range
+my $n = 1 << $bits;
+my @frame = (ord('W'), $bits);
+my $checksum = 0xAA;
+for (my $i = 0; $i < $n; $i++)
+{
+  my $pos = $i * @samples / $n;
+  my $j = int($pos);
+  my $frac = $pos - $j;
+  my $value = $samples[$j] * (1 - $frac) + $samples[($j + 1) % @samples] * $frac;
+  $value = int($value + (($value < 0) ? -0.5 : 0.5));
+  $value = 127 if $value > 127;
+  $value = -127 if $value < -127;
+  push(@frame, $value & 0xFF);
+  $checksum = ($checksum + $value) & 0xFF;
+}
+push(@frame, $checksum);
+
+my $out;
+if ($device eq '-')
+{
+  $out = \*STDOUT;
+}
+else
+{
+  system('stty', '-F', $device, $baud, 'raw', 'cs8', '-cstopb', '-parenb') == 0
+    or die "Can't set up $device";
+  open($out, '>', $device) or die "Can't open $device: $!";
+}
+binmode($out);
+print $out pack('C*', @frame);
+close($out);
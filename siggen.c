@@ -7,6 +7,7 @@
 #include "ui.h"
 #include "out.h"
 #include "store.h"
+#include "upload.h"
 
 int main(void)
 {
@@ -21,6 +22,9 @@ int main(void)
   UI_init();
   OUT_init();
   STORE_init();
+#if OUT_UPLOAD
+  UPLOAD_init();
+#endif
 
   sei();
 
@@ -29,5 +33,8 @@ int main(void)
     UI_cyclic();
     OUT_cyclic();
     STORE_cyclic();
+#if OUT_UPLOAD
+    UPLOAD_cyclic();
+#endif
   }
 }
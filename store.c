@@ -1,12 +1,28 @@
+#include <avr/io.h>
 #include <avr/eeprom.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "out.h"
 #include "store.h"
 
 /* This is where the settings are stored in EEPROM */
 #define EEPROM_START 0
 
+/* and the segments of a sequence, leaving room for more settings */
+#define EEPROM_SEGMENTS_START 16
+
+#define NO_SEGMENT 0xFF
+
+/* and the shape of OUT_ARBITRARY, out of the way at the end, followed
+   by its checksum */
+#define ARBITRARY_LENGTH (1 << OUT_MAX_WAVEFORM_LENGTH_BITS)
+#define EEPROM_ARBITRARY_START (E2END + 1 - ARBITRARY_LENGTH - 1)
+
+#if OUT_UPLOAD && OUT_SEQUENCE && (EEPROM_SEGMENTS_START + 7 * OUT_SEQUENCE_MAX_SEGMENTS > EEPROM_ARBITRARY_START)
+  #error The segments of a sequence run into the stored arbitrary waveform
+#endif
+
 /* Number of cycles to wait before starting transfer to EEPROM */
 #define WAIT_BEFORE_WRITING 30
 
@@ -24,7 +40,23 @@ static struct
 static volatile uint8_t tick;
 static uint8_t wait_count;
 
+/* The segment last set, until it's written to EEPROM */
+static STORE_segment_t pending_segment;
+static uint8_t pending_index = NO_SEGMENT;
+
+#if OUT_UPLOAD
+/* The shape being written to EEPROM, the next byte of it to write, or
+   ARBITRARY_LENGTH for the checksum, and the checksum so far */
+static const int8_t* arbitrary;
+static uint16_t arbitrary_index = ARBITRARY_LENGTH + 1;
+static uint8_t arbitrary_sum;
+#endif
+
 static uint8_t compute_checksum(void);
+static void write_segment(void);
+#if OUT_UPLOAD
+static void write_arbitrary(void);
+#endif
 
 void STORE_init(void)
 {
@@ -62,9 +94,13 @@ void STORE_cyclic(void)
       {
         settings.checksum = compute_checksum();
         eeprom_update_block((const void *)&settings, (void*)EEPROM_START, sizeof(settings));
+        write_segment();
       }
     }
   }
+#if OUT_UPLOAD
+  write_arbitrary();
+#endif
 }
 
 void STORE_set_osccal(uint8_t new_value)
@@ -117,6 +153,89 @@ uint8_t STORE_get_waveform(void)
   return settings.waveform;
 }
 
+void STORE_set_segment(uint8_t index, const STORE_segment_t* segment)
+{
+  if (index != pending_index)
+  {
+    write_segment();
+  }
+  pending_segment = *segment;
+  pending_index = index;
+  wait_count = WAIT_BEFORE_WRITING;
+}
+void STORE_get_segment(uint8_t index, STORE_segment_t* segment)
+{
+  if (index == pending_index)
+  {
+    *segment = pending_segment;
+  }
+  else
+  {
+    eeprom_read_block((void *)segment,
+                      (const void*)(EEPROM_SEGMENTS_START + index * sizeof(STORE_segment_t)),
+                      sizeof(STORE_segment_t));
+  }
+}
+
+static void write_segment(void)
+{
+  if (pending_index != NO_SEGMENT)
+  {
+    eeprom_update_block((const void *)&pending_segment,
+                        (void*)(EEPROM_SEGMENTS_START + pending_index * sizeof(STORE_segment_t)),
+                        sizeof(STORE_segment_t));
+    pending_index = NO_SEGMENT;
+  }
+}
+
+#if OUT_UPLOAD
+void STORE_set_arbitrary(const int8_t* samples)
+{
+  arbitrary = samples;
+  arbitrary_index = 0;
+  arbitrary_sum = 0xAA;
+}
+uint8_t STORE_get_arbitrary(int8_t* samples)
+{
+  uint16_t i;
+  uint8_t sum;
+
+  /* Check it first, to leave samples alone if it's no good */
+  sum = 0xAA;
+  for (i = 0; i < ARBITRARY_LENGTH; i++)
+  {
+    sum += eeprom_read_byte((const uint8_t*)(EEPROM_ARBITRARY_START + i));
+  }
+  if (sum != eeprom_read_byte((const uint8_t*)(EEPROM_ARBITRARY_START + ARBITRARY_LENGTH)))
+  {
+    return 0;
+  }
+  eeprom_read_block((void *)samples, (const void*)EEPROM_ARBITRARY_START, ARBITRARY_LENGTH);
+  return 1;
+}
+
+/* One byte each time round, and only when the EEPROM isn't still busy
+   with the last one, so that nothing waits the 8.5 ms a byte takes.
+   The checksum goes last, so a shape only partly written when the power
+   went off fails it, bar a 1 in 256 chance. */
+static void write_arbitrary(void)
+{
+  if ((arbitrary_index <= ARBITRARY_LENGTH) && eeprom_is_ready())
+  {
+    if (arbitrary_index < ARBITRARY_LENGTH)
+    {
+      eeprom_update_byte((uint8_t*)(EEPROM_ARBITRARY_START + arbitrary_index), arbitrary[arbitrary_index]);
+      arbitrary_sum += arbitrary[arbitrary_index];
+    }
+    else
+    {
+      eeprom_update_byte((uint8_t*)(EEPROM_ARBITRARY_START + ARBITRARY_LENGTH), arbitrary_sum);
+    }
+    arbitrary_index++;
+  }
+}
+#endif
+
 static uint8_t compute_checksum(void)
 {
   uint8_t sum;
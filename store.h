@@ -5,6 +5,16 @@
 extern "C" {
 #endif
 
+/* One segment of a sequence (OUT_SEQUENCE). A waveform past
+   OUT_WAVEFORM_LAST, as in erased EEPROM, or a duration of 0 ends the
+   sequence. */
+typedef struct
+{
+  uint8_t waveform;
+  uint32_t freq_mHz;
+  uint16_t duration_ms;
+} STORE_segment_t;
+
 void STORE_init(void);
 
 void STORE_cyclic(void);
@@ -28,6 +38,21 @@ uint8_t STORE_get_contrast(void);
 void STORE_set_waveform(uint8_t new_value);
 uint8_t STORE_get_waveform(void);
 
+/* Segments are kept in EEPROM after the settings, not in SRAM.
+   Setting one is written out once it has been left alone for a while,
+   as the settings are; getting it reads back what was last set. */
+void STORE_set_segment(uint8_t index, const STORE_segment_t* segment);
+void STORE_get_segment(uint8_t index, STORE_segment_t* segment);
+
+/* The shape of OUT_ARBITRARY (OUT_UPLOAD), 2^OUT_MAX_WAVEFORM_LENGTH_BITS
+   samples, is kept at the end of EEPROM with a checksum. Setting it
+   writes it out a byte at a time from STORE_cyclic, reading the samples
+   as it goes, so they have to stay put until then; setting it again
+   starts over. Getting it returns 0, leaving samples alone, if what's
+   there isn't one, as in erased EEPROM. */
+void STORE_set_arbitrary(const int8_t* samples);
+uint8_t STORE_get_arbitrary(int8_t* samples);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@
 #include "ui.h"
 #include "out.h"
 #include "store.h"
+#include "upload.h"
 #include "lcd.h"
 #include "format.h"
 
@@ -36,7 +37,52 @@ enum
   PARAM_ALTERNATE,
   PARAM_WAVEFORM,
   PARAM_DUTY_CYCLE,
+  PARAM_PULSE_WIDTH,
+#if OUT_LFSR
+  PARAM_PRBS,
+#endif
+#if OUT_CHANNEL_B
+  PARAM_CHANNEL_B,
+  PARAM_CHANNEL_B_PHASE,
+  PARAM_CHANNEL_B_DUTY_CYCLE,
+#endif
+#if OUT_SYNC
+  PARAM_SYNC,
+#endif
+#if OUT_SWEEP
+  PARAM_SWEEP,
+  PARAM_SWEEP_STOP,
+  PARAM_SWEEP_STEPS,
+  PARAM_SWEEP_DWELL,
+#endif
+#if OUT_SEQUENCE
+  PARAM_SEQUENCE,
+  PARAM_SEGMENT,
+  PARAM_SEGMENT_WAVEFORM,
+  PARAM_SEGMENT_FREQ,
+  PARAM_SEGMENT_TIME,
+#endif
+#if OUT_GATE
+  PARAM_GATE,
+  PARAM_BURST_CYCLES,
+  PARAM_ON,
+#endif
   PARAM_AMPLITUDE,
+#if OUT_SHAPING
+  PARAM_SHAPING,
+#endif
+#if OUT_TWO_TONE
+  PARAM_TONE2_FREQ,
+  PARAM_TONE2_AMPLITUDE,
+#endif
+  PARAM_SAMPLING,
+#if OUT_PWM_DAC
+  PARAM_PWM_DAC,
+#endif
+#if OUT_UPLOAD
+  PARAM_UPLOAD,
+#endif
+  PARAM_ERROR,
   PARAM_CONTRAST,
   PARAM_FINE_CALIBRATE,
   PARAM_MEDIUM_CALIBRATE,
@@ -56,6 +102,20 @@ static volatile uint8_t prev_press;
 
 static char scratch[15];
 
+#if OUT_TWO_TONE
+// The second tone steps through the DTMF frequencies, in Hz
+static const uint16_t dtmf_hz[] PROGMEM =
+{
+  697, 770, 852, 941, 1209, 1336, 1477, 1633
+};
+#endif
+
+#if OUT_SEQUENCE
+// The segment being edited
+static uint8_t selected_segment;
+#endif
+
+static void ui_tick(void);
 static void check_button(volatile uint8_t* port,
                          uint8_t mask,
                          uint8_t* history,
@@ -63,6 +123,8 @@ static void check_button(volatile uint8_t* port,
                          volatile uint8_t* press);
 
 static uint8_t check_up_down(uint8_t *value, uint8_t inclusive_max);
+static uint8_t check_up_down_step(uint16_t *value, uint8_t step, uint16_t inclusive_max);
+static uint8_t check_up_down_125(uint32_t *value, uint32_t min, uint32_t max);
 
 static void edit_number(void);
 
@@ -76,12 +138,20 @@ void UI_init(void)
 {
   LCD_init();
 
+#if OUT_TICK_HZ == 50
   // Configure Timer 2 to generate interrupt at approx 50Hz
   // and toggle OC2
   TCCR2 = (1<<WGM21)|(0<<WGM20)|
           (0<<COM21)|(1<<COM20)|
           (1<<CS22)|(1<<CS21)|(1<<CS20);
   OCR2 = (uint8_t)(F_CPU / 1024 / 50 - 1);
+#else
+  // The same at OUT_TICK_HZ, for timing sequences
+  TCCR2 = (1<<WGM21)|(0<<WGM20)|
+          (0<<COM21)|(1<<COM20)|
+          (1<<CS22)|(0<<CS21)|(0<<CS20);
+  OCR2 = (uint8_t)(F_CPU / 64 / OUT_TICK_HZ - 1);
+#endif
   TIMSK |= (1<<OCIE2);
 
   // Configure PC2, PC3, PC4, PC5 as inputs with pull-ups enabled
@@ -143,7 +213,38 @@ void UI_cyclic(void)
   myGLCD.setContrast(STORE_get_contrast());
 }
 
-ISR(TIMER2_COMP_vect)
+ISR(TIMER2_COMP_vect, ISR_NOBLOCK)
+{
+#if OUT_TICK_HZ != 50
+  static uint8_t tick_count;
+#endif
+
+  // Interrupts are already enabled again (ISR_NOBLOCK), before the
+  // registers are saved, so that waveform generation and the sync
+  // input don't wait for this; but don't let it nest itself
+  cli();
+  TIMSK &= ~(1<<OCIE2);
+  sei();
+
+  OUT_tick();
+
+#if OUT_TICK_HZ != 50
+  // The buttons and the rest go at 50 Hz
+  if (++tick_count >= OUT_TICK_HZ / 50)
+  {
+    tick_count = 0;
+    ui_tick();
+  }
+#else
+  ui_tick();
+#endif
+
+  cli();
+  TIMSK |= (1<<OCIE2);
+  sei();
+}
+
+static void ui_tick(void)
 {
   static uint8_t up_history;
   static uint8_t down_history;
@@ -154,11 +255,6 @@ ISR(TIMER2_COMP_vect)
   static uint8_t next_count;
   static uint8_t prev_count;
 
-  // enable nested interrupts for waveform generation
-  // but don't let this interrupt nest itself
-  TIMSK &= ~(1<<OCIE2);
-  sei();
-
   check_button(&PINC, 1<<PC3, &up_history, &up_count, &up_press);
   check_button(&PINC, 1<<PC2, &down_history, &down_count, &down_press);
   check_button(&PINC, 1<<PC5, &next_history, &next_count, &next_press);
@@ -172,15 +268,15 @@ ISR(TIMER2_COMP_vect)
   }
 
   STORE_tick();
+#if OUT_UPLOAD
+  UPLOAD_tick();
+#endif
 
   if ((wait_after_freq_change != 0) &&
       (wait_after_freq_count > 0))
   {
     wait_after_freq_count--;
   }
-
-  cli();
-  TIMSK |= (1<<OCIE2);
 }
 
 static void check_button(volatile uint8_t* port,
@@ -250,6 +346,108 @@ static uint8_t check_up_down(uint8_t *value, uint8_t inclusive_max)
   return pressed;
 }
 
+// As check_up_down, but in steps of step, going to the next
+// multiple of step from a value in between
+static uint8_t check_up_down_step(uint16_t *value, uint8_t step, uint16_t inclusive_max)
+{
+  uint8_t pressed;
+  pressed = 0;
+  if (up_press)
+  {
+    up_press = 0;
+    pressed = 1;
+    if (*value - *value % step + step <= inclusive_max)
+    {
+      *value += step - *value % step;
+    }
+    else
+    {
+      *value = 0;
+    }
+  }
+  if (down_press)
+  {
+    down_press = 0;
+    pressed = 1;
+    if (*value == 0)
+    {
+      *value = inclusive_max;
+    }
+    else if (*value % step != 0)
+    {
+      *value -= *value % step;
+    }
+    else
+    {
+      *value -= step;
+    }
+  }
+  return pressed;
+}
+
+// Steps through 1, 2 and 5 times powers of 10 from min to max,
+// going to the next one from a value in between
+static uint8_t check_up_down_125(uint32_t *value, uint32_t min, uint32_t max)
+{
+  uint8_t pressed;
+  uint32_t decade;
+  pressed = 0;
+
+  decade = 1;
+  while (*value / decade >= 10)
+  {
+    decade *= 10;
+  }
+
+  if (up_press)
+  {
+    up_press = 0;
+    pressed = 1;
+    if (*value < 2 * decade)
+    {
+      *value = 2 * decade;
+    }
+    else if (*value < 5 * decade)
+    {
+      *value = 5 * decade;
+    }
+    else if (decade <= max / 10)
+    {
+      *value = 10 * decade;
+    }
+    if (*value > max)
+    {
+      *value = max;
+    }
+  }
+  if (down_press)
+  {
+    down_press = 0;
+    pressed = 1;
+    if (*value > 5 * decade)
+    {
+      *value = 5 * decade;
+    }
+    else if (*value > 2 * decade)
+    {
+      *value = 2 * decade;
+    }
+    else if (*value > decade)
+    {
+      *value = decade;
+    }
+    else
+    {
+      *value = decade / 2;
+    }
+    if (*value < min)
+    {
+      *value = min;
+    }
+  }
+  return pressed;
+}
+
 static void show_units(void)
 {
   static char units_string[4];
@@ -314,6 +512,22 @@ static void show_waveform(void)
   {
     s = PSTR("sine");
   }
+  else if (waveform == OUT_PULSE)
+  {
+    s = PSTR("pulse");
+  }
+#if OUT_LFSR
+  else if (waveform == OUT_NOISE)
+  {
+    s = PSTR("noise");
+  }
+#endif
+#if OUT_UPLOAD
+  else if (waveform == OUT_ARBITRARY)
+  {
+    s = PSTR("arbitrary");
+  }
+#endif
   else
   {
     s = PSTR("square");
@@ -372,7 +586,7 @@ static void edit_number(void)
     waveform = OUT_get_waveform();
     if (selected_param == PARAM_SCALE)
     {
-      if (waveform == OUT_SQUARE)
+      if ((waveform == OUT_SQUARE) || (waveform == OUT_PULSE))
       {
         if (up)
         {
@@ -383,12 +597,36 @@ static void edit_number(void)
         }
         else // down
         {
+#if OUT_POSTSCALE
+          if ((n > 2500) ||
+              ((n >= 10) && (OUT_get_freq_mode() == OUT_FREQ_MODE)))
+#else
           if (n > 2500)
+#endif
           {
             n /= 10;
           }
         }
       }
+#if OUT_LFSR
+      else if (waveform == OUT_NOISE)
+      {
+        if (up)
+        {
+          if (n < (OUT_MAX_NOISE_FREQUENCY_mHz/10))
+          {
+            n *= 10;
+          }
+        }
+        else // down
+        {
+          if (n > (OUT_MIN_NOISE_PERIOD_NS*10))
+          {
+            n /= 10;
+          }
+        }
+      }
+#endif
       else // triangle or sine
       {
         if (up)
@@ -509,9 +747,14 @@ static void show_parameter(void)
   uint8_t unit_steps;
   scratch[0] = '\0';
   uint32_t u32;
+  uint16_t u16;
   uint8_t u8;
   int8_t i8;
   static uint8_t freq_mode;
+#if OUT_SEQUENCE
+  STORE_segment_t segment;
+  uint8_t pressed;
+#endif
 
   freq_mode = (OUT_get_freq_mode() == OUT_FREQ_MODE);
   switch (selected_param)
@@ -590,16 +833,318 @@ static void show_parameter(void)
     break;
 
   case PARAM_DUTY_CYCLE:
-    strcpy_P(s, PSTR("Duty-cycle:"));
-    u8 = OUT_get_duty_cycle_percent();
-    FORMAT_cat_uint8(s, u8);
+    // 0.1% steps when the timer period is long enough for them
+    strcpy_P(s, PSTR("Duty:"));
+    u16 = OUT_get_duty_cycle_permille();
+    FORMAT_cat_uint16(s, u16 / 10);
+    if (OUT_get_duty_cycle_fine() || (u16 % 10 != 0))
+    {
+      strcat_P(s, PSTR("."));
+      FORMAT_cat_uint8(s, u16 % 10);
+    }
     strcat_P(s, percent);
-    if (check_up_down(&u8, 100))
+    if (check_up_down_step(&u16, OUT_get_duty_cycle_fine() ? 1 : 10, 1000))
+    {
+      OUT_set_duty_cycle_permille(u16);
+    }
+    break;
+
+  case PARAM_PULSE_WIDTH:
+    // Actual width of a pulse, e.g. "W(us):1.000", with '!' in place
+    // of ':' when the width set doesn't fit the period
+    strcpy_P(s, PSTR("W(ns):"));
+    if (!OUT_get_pulse_width_fits())
+    {
+      s[5] = '!';
+    }
+    u32 = OUT_get_pulse_width_actual_ns();
+    unit_steps = FORMAT_cat_uint32(s, u32, 8);
+    switch (unit_steps)
+    {
+    case 0: break;
+    case 1: s[2] = 'u'; break;
+    case 2: s[2] = 'm'; break;
+    case 3: s[2] = ' '; break;
+    default:s[2] = '?'; break;
+    }
+    u32 = OUT_get_pulse_width_ns();
+    if (check_up_down_125(&u32, 100, 2000000000UL))
+    {
+      OUT_set_pulse_width_ns(u32);
+    }
+    break;
+
+#if OUT_LFSR
+  case PARAM_PRBS:
+    // Length of the LFSR for noise e.g. "Noise: PRBS15"
+    strcpy_P(s, PSTR("Noise: PRBS"));
+    u8 = OUT_get_prbs();
+    switch (u8)
+    {
+    case OUT_PRBS7:  strcat_P(s, PSTR("7")); break;
+    case OUT_PRBS9:  strcat_P(s, PSTR("9")); break;
+    case OUT_PRBS11: strcat_P(s, PSTR("11")); break;
+    default:         strcat_P(s, PSTR("15")); break;
+    }
+    if (check_up_down(&u8, OUT_PRBS_LAST))
+    {
+      OUT_set_prbs(u8);
+    }
+    break;
+#endif
+
+#if OUT_CHANNEL_B
+  case PARAM_CHANNEL_B:
+    u8 = OUT_get_channel_b();
+    switch (u8)
+    {
+    case OUT_CHANNEL_B_IN_PHASE: strcpy_P(s, PSTR("B: in phase")); break;
+    case OUT_CHANNEL_B_INVERTED: strcpy_P(s, PSTR("B: inverted")); break;
+    case OUT_CHANNEL_B_PHASE:    strcpy_P(s, PSTR("B: 50% phase")); break;
+    default:                     strcpy_P(s, PSTR("B: off")); break;
+    }
+    if (check_up_down(&u8, OUT_CHANNEL_B_LAST))
+    {
+      OUT_set_channel_b(u8);
+    }
+    break;
+
+  case PARAM_CHANNEL_B_PHASE:
+    // Only used with "B: 50% phase"
+    strcpy_P(s, PSTR("B phase:"));
+    u16 = OUT_get_channel_b_phase_degrees();
+    FORMAT_cat_uint16(s, u16);
+    strcat_P(s, PSTR("deg"));
+    if (check_up_down_step(&u16, 5, 355))
+    {
+      OUT_set_channel_b_phase_degrees(u16);
+    }
+    break;
+
+  case PARAM_CHANNEL_B_DUTY_CYCLE:
+    // Only used with "B: in phase", in steps as for OC1A
+    strcpy_P(s, PSTR("B duty:"));
+    u16 = OUT_get_channel_b_duty_cycle_permille();
+    FORMAT_cat_uint16(s, u16 / 10);
+    if (OUT_get_duty_cycle_fine() || (u16 % 10 != 0))
+    {
+      strcat_P(s, PSTR("."));
+      FORMAT_cat_uint8(s, u16 % 10);
+    }
+    strcat_P(s, percent);
+    if (check_up_down_step(&u16, OUT_get_duty_cycle_fine() ? 1 : 10, 1000))
+    {
+      OUT_set_channel_b_duty_cycle_permille(u16);
+    }
+    break;
+#endif
+
+#if OUT_SYNC
+  case PARAM_SYNC:
+    u8 = OUT_get_sync();
+    strcpy_P(s, u8 ? PSTR("Sync: on") : PSTR("Sync: off"));
+    if (check_up_down(&u8, 1))
+    {
+      OUT_set_sync(u8);
+    }
+    break;
+#endif
+
+#if OUT_SWEEP
+  case PARAM_SWEEP:
+    // The step going out follows the mode e.g. "Sweep: log 3"
+    u8 = OUT_get_sweep();
+    switch (u8)
+    {
+    case OUT_SWEEP_LINEAR: strcpy_P(s, PSTR("Sweep: lin ")); break;
+    case OUT_SWEEP_LOG:    strcpy_P(s, PSTR("Sweep: log ")); break;
+    default:               strcpy_P(s, PSTR("Sweep: off")); break;
+    }
+    if (u8 != OUT_SWEEP_OFF)
+    {
+      FORMAT_cat_uint8(s, OUT_get_sweep_step());
+    }
+    if (check_up_down(&u8, OUT_SWEEP_LAST))
+    {
+      OUT_set_sweep(u8);
+    }
+    break;
+
+  case PARAM_SWEEP_STOP:
+    // Stop frequency in a 1-2-5 series e.g. "To(kHz):10.000"
+    strcpy_P(s, PSTR("To(mHz):"));
+    u32 = OUT_get_sweep_stop_mHz();
+    unit_steps = FORMAT_cat_uint32(s, u32, 6);
+    switch (unit_steps)
     {
-      OUT_set_duty_cycle_percent(u8);
+    case 0: break;
+    case 1: s[3] = ' '; break;
+    case 2: s[3] = 'k'; break;
+    case 3: s[3] = 'M'; break;
+    default:s[3] = '?'; break;
+    }
+    if (check_up_down_125(&u32, 1000, 500000000UL))
+    {
+      OUT_set_sweep_stop_mHz(u32);
+    }
+    break;
+
+  case PARAM_SWEEP_STEPS:
+    strcpy_P(s, PSTR("Steps:"));
+    u8 = OUT_get_sweep_steps();
+    FORMAT_cat_uint8(s, u8);
+    if (check_up_down(&u8, OUT_SWEEP_MAX_STEPS))
+    {
+      OUT_set_sweep_steps(u8);
+    }
+    break;
+
+  case PARAM_SWEEP_DWELL:
+    // Time per step in a 1-2-5 series
+    strcpy_P(s, PSTR("Dwell:"));
+    u32 = OUT_get_sweep_dwell_ms();
+    FORMAT_cat_uint16(s, (uint16_t)u32);
+    strcat_P(s, PSTR("ms"));
+    if (check_up_down_125(&u32, 20, 50000))
+    {
+      OUT_set_sweep_dwell_ms((uint16_t)u32);
+    }
+    break;
+#endif
+
+#if OUT_SEQUENCE
+  case PARAM_SEQUENCE:
+    // The segment playing follows the mode, from 1 e.g. "Seq: loop 2/4"
+    u8 = OUT_get_sequence();
+    switch (u8)
+    {
+    case OUT_SEQUENCE_ONCE: strcpy_P(s, PSTR("Seq: once ")); break;
+    case OUT_SEQUENCE_LOOP: strcpy_P(s, PSTR("Seq: loop ")); break;
+    default:                strcpy_P(s, PSTR("Seq: off")); break;
+    }
+    if (OUT_get_sequence_length() != 0)
+    {
+      FORMAT_cat_uint8(s, OUT_get_sequence_segment() + 1);
+      strcat_P(s, PSTR("/"));
+      FORMAT_cat_uint8(s, OUT_get_sequence_length());
+    }
+    if (check_up_down(&u8, OUT_SEQUENCE_LAST))
+    {
+      OUT_set_sequence(u8);
     }
     break;
 
+  case PARAM_SEGMENT:
+    // Which segment the next three edit, from 1
+    strcpy_P(s, PSTR("Edit segment "));
+    FORMAT_cat_uint8(s, selected_segment + 1);
+    check_up_down(&selected_segment, OUT_SEQUENCE_MAX_SEGMENTS - 1);
+    break;
+
+  case PARAM_SEGMENT_WAVEFORM:
+  case PARAM_SEGMENT_FREQ:
+  case PARAM_SEGMENT_TIME:
+    // Any change starts the sequence again with it. Noise can't be
+    // a segment, so the one after pulse is the end.
+    STORE_get_segment(selected_segment, &segment);
+    if (segment.waveform > OUT_PULSE + 1)
+    {
+      // Erased, so it ends the sequence
+      segment.waveform = OUT_PULSE + 1;
+      segment.freq_mHz = 1000000;
+      segment.duration_ms = 100;
+    }
+    s[0] = '\0';
+    FORMAT_cat_uint8(s, selected_segment + 1);
+    if (selected_param == PARAM_SEGMENT_WAVEFORM)
+    {
+      switch (segment.waveform)
+      {
+      case OUT_SQUARE:   strcat_P(s, PSTR(": square")); break;
+      case OUT_TRIANGLE: strcat_P(s, PSTR(": triangle")); break;
+      case OUT_SINE:     strcat_P(s, PSTR(": sine")); break;
+      case OUT_PULSE:    strcat_P(s, PSTR(": pulse")); break;
+      default:           strcat_P(s, PSTR(": end")); break;
+      }
+      pressed = check_up_down(&segment.waveform, OUT_PULSE + 1);
+    }
+    else if (selected_param == PARAM_SEGMENT_FREQ)
+    {
+      // e.g. "1 F(kHz):10.000", in a 1-2-5 series
+      u8 = strlen(s) + 3;
+      strcat_P(s, PSTR(" F(mHz):"));
+      unit_steps = FORMAT_cat_uint32(s, segment.freq_mHz, 5);
+      switch (unit_steps)
+      {
+      case 0: break;
+      case 1: s[u8] = ' '; break;
+      case 2: s[u8] = 'k'; break;
+      case 3: s[u8] = 'M'; break;
+      default:s[u8] = '?'; break;
+      }
+      pressed = check_up_down_125(&segment.freq_mHz, 1000, 500000000UL);
+    }
+    else
+    {
+      // Duration in a 1-2-5 series
+      strcat_P(s, PSTR(" T:"));
+      FORMAT_cat_uint16(s, segment.duration_ms);
+      strcat_P(s, PSTR("ms"));
+      u32 = segment.duration_ms;
+      pressed = check_up_down_125(&u32, 1, 50000);
+      segment.duration_ms = (uint16_t)u32;
+    }
+    if (pressed)
+    {
+      STORE_set_segment(selected_segment, &segment);
+      OUT_set_sequence(OUT_get_sequence());
+    }
+    break;
+#endif
+
+#if OUT_GATE
+  case PARAM_GATE:
+    u8 = OUT_get_gate();
+    switch (u8)
+    {
+    case OUT_GATE_BURST: strcpy_P(s, PSTR("Gate: burst")); break;
+    case OUT_GATE_INT0:  strcpy_P(s, PSTR("Gate: INT0")); break;
+    default:             strcpy_P(s, PSTR("Gate: none")); break;
+    }
+    if (check_up_down(&u8, OUT_GATE_LAST))
+    {
+      OUT_set_gate(u8);
+    }
+    break;
+
+  case PARAM_BURST_CYCLES:
+    // Cycles per burst in a 1-2-5 series
+    strcpy_P(s, PSTR("Burst:"));
+    u32 = OUT_get_burst_cycles();
+    FORMAT_cat_uint16(s, (uint16_t)u32);
+    if (check_up_down_125(&u32, 1, 50000))
+    {
+      OUT_set_burst_cycles((uint16_t)u32);
+    }
+    break;
+
+  case PARAM_ON:
+    // Up turns the output on, or triggers a burst, down turns it off.
+    // Line 3 shows which it is.
+    strcpy_P(s, PSTR("On:up off:down"));
+    if (up_press)
+    {
+      up_press = 0;
+      OUT_set_on(1);
+    }
+    if (down_press)
+    {
+      down_press = 0;
+      OUT_set_on(0);
+    }
+    break;
+#endif
+
   case PARAM_AMPLITUDE:
     strcpy_P(s, PSTR("Amplitude:"));
     u8 = OUT_get_amplitude_percent();
@@ -611,6 +1156,125 @@ static void show_parameter(void)
     }
     break;
 
+#if OUT_SHAPING
+  case PARAM_SHAPING:
+    u8 = OUT_get_shaping();
+    strcpy_P(s, u8 ? PSTR("Shaping: on") : PSTR("Shaping: off"));
+    if (check_up_down(&u8, 1))
+    {
+      OUT_set_shaping(u8);
+    }
+    break;
+#endif
+
+#if OUT_TWO_TONE
+  case PARAM_TONE2_FREQ:
+    // e.g. "Tone 2:1336Hz", up and down to the next DTMF frequency
+    strcpy_P(s, PSTR("Tone 2:"));
+    u32 = OUT_get_tone2_freq_mHz();
+    FORMAT_cat_uint16(s, (uint16_t)(u32 / 1000));
+    strcat_P(s, PSTR("Hz"));
+    u8 = 0;
+    while ((u8 < sizeof(dtmf_hz)/sizeof(dtmf_hz[0]) - 1) &&
+           (pgm_read_word(&dtmf_hz[u8]) * 1000UL < u32))
+    {
+      u8++;
+    }
+    u16 = pgm_read_word(&dtmf_hz[u8]);
+    if (up_press)
+    {
+      up_press = 0;
+      if ((u16 * 1000UL <= u32) && (u8 < sizeof(dtmf_hz)/sizeof(dtmf_hz[0]) - 1))
+      {
+        u16 = pgm_read_word(&dtmf_hz[u8 + 1]);
+      }
+      OUT_set_tone2_freq_mHz(u16 * 1000UL);
+    }
+    if (down_press)
+    {
+      down_press = 0;
+      if ((u16 * 1000UL >= u32) && (u8 > 0))
+      {
+        u16 = pgm_read_word(&dtmf_hz[u8 - 1]);
+      }
+      OUT_set_tone2_freq_mHz(u16 * 1000UL);
+    }
+    break;
+
+  case PARAM_TONE2_AMPLITUDE:
+    strcpy_P(s, PSTR("Tone 2:"));
+    u8 = OUT_get_tone2_amplitude_percent();
+    FORMAT_cat_uint8(s, u8);
+    strcat_P(s, percent);
+    if (check_up_down(&u8, 100))
+    {
+      OUT_set_tone2_amplitude_percent(u8);
+    }
+    break;
+#endif
+
+  case PARAM_SAMPLING:
+    // Read-only: table length and sample rate e.g. "N128 @117.6kHz"
+    u16 = OUT_get_table_length();
+    if (u16 == 0)
+    {
+      strcpy_P(s, PSTR("No sampling"));
+    }
+    else
+    {
+      strcpy_P(s, PSTR("N"));
+      FORMAT_cat_uint16(s, u16);
+      strcat_P(s, PSTR(" @"));
+      u32 = OUT_get_sample_rate_mHz();
+      unit_steps = FORMAT_cat_uint32(s, u32, 5);
+      switch (unit_steps)
+      {
+      case 1: strcat_P(s, PSTR("Hz")); break;
+      case 2: strcat_P(s, PSTR("kHz")); break;
+      case 3: strcat_P(s, PSTR("MHz")); break;
+      default:strcat_P(s, PSTR("?")); break;
+      }
+    }
+    break;
+
+#if OUT_PWM_DAC
+  case PARAM_PWM_DAC:
+    // Read-only: duty cycles per sample, which the sample rate above is
+    // the PWM carrier for e.g. "PWM:256 levels"
+    strcpy_P(s, PSTR("PWM:"));
+    FORMAT_cat_uint16(s, OUT_PWM_DAC_LEVELS);
+    strcat_P(s, PSTR(" levels"));
+    break;
+#endif
+
+#if OUT_UPLOAD
+  case PARAM_UPLOAD:
+    // Read-only: how the last upload of the arbitrary waveform went,
+    // or how far it's got e.g. "Upload:37%", or "Upload:off DAC" while
+    // the DAC has RXD (PD0) and nothing can be received
+    strcpy_P(s, PSTR("Upload:"));
+    switch (UPLOAD_get_status())
+    {
+    case UPLOAD_OFF:       strcat_P(s, PSTR("off DAC")); break;
+    case UPLOAD_IDLE:      strcat_P(s, PSTR("ready")); break;
+    case UPLOAD_DONE:      strcat_P(s, PSTR("done")); break;
+    case UPLOAD_FAILED:    strcat_P(s, PSTR("failed")); break;
+    default:
+      FORMAT_cat_uint16(s, UPLOAD_get_percent());
+      strcat_P(s, PSTR("%"));
+      break;
+    }
+    break;
+#endif
+
+  case PARAM_ERROR:
+    // Read-only: how far the output is from the value set e.g. "Error:460ppm"
+    strcpy_P(s, PSTR("Error:"));
+    u16 = OUT_get_error_ppm();
+    FORMAT_cat_uint16(s, u16);
+    strcat_P(s, PSTR("ppm"));
+    break;
+
   case PARAM_CONTRAST:
     strcpy_P(s, PSTR("Contrast:"));
     u8 = STORE_get_contrast();
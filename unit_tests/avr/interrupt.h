@@ -0,0 +1,13 @@
+/* Host stand-in for avr-libc's <avr/interrupt.h>, for the tests'
+   register models */
+#ifndef __INTERRUPT_H_
+#define __INTERRUPT_H_
+
+void sim_cli(void);
+void sim_sei(void);
+
+#define cli() sim_cli()
+#define sei() sim_sei()
+#define ISR(vector, ...) void vector(void)
+
+#endif
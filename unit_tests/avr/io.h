@@ -0,0 +1,84 @@
+/* Host stand-in for avr-libc's <avr/io.h>, with just the Timer1 and
+   USART registers and DDRD. Every access goes to the test's sim_read
+   and sim_write, which in retune_trace.cpp run the timer model for a
+   few clock cycles, so it needs C++. */
+#ifndef __IO_H_
+#define __IO_H_
+
+#include <stdint.h>
+
+enum
+{
+  SIM_TCCR1B,
+  SIM_TCNT1,
+  SIM_ICR1,
+  SIM_OCR1A,
+  SIM_OCR1B,
+  SIM_TIFR,
+  SIM_TIMSK,
+  SIM_SFIOR,
+  SIM_UCSRA,
+  SIM_UCSRB,
+  SIM_UCSRC,
+  SIM_UBRRH,
+  SIM_UBRRL,
+  SIM_UDR,
+  SIM_DDRD
+};
+
+uint16_t sim_read(uint8_t reg);
+void sim_write(uint8_t reg, uint16_t value);
+
+template <typename T, uint8_t R> struct sim_reg
+{
+  operator T() const { return (T)sim_read(R); }
+  sim_reg& operator=(T value) { sim_write(R, value); return *this; }
+  sim_reg& operator|=(T value) { sim_write(R, (T)(sim_read(R) | value)); return *this; }
+  sim_reg& operator&=(T value) { sim_write(R, (T)(sim_read(R) & value)); return *this; }
+};
+
+#define TCCR1B (sim_reg<uint8_t, SIM_TCCR1B>{})
+#define TCNT1  (sim_reg<uint16_t, SIM_TCNT1>{})
+#define ICR1   (sim_reg<uint16_t, SIM_ICR1>{})
+#define OCR1A  (sim_reg<uint16_t, SIM_OCR1A>{})
+#define OCR1B  (sim_reg<uint16_t, SIM_OCR1B>{})
+#define TIFR   (sim_reg<uint8_t, SIM_TIFR>{})
+#define TIMSK  (sim_reg<uint8_t, SIM_TIMSK>{})
+#define SFIOR  (sim_reg<uint8_t, SIM_SFIOR>{})
+#define UCSRA  (sim_reg<uint8_t, SIM_UCSRA>{})
+#define UCSRB  (sim_reg<uint8_t, SIM_UCSRB>{})
+#define UCSRC  (sim_reg<uint8_t, SIM_UCSRC>{})
+#define UBRRH  (sim_reg<uint8_t, SIM_UBRRH>{})
+#define UBRRL  (sim_reg<uint8_t, SIM_UBRRL>{})
+#define UDR    (sim_reg<uint8_t, SIM_UDR>{})
+#define DDRD   (sim_reg<uint8_t, SIM_DDRD>{})
+
+#define CS12 2
+#define CS11 1
+#define CS10 0
+
+#define TICIE1 5
+#define OCIE1A 4
+#define OCIE1B 3
+#define TOIE1 2
+
+#define ICF1 5
+#define OCF1A 4
+#define OCF1B 3
+#define TOV1 2
+
+#define PSR10 0
+
+#define FE 4
+#define DOR 3
+
+#define RXCIE 7
+#define RXEN 4
+
+#define URSEL 7
+#define UCSZ1 2
+#define UCSZ0 1
+
+#define PD0 0
+
+#endif
@@ -0,0 +1,11 @@
+/* Host stand-in for avr-libc's <avr/pgmspace.h>,
+   so that the tests can compile firmware sources unchanged */
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+
+#endif
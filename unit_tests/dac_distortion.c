@@ -0,0 +1,187 @@
+/* Compares the distortion of a sine wave out of the R-2R DAC at each
+   OUT_DAC_BITS width, 5, 6 and 8, over a range of amplitudes, and with
+   OUT_SHAPING on for 5 and 6.
+
+   The table is built as recompute_waveform in out.c builds it, from the
+   half-wave tables gen_waves.pl makes, and the DAC is taken as ideal,
+   so what's left is rounding to DAC steps. The samples go through the
+   sample ISR's shaping for CYCLES cycles of the table, after which the
+   part of a step it carries over repeats, so all of the rounding lands
+   on multiples of 1/CYCLES of the fundamental. THD+N is the power in
+   them against the fundamental's: all the way to half the sample rate,
+   and up to the 10th harmonic, which is about what's left after an RC
+   filter where shaping puts its noise well above the fundamental.
+
+   usage: dac_distortion [table_length_bits]
+   table_length_bits is from 4 to 8, default 7 */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define MAX_TABLE_LENGTH 256
+
+/* A power of 2, at least 2^(8 - 5), for the part of a step shaping
+   carries over to go round */
+#define CYCLES 8
+
+static const uint8_t widths[] = {5, 6, 8};
+static const uint8_t amplitudes[] = {100, 50, 20, 10, 5};
+
+/* As recompute_waveform, for OUT_SINE. With shaping the table has
+   8 - dac_bits bits below a DAC step. */
+static void build_table(uint8_t* table, uint8_t length_bits, uint8_t dac_bits, uint8_t amplitude, uint8_t shaping)
+{
+  uint16_t half;
+  uint16_t i;
+  uint8_t centre;
+  uint16_t scale;
+  uint8_t value;
+  uint8_t shaping_bits;
+
+  half = (1 << length_bits) / 2;
+  centre = 1 << (dac_bits - 1);
+  scale = (uint16_t)(((centre - 1) * 32768UL * amplitude + 127UL*100/2) / (127UL*100));
+  shaping_bits = shaping ? 8 - dac_bits : 0;
+
+  for (i = 0; i < half; i++)
+  {
+    if ((amplitude == 100) && !shaping)
+    {
+      /* gen_waves.pl's table in DAC steps */
+      value = (uint8_t)(int)((centre - 1) * sin(2 * M_PI * (i + 0.5) / (1 << length_bits)) + 0.5);
+      table[i] = centre + value;
+      table[half + i] = centre - value;
+      continue;
+    }
+
+    /* As gen_waves.pl, never negative in the first half of a sine */
+    value = (uint8_t)(int)(127 * sin(2 * M_PI * (i + 0.5) / (1 << length_bits)) + 0.5);
+
+    value = (uint8_t)(((uint32_t)value * scale + (16384 >> shaping_bits)) >> (15 - shaping_bits));
+    table[i] = (centre << shaping_bits) + value;
+    table[half + i] = (centre << shaping_bits) - value;
+  }
+}
+
+/* As the sample ISR: CYCLES cycles of DAC steps from the table, after
+   running through it once for the part of a step carried over to settle */
+static void run_isr(uint8_t* out, const uint8_t* table, uint16_t length, uint8_t shaping_bits)
+{
+  uint16_t n;
+  uint8_t value;
+  uint8_t error = 0;
+
+  for (n = 0; n < length * (CYCLES + 1); n++)
+  {
+    value = table[n % length] + error;
+    error = value & ((1 << shaping_bits) - 1);
+    if (n >= length)
+    {
+      out[n - length] = value >> shaping_bits;
+    }
+  }
+}
+
+/* THD+N as a ratio, from a DFT of the CYCLES cycles of samples, in
+   all and up to the 10th harmonic */
+static void thd_n(const uint8_t* samples, uint16_t length, double* all, double* to_10th)
+{
+  uint16_t k;
+  uint16_t n;
+  uint16_t total;
+  double re;
+  double im;
+  double fundamental = 0;
+  double rest = 0;
+  double rest_10th = 0;
+
+  total = length * CYCLES;
+  for (k = 1; k <= total / 2; k++)
+  {
+    re = 0;
+    im = 0;
+    for (n = 0; n < total; n++)
+    {
+      re += samples[n] * cos(2 * M_PI * k * n / total);
+      im -= samples[n] * sin(2 * M_PI * k * n / total);
+    }
+    if (k == CYCLES)
+    {
+      fundamental = re*re + im*im;
+    }
+    else
+    {
+      rest += re*re + im*im;
+      if (k <= 10 * CYCLES)
+      {
+        rest_10th += re*re + im*im;
+      }
+    }
+  }
+  *all = sqrt(rest / fundamental);
+  *to_10th = sqrt(rest_10th / fundamental);
+}
+
+static uint16_t count_levels(const uint8_t* table, uint16_t length)
+{
+  uint8_t used[256] = {0};
+  uint16_t levels = 0;
+  uint16_t n;
+
+  for (n = 0; n < length; n++)
+  {
+    if (!used[table[n]])
+    {
+      used[table[n]] = 1;
+      levels++;
+    }
+  }
+  return levels;
+}
+
+int main(int argc, char* argv[])
+{
+  uint8_t table[MAX_TABLE_LENGTH];
+  uint8_t samples[MAX_TABLE_LENGTH * CYCLES];
+  uint8_t length_bits = 7;
+  uint16_t length;
+  uint8_t w;
+  uint8_t a;
+  uint8_t shaping;
+  double thd;
+  double thd_10th;
+  double sinad_db;
+
+  if (argc > 1)
+  {
+    length_bits = (uint8_t)atoi(argv[1]);
+  }
+  if ((length_bits < 4) || (length_bits > 8))
+  {
+    fprintf(stderr, "usage: dac_distortion [table_length_bits, 4 to 8]\n");
+    return 1;
+  }
+  length = 1 << length_bits;
+
+  printf("Sine, %u samples per cycle\n", length);
+  printf("bits  shaping  amplitude  levels  THD+N (%%)  THD+N (dB)  ENOB  to 10th (%%)\n");
+  for (w = 0; w < sizeof(widths); w++)
+  {
+    for (shaping = 0; shaping <= (widths[w] < 8); shaping++)
+    {
+      for (a = 0; a < sizeof(amplitudes); a++)
+      {
+        build_table(table, length_bits, widths[w], amplitudes[a], shaping);
+        run_isr(samples, table, length, shaping ? 8 - widths[w] : 0);
+        thd_n(samples, length, &thd, &thd_10th);
+        sinad_db = -20 * log10(thd);
+        printf("%4u  %7s  %8u%%  %6u  %10.3f  %10.1f  %4.1f  %11.3f\n",
+               widths[w], shaping ? "on" : "off", amplitudes[a],
+               count_levels(samples, length * CYCLES),
+               100 * thd, -sinad_db, (sinad_db - 1.76) / 6.02, 100 * thd_10th);
+      }
+    }
+  }
+  return 0;
+}
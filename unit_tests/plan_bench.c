@@ -0,0 +1,120 @@
+/* Cycle counts of PLAN_timer against the same planner using division,
+   of PLAN_search across the table lengths, and of PLAN_compare, which
+   is all a new duty cycle needs, against planning the timer again.
+   This runs on the ATmega8 in simulavr, see 'make bench_plan', or on
+   the host with its time stamp counter, see 'make bench_plan_host'. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "out.h"
+#include "plan.h"
+#include "plan_ref.h"
+
+#ifdef __AVR__
+
+/* simulavr copies whatever is written here to its stdout */
+#define SIM_OUT (*(volatile uint8_t*)0x20)
+
+static int sim_putchar(char c, FILE* stream)
+{
+  SIM_OUT = c;
+  return 0;
+}
+
+static FILE sim_stdout = FDEV_SETUP_STREAM(sim_putchar, NULL, _FDEV_SETUP_WRITE);
+
+/* Timer1 counts CPU cycles */
+#define CYCLES(call) (TCNT1 = 0, (call), TCNT1)
+
+#else
+
+/* The host's time stamp counter, averaged over many calls */
+#define REPEAT 10000
+#define CYCLES(call) \
+  ({ uint64_t start_ = __rdtsc(); uint16_t n_; \
+     for (n_ = 0; n_ < REPEAT; n_++) { call; } \
+     (uint16_t)((__rdtsc() - start_) / REPEAT); })
+
+#endif
+
+static const uint32_t values[] =
+{
+  250, 1000, 12345, 1000000, 16000000, 99999999, 1234567890, 4000000000UL
+};
+
+/* Triangle and sine wave periods in ns and frequencies in mHz */
+static const uint32_t search_values[][2] =
+{
+  { 4000000000UL, 250 }, { 1000000, 1000000 }, { 810372, 1234000 }, { 150000, 6900000 }
+};
+
+int main(void)
+{
+  PLAN_timer_t timer;
+  PLAN_search_t plan;
+  uint8_t i;
+  uint8_t freq_mode;
+  uint16_t ref_cycles;
+  uint16_t new_cycles;
+  uint32_t ref_total = 0;
+  uint32_t new_total = 0;
+
+#ifdef __AVR__
+  stdout = &sim_stdout;
+
+  /* Timer1 counts CPU cycles */
+  TCCR1A = 0;
+  TCCR1B = (1<<CS10);
+#endif
+
+  new_cycles = CYCLES(PLAN_set_f_cpu(F_CPU - 2048));
+  printf("PLAN_set_f_cpu: %u cycles\n", new_cycles);
+
+  for (freq_mode = OUT_PERIOD_MODE; freq_mode <= OUT_FREQ_MODE; freq_mode++)
+  {
+    for (i = 0; i < sizeof(values)/sizeof(values[0]); i++)
+    {
+      ref_cycles = CYCLES(plan_ref(&timer, F_CPU - 2048, freq_mode, values[i], 50));
+      new_cycles = CYCLES(PLAN_timer(&timer, freq_mode, values[i], 500));
+
+      printf("%s %10lu: %5u -> %5u cycles\n",
+             (freq_mode == OUT_PERIOD_MODE) ? "period ns" : "freq mHz ",
+             (unsigned long)values[i], ref_cycles, new_cycles);
+      ref_total += ref_cycles;
+      new_total += new_cycles;
+    }
+  }
+  printf("total: %lu -> %lu cycles\n", (unsigned long)ref_total, (unsigned long)new_total);
+
+  for (freq_mode = OUT_PERIOD_MODE; freq_mode <= OUT_FREQ_MODE; freq_mode++)
+  {
+    for (i = 0; i < sizeof(search_values)/sizeof(search_values[0]); i++)
+    {
+      new_cycles = CYCLES(PLAN_search(&plan, freq_mode, search_values[i][freq_mode == OUT_FREQ_MODE], 500,
+                                      OUT_MIN_WAVEFORM_LENGTH_BITS, OUT_MAX_WAVEFORM_LENGTH_BITS));
+
+      printf("search %s %10lu: %5u cycles, N%u\n",
+             (freq_mode == OUT_PERIOD_MODE) ? "period ns" : "freq mHz ",
+             (unsigned long)search_values[i][freq_mode == OUT_FREQ_MODE], new_cycles,
+             1U << plan.table_length_bits);
+    }
+  }
+
+  /* A new duty cycle used to take a whole plan */
+  for (i = 0; i < sizeof(values)/sizeof(values[0]); i++)
+  {
+    PLAN_timer(&timer, OUT_FREQ_MODE, values[i], 500);
+    ref_cycles = CYCLES(PLAN_timer(&timer, OUT_FREQ_MODE, values[i], 333));
+    new_cycles = CYCLES(timer.compare = PLAN_compare(timer.top, 333));
+
+    printf("duty   freq mHz  %10lu: %5u -> %5u cycles\n", (unsigned long)values[i], ref_cycles, new_cycles);
+  }
+
+  exit(0);
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+
+#include "out.h"
+#include "plan.h"
+#include "plan_ref.h"
+
+/* 1000 * f_cpu / d, rounded, in 32 bits */
+static uint32_t div_f_cpu_ref(uint32_t f_cpu, uint32_t d)
+{
+  uint32_t q;
+  uint32_t rem;
+  uint8_t i;
+
+  q = (F_CPU_MUL * f_cpu) / d;
+  rem = (F_CPU_MUL * f_cpu) % d;
+  for (i = F_OUT_DIV; i > 1; i >>= 1)
+  {
+    q = q * 2 + (rem >= d - rem);
+    rem = (rem >= d - rem) ? rem - (d - rem) : rem * 2;
+  }
+  return q + (rem >= d - rem);
+}
+
+void plan_ref(PLAN_timer_t* timer, uint32_t f_cpu, uint8_t freq_mode, uint32_t value, uint8_t duty_cycle)
+{
+  uint32_t period_clocks;
+  uint8_t prescaler_bits;
+  uint16_t prescaler;
+  uint16_t oc;
+  uint32_t f_period_ns;
+
+  f_period_ns = (1000UL*1000UL*1000UL + f_cpu/2) / f_cpu;
+
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    period_clocks = (value + f_period_ns/2) / f_period_ns;
+  }
+  else
+  {
+    period_clocks = div_f_cpu_ref(f_cpu, value);
+  }
+
+  if (period_clocks < 65536)
+  {
+    prescaler = 1;
+    prescaler_bits = 1;
+  }
+  else if ((period_clocks + 4) <= 65536*8)
+  {
+    prescaler = 8;
+    prescaler_bits = 2;
+    period_clocks = (period_clocks + 4) / 8;
+  }
+  else if ((period_clocks + 32) <= 65536*64)
+  {
+    prescaler = 64;
+    prescaler_bits = 3;
+    period_clocks = (period_clocks + 32) / 64;
+  }
+  else if ((period_clocks + 128) <= 65536*256)
+  {
+    prescaler = 256;
+    prescaler_bits = 4;
+    period_clocks = (period_clocks + 128) / 256;
+  }
+  else
+  {
+    prescaler = 1024;
+    prescaler_bits = 5;
+    period_clocks = (period_clocks + 512) / 1024;
+    if (period_clocks > 65536)
+    {
+      period_clocks = 65536;
+    }
+  }
+
+  oc = (uint16_t)((period_clocks * duty_cycle + 50) / 100);
+  if (oc > 0)
+  {
+    oc--;
+  }
+
+  timer->clock_select = prescaler_bits;
+  timer->top = (uint16_t)period_clocks - 1;
+  timer->compare = oc;
+  timer->period_ns = period_clocks * prescaler * f_period_ns;
+  timer->freq_mHz = div_f_cpu_ref(f_cpu, period_clocks * prescaler);
+}
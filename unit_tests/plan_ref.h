@@ -0,0 +1,8 @@
+#ifndef __PLAN_REF_H_
+#define __PLAN_REF_H_
+
+/* The frequency planner written with plain division,
+   to check PLAN_timer against */
+void plan_ref(PLAN_timer_t* timer, uint32_t f_cpu, uint8_t freq_mode, uint32_t value, uint8_t duty_cycle);
+
+#endif
@@ -0,0 +1,385 @@
+/* Checks the Timer1 frequency planner (plan.c) against an exact model
+   for every timer frequency in mHz and every timer period in ns
+   from 250 to 4*10^9, and writes the error against frequency
+   to stdout as CSV.
+
+   Every waveform comes down to one of these inputs: square waves
+   use the frequency or period as it is, triangle and sine waves
+   scale it by the table length first.
+
+   Every input is tried at the nominal F_CPU and at both ends of the
+   calibration range, and a geometric sweep of the inputs is tried at
+   every calibration. The inputs are shared out between all CPU cores.
+
+   usage: plan_sweep [step]
+   step is the spacing of the inputs in the full sweeps, default 1 */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "out.h"
+#include "plan.h"
+
+#define MIN_VALUE 250UL
+#define MAX_VALUE 4000000000UL
+
+#define F_CPU_CAL_MIN (F_CPU - 2048L*128 - 32L*128)
+#define F_CPU_CAL_MAX (F_CPU + 2048L*127 + 32L*127)
+
+/* Each CSV row covers a tenth of a decade of input values */
+#define BINS_PER_DECADE 10
+#define NUM_BINS 73
+
+/* Inputs handed to a thread at a time in the full sweeps */
+#define CHUNK_VALUES (1UL << 22)
+
+/* Failures to print in full */
+#define MAX_REPORTS 20
+
+typedef struct
+{
+  uint64_t inputs;
+  uint64_t failures;
+  double max_error_ppm;
+  double sum_error_ppm;
+  double max_report_error_ppm;
+  uint32_t worst_value;
+  uint32_t worst_f_cpu;
+} bin_t;
+
+typedef struct
+{
+  uint8_t freq_mode;
+  uint32_t f_cpu;
+  uint32_t f_period_ns;
+  uint32_t step;        /* 0 for the geometric sweep */
+  uint32_t num_chunks;
+  uint32_t next_chunk;
+} sweep_t;
+
+static double bin_start[NUM_BINS + 1];
+static bin_t bins[2][NUM_BINS];
+static uint64_t reports;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void init_bins(void);
+static uint8_t find_bin(uint32_t value);
+static void run_sweep(sweep_t* sweep, long num_threads);
+static void* sweep_thread(void* arg);
+static void check(bin_t* bin, const sweep_t* sweep, uint32_t value);
+static void print_csv(void);
+
+int main(int argc, char* argv[])
+{
+  static const int32_t dense_f_cpus[] = { F_CPU_CAL_MIN, F_CPU, F_CPU_CAL_MAX };
+  sweep_t sweep;
+  uint32_t step;
+  long num_threads;
+  uint64_t failures;
+  uint8_t freq_mode;
+  uint8_t i;
+  int32_t f_cpu;
+
+  step = 1;
+  if (argc > 1)
+  {
+    step = (uint32_t)strtoul(argv[1], NULL, 0);
+    if (step == 0)
+    {
+      step = 1;
+    }
+  }
+
+  num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+  fprintf(stderr, "Sweeping with step %u on %ld threads\n", step, num_threads);
+
+  init_bins();
+
+  for (freq_mode = OUT_PERIOD_MODE; freq_mode <= OUT_FREQ_MODE; freq_mode++)
+  {
+    sweep.freq_mode = freq_mode;
+
+    for (i = 0; i < sizeof(dense_f_cpus)/sizeof(dense_f_cpus[0]); i++)
+    {
+      fprintf(stderr, "%s, f_cpu %d, every input\n",
+              (freq_mode == OUT_FREQ_MODE) ? "frequency" : "period", dense_f_cpus[i]);
+      sweep.f_cpu = (uint32_t)dense_f_cpus[i];
+      sweep.step = step;
+      sweep.num_chunks = (MAX_VALUE - MIN_VALUE) / CHUNK_VALUES + 1;
+      run_sweep(&sweep, num_threads);
+    }
+
+    fprintf(stderr, "%s, every f_cpu, geometric inputs\n",
+            (freq_mode == OUT_FREQ_MODE) ? "frequency" : "period");
+    for (f_cpu = F_CPU_CAL_MIN; f_cpu <= F_CPU_CAL_MAX; f_cpu += 32)
+    {
+      sweep.f_cpu = (uint32_t)f_cpu;
+      sweep.step = 0;
+      sweep.num_chunks = NUM_BINS;
+      run_sweep(&sweep, num_threads);
+    }
+  }
+
+  print_csv();
+
+  failures = 0;
+  for (freq_mode = 0; freq_mode < 2; freq_mode++)
+  {
+    for (i = 0; i < NUM_BINS; i++)
+    {
+      failures += bins[freq_mode][i].failures;
+    }
+  }
+  if (failures)
+  {
+    fprintf(stderr, "FAIL: %llu inputs outside the error bound\n", (unsigned long long)failures);
+    return 1;
+  }
+  fprintf(stderr, "All inputs within the error bound\n");
+  return 0;
+}
+
+static void init_bins(void)
+{
+  uint8_t i;
+
+  for (i = 0; i <= NUM_BINS; i++)
+  {
+    bin_start[i] = MIN_VALUE * pow(10.0, (double)i / BINS_PER_DECADE);
+  }
+}
+
+static uint8_t find_bin(uint32_t value)
+{
+  uint8_t i;
+
+  i = 0;
+  while ((i < NUM_BINS - 1) && (value >= bin_start[i + 1]))
+  {
+    i++;
+  }
+  return i;
+}
+
+static void run_sweep(sweep_t* sweep, long num_threads)
+{
+  pthread_t threads[num_threads];
+  long i;
+
+  /* The planner keeps the calibration in static variables,
+     so set it before the threads start and leave it alone */
+  PLAN_set_f_cpu(sweep->f_cpu);
+  sweep->f_period_ns = (1000000000UL + sweep->f_cpu/2) / sweep->f_cpu;
+  sweep->next_chunk = 0;
+
+  for (i = 0; i < num_threads; i++)
+  {
+    pthread_create(&threads[i], NULL, sweep_thread, sweep);
+  }
+  for (i = 0; i < num_threads; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+static void* sweep_thread(void* arg)
+{
+  sweep_t* sweep = (sweep_t*)arg;
+  bin_t local[NUM_BINS] = { { 0 } };
+  uint32_t chunk;
+  uint64_t value;
+  uint64_t last;
+  uint8_t bin;
+  uint8_t i;
+  bin_t* total;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&lock);
+    chunk = sweep->next_chunk++;
+    pthread_mutex_unlock(&lock);
+    if (chunk >= sweep->num_chunks)
+    {
+      break;
+    }
+
+    if (sweep->step)
+    {
+      value = MIN_VALUE + (uint64_t)chunk * CHUNK_VALUES;
+      last = value + CHUNK_VALUES - 1;
+      value += (sweep->step - (value - MIN_VALUE) % sweep->step) % sweep->step;
+    }
+    else
+    {
+      value = (uint64_t)ceil(bin_start[chunk]);
+      last = (uint64_t)ceil(bin_start[chunk + 1]) - 1;
+    }
+    if (last > MAX_VALUE)
+    {
+      last = MAX_VALUE;
+    }
+
+    bin = find_bin((uint32_t)value);
+    while (value <= last)
+    {
+      while ((bin < NUM_BINS - 1) && (value >= bin_start[bin + 1]))
+      {
+        bin++;
+      }
+      check(&local[bin], sweep, (uint32_t)value);
+      if (sweep->step)
+      {
+        value += sweep->step;
+      }
+      else
+      {
+        value += value / 1024 + 1;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < NUM_BINS; i++)
+  {
+    total = &bins[sweep->freq_mode][i];
+    total->inputs += local[i].inputs;
+    total->failures += local[i].failures;
+    total->sum_error_ppm += local[i].sum_error_ppm;
+    if (local[i].max_report_error_ppm > total->max_report_error_ppm)
+    {
+      total->max_report_error_ppm = local[i].max_report_error_ppm;
+    }
+    if (local[i].max_error_ppm > total->max_error_ppm)
+    {
+      total->max_error_ppm = local[i].max_error_ppm;
+      total->worst_value = local[i].worst_value;
+      total->worst_f_cpu = local[i].worst_f_cpu;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+/* Checks one input against the model:
+   - the prescaler is a valid setting and ICR1 holds the whole period
+   - the period in clock cycles is the ideal one, give or take half a
+     prescaled clock, half a clock, and for periods in ns the rounding
+     of the clock period to whole ns
+   - the reported frequency is the one the registers give, within 0.5 mHz
+   - the reported period is the one the registers give, give or take
+     the rounding of the clock period to whole ns */
+static void check(bin_t* bin, const sweep_t* sweep, uint32_t value)
+{
+  static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  PLAN_timer_t timer;
+  double f_cpu;
+  double ns_rounding;
+  double ideal_clocks;
+  double clocks;
+  double allowed_clocks;
+  double actual;
+  double true_period_ns;
+  double true_freq_mHz;
+  double error_ppm;
+  double report_error_ppm;
+  uint16_t prescaler;
+  uint8_t ok;
+
+  PLAN_timer(&timer, sweep->freq_mode, value, 500);
+
+  f_cpu = sweep->f_cpu;
+  ns_rounding = fabs(sweep->f_period_ns * f_cpu / 1e9 - 1.0);
+  prescaler = prescalers[timer.clock_select & 7];
+  clocks = (double)prescaler * ((uint32_t)timer.top + 1);
+  true_period_ns = clocks * 1e9 / f_cpu;
+  true_freq_mHz = f_cpu * 1e3 / clocks;
+
+  if (sweep->freq_mode == OUT_FREQ_MODE)
+  {
+    ideal_clocks = f_cpu * 1e3 / value;
+    allowed_clocks = prescaler / 2.0 + 0.5;
+    actual = true_freq_mHz;
+  }
+  else
+  {
+    ideal_clocks = value * f_cpu / 1e9;
+    allowed_clocks = prescaler / 2.0 + 0.5 + ideal_clocks * fabs(1e9 / (sweep->f_period_ns * f_cpu) - 1.0) * 1.000001;
+    actual = true_period_ns;
+  }
+  allowed_clocks += ideal_clocks * 1e-12;
+
+  error_ppm = fabs(actual - value) / value * 1e6;
+  report_error_ppm = fabs(timer.freq_mHz - true_freq_mHz) / true_freq_mHz * 1e6;
+
+  ok = (prescaler != 0) &&
+       (timer.top > 0) &&
+       (timer.compare <= timer.top) &&
+       (fabs(clocks - ideal_clocks) <= allowed_clocks) &&
+       (fabs(timer.freq_mHz - true_freq_mHz) <= 0.5 + true_freq_mHz * 1e-12) &&
+       (fabs(timer.period_ns - true_period_ns) <= true_period_ns * ns_rounding * 1.000001 + 1e-6);
+
+  bin->inputs++;
+  bin->sum_error_ppm += error_ppm;
+  if (error_ppm > bin->max_error_ppm)
+  {
+    bin->max_error_ppm = error_ppm;
+    bin->worst_value = value;
+    bin->worst_f_cpu = sweep->f_cpu;
+  }
+  if (report_error_ppm > bin->max_report_error_ppm)
+  {
+    bin->max_report_error_ppm = report_error_ppm;
+  }
+
+  if (!ok)
+  {
+    bin->failures++;
+    pthread_mutex_lock(&lock);
+    if (reports++ < MAX_REPORTS)
+    {
+      fprintf(stderr, "FAIL: f_cpu=%u, %s=%u: prescaler=%u, ICR1=%u, OCR1A=%u, "
+              "reported %u ns/%u mHz, registers give %.1f ns/%.1f mHz, ideal %.1f clocks\n",
+              sweep->f_cpu, (sweep->freq_mode == OUT_FREQ_MODE) ? "freq_mHz" : "period_ns", value,
+              prescaler, timer.top, timer.compare,
+              timer.period_ns, timer.freq_mHz, true_period_ns, true_freq_mHz, ideal_clocks);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+static void print_csv(void)
+{
+  uint8_t freq_mode;
+  uint8_t i;
+  const bin_t* bin;
+
+  printf("mode,from,to,inputs,max_error_ppm,mean_error_ppm,max_report_error_ppm,worst_input,worst_f_cpu,failures\n");
+  for (freq_mode = OUT_PERIOD_MODE; freq_mode <= OUT_FREQ_MODE; freq_mode++)
+  {
+    for (i = 0; i < NUM_BINS; i++)
+    {
+      bin = &bins[freq_mode][i];
+      if (bin->inputs == 0)
+      {
+        continue;
+      }
+      printf("%s,%.0f,%.0f,%llu,%.3f,%.3f,%.3f,%u,%u,%llu\n",
+             (freq_mode == OUT_FREQ_MODE) ? "freq_mHz" : "period_ns",
+             ceil(bin_start[i]), fmin(ceil(bin_start[i + 1]) - 1, MAX_VALUE),
+             (unsigned long long)bin->inputs,
+             bin->max_error_ppm,
+             bin->sum_error_ppm / bin->inputs,
+             bin->max_report_error_ppm,
+             bin->worst_value, bin->worst_f_cpu,
+             (unsigned long long)bin->failures);
+    }
+  }
+}
@@ -0,0 +1,636 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "out.h"
+#include "plan.h"
+#include "plan_ref.h"
+
+int test_div(uint32_t n, uint32_t d);
+int test_timer(int8_t medium_cal, int8_t fine_cal, uint8_t freq_mode, uint32_t value, uint8_t duty_cycle);
+int test_search(int8_t medium_cal, uint8_t freq_mode, uint32_t value);
+int test_ppm(uint32_t error, uint32_t value);
+int test_dither(int8_t medium_cal, uint8_t freq_mode, uint32_t value);
+int test_compare(uint16_t top, uint16_t duty_cycle);
+int test_postscale(int8_t medium_cal, uint32_t value, uint16_t duty_cycle);
+int test_pulse(int8_t medium_cal, uint8_t freq_mode, uint32_t value, uint32_t width_ns);
+int test_channel_b(int8_t medium_cal, uint8_t freq_mode, uint32_t value, uint16_t phase, uint16_t duty_cycle);
+int test_sweep(uint32_t start, uint32_t stop, uint8_t last_step, uint8_t log);
+
+int main(void)
+{
+  int fail = 0;
+  uint32_t d;
+  uint32_t i;
+  uint32_t value;
+  int medium_cal;
+  int fine_cal;
+  uint8_t duty_cycle;
+  uint16_t duty_permille;
+  uint8_t freq_mode;
+  static const int8_t fine_cals[] = { -128, -1, 0, 1, 127 };
+
+  /* PLAN_div against division: every divisor up to 2^20,
+     then random ones */
+  for (d = 1; !fail && (d <= (1UL << 20)); d++)
+  {
+    if (!fail) fail = test_div(0xFFFFFFFFUL, d);
+    if (!fail) fail = test_div(d - 1, d);
+    if (!fail) fail = test_div(0xFFFFFFFFUL / d * d, d);
+    if (!fail) fail = test_div(0xFFFFFFFFUL / d * d - 1, d);
+  }
+  srand(1);
+  for (i = 0; !fail && (i < 10000000UL); i++)
+  {
+    d = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    d >>= rand() & 31;
+    if (d == 0)
+    {
+      d = 1;
+    }
+    fail = test_div(((uint32_t)rand() << 16) ^ (uint32_t)rand(), d);
+  }
+
+  /* PLAN_timer against the planner using division, across the
+     calibration range and the whole range of timer periods
+     and frequencies, including either side of each step */
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 15)
+  {
+    for (i = 0; !fail && (i < sizeof(fine_cals)); i++)
+    {
+      fine_cal = fine_cals[i];
+      duty_cycle = 0;
+      for (freq_mode = OUT_PERIOD_MODE; !fail && (freq_mode <= OUT_FREQ_MODE); freq_mode++)
+      {
+        for (value = 250; !fail && (value < 4000000000UL); value += value/512 + 1)
+        {
+          if (!fail) fail = test_timer(medium_cal, fine_cal, freq_mode, value, duty_cycle);
+          if (!fail) fail = test_timer(medium_cal, fine_cal, freq_mode, value + 1, duty_cycle);
+          duty_cycle = (duty_cycle + 7) % 101;
+        }
+        if (!fail) fail = test_timer(medium_cal, fine_cal, freq_mode, 4000000000UL, 100);
+      }
+    }
+  }
+
+  /* PLAN_search against trying every prescaler and table length */
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 85)
+  {
+    for (freq_mode = OUT_PERIOD_MODE; !fail && (freq_mode <= OUT_FREQ_MODE); freq_mode++)
+    {
+      for (value = 250; !fail && (value < 4000000000UL); value += value/4096 + 1)
+      {
+        if ((freq_mode == OUT_PERIOD_MODE) ?
+            (value >= OUT_MIN_NON_SQUARE_PERIOD_NS) :
+            (value <= OUT_MAX_NON_SQUARE_FREQUENCY_mHz))
+        {
+          fail = test_search(medium_cal, freq_mode, value);
+        }
+      }
+    }
+  }
+
+  /* PLAN_dither against the period worked out in 64 bits */
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 85)
+  {
+    for (freq_mode = OUT_PERIOD_MODE; !fail && (freq_mode <= OUT_FREQ_MODE); freq_mode++)
+    {
+      for (value = 250; !fail && (value < 4000000000UL); value += value/8192 + 1)
+      {
+        fail = test_dither(medium_cal, freq_mode, value);
+      }
+    }
+  }
+
+  /* PLAN_compare against division, for every TOP and duty cycle */
+  for (value = 0; !fail && (value <= 0xFFFF); value++)
+  {
+    for (duty_permille = 0; !fail && (duty_permille <= 1000); duty_permille++)
+    {
+      fail = test_compare((uint16_t)value, duty_permille);
+    }
+  }
+
+  /* PLAN_pulse against 64-bit arithmetic, with widths from well below
+     a clock to longer than the period */
+  srand(5);
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 85)
+  {
+    for (freq_mode = OUT_PERIOD_MODE; !fail && (freq_mode <= OUT_FREQ_MODE); freq_mode++)
+    {
+      for (value = 250; !fail && (value < 4000000000UL); value += value/1024 + 1)
+      {
+        i = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        fail = test_pulse(medium_cal, freq_mode, value, (i >> (rand() % 32)) % 4000000001UL);
+      }
+    }
+  }
+
+  /* PLAN_postscale against 64-bit arithmetic, from 1 mHz to beyond
+     where the prescaler takes over, at the ends of the duty cycle
+     range and in between */
+  srand(3);
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 85)
+  {
+    for (value = 1; !fail && (value <= 1000); value++)
+    {
+      if (!fail) fail = test_postscale(medium_cal, value, 0);
+      if (!fail) fail = test_postscale(medium_cal, value, 1);
+      if (!fail) fail = test_postscale(medium_cal, value, 500);
+      if (!fail) fail = test_postscale(medium_cal, value, 999);
+      if (!fail) fail = test_postscale(medium_cal, value, 1000);
+      if (!fail) fail = test_postscale(medium_cal, value, rand() % 1001);
+    }
+  }
+
+  /* Channel B in each mode against channel B off, and the toggling
+     period and phase against 64-bit arithmetic */
+  srand(4);
+  for (medium_cal = -128; !fail && (medium_cal <= 127); medium_cal += 85)
+  {
+    for (freq_mode = OUT_PERIOD_MODE; !fail && (freq_mode <= OUT_FREQ_MODE); freq_mode++)
+    {
+      for (value = 250; !fail && (value < 4000000000UL); value += value/256 + 1)
+      {
+        fail = test_channel_b(medium_cal, freq_mode, value, rand() % 360, rand() % 1001);
+      }
+    }
+  }
+
+  /* Linear sweeps against 64-bit arithmetic, and log sweeps against
+     floating point, up and down, from 2 to 256 steps */
+  srand(5);
+  for (i = 0; !fail && (i < 20000UL); i++)
+  {
+    uint32_t start;
+    uint32_t stop;
+
+    start = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) >> (rand() & 31);
+    stop = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) >> (rand() & 31);
+    start = (start % 4000000000UL) + 1;
+    stop = (stop % 4000000000UL) + 1;
+    if (!fail) fail = test_sweep(start, stop, (rand() % 255) + 1, 0);
+    if (!fail) fail = test_sweep(start, stop, (rand() % 255) + 1, 1);
+  }
+  if (!fail) fail = test_sweep(1, 4000000000UL, 255, 1);
+  if (!fail) fail = test_sweep(4000000000UL, 1, 255, 1);
+  if (!fail) fail = test_sweep(1000, 1001, 255, 1);
+
+  /* PLAN_ppm against 64-bit arithmetic */
+  srand(2);
+  for (i = 0; !fail && (i < 1000000UL); i++)
+  {
+    value = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    value >>= rand() & 31;
+    if (value == 0)
+    {
+      value = 1;
+    }
+    fail = test_ppm(value >> (rand() & 31), value);
+  }
+
+  return fail;
+}
+
+int test_div(uint32_t n, uint32_t d)
+{
+  uint32_t actual;
+
+  actual = PLAN_div(n, d);
+  if (actual != n / d)
+  {
+    printf("FAIL: PLAN_div(%u, %u), expected %u, got %u\n", n, d, n / d, actual);
+    return 1;
+  }
+  return 0;
+}
+
+int test_timer(int8_t medium_cal, int8_t fine_cal, uint8_t freq_mode, uint32_t value, uint8_t duty_cycle)
+{
+  PLAN_timer_t expected;
+  PLAN_timer_t actual;
+  uint32_t f_cpu;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal + 32L*fine_cal);
+  plan_ref(&expected, f_cpu, freq_mode, value, duty_cycle);
+  PLAN_set_f_cpu(f_cpu);
+  PLAN_timer(&actual, freq_mode, value, duty_cycle * 10);
+
+  if ((actual.clock_select != expected.clock_select) ||
+      (actual.top != expected.top) ||
+      (actual.compare != expected.compare) ||
+      (actual.period_ns != expected.period_ns) ||
+      (actual.freq_mHz != expected.freq_mHz))
+  {
+    printf("FAIL: f_cpu=%u, mode=%u, value=%u, duty=%u, "
+           "expected %u/%u/%u/%u/%u, got %u/%u/%u/%u/%u\n",
+           f_cpu, freq_mode, value, duty_cycle,
+           expected.clock_select, expected.top, expected.compare, expected.period_ns, expected.freq_mHz,
+           actual.clock_select, actual.top, actual.compare, actual.period_ns, actual.freq_mHz);
+    return 1;
+  }
+  return 0;
+}
+
+/* Ideal cycle length in 1/64ths of a clock, as the planner works it out */
+static uint64_t ideal_clocks(uint32_t f_cpu, uint8_t freq_mode, uint32_t value)
+{
+  uint64_t n;
+
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    n = (1000000000UL + f_cpu/2) / f_cpu;
+    return ((uint64_t)value * 64 + n/2) / n;
+  }
+  return (64000ULL * f_cpu + value/2) / value;
+}
+
+int test_search(int8_t medium_cal, uint8_t freq_mode, uint32_t value)
+{
+  static const uint8_t shifts[5] = { 0, 3, 6, 8, 10 };
+  PLAN_search_t actual;
+  uint32_t f_cpu;
+  uint64_t ideal;
+  uint64_t clocks;
+  uint64_t error;
+  uint64_t best_error = UINT64_MAX;
+  uint64_t actual_error;
+  uint8_t best_bits = 0;
+  uint8_t bits;
+  uint8_t i;
+  uint32_t pc;
+  int k;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal);
+  ideal = ideal_clocks(f_cpu, freq_mode, value);
+
+  /* Every prescaler, table length and ICR1 either side of the ideal */
+  for (bits = OUT_MIN_WAVEFORM_LENGTH_BITS; bits <= OUT_MAX_WAVEFORM_LENGTH_BITS; bits++)
+  {
+    for (i = 0; i < 5; i++)
+    {
+      for (k = 0; k < 2; k++)
+      {
+        pc = (uint32_t)(ideal >> (shifts[i] + bits + 6)) + k;
+        if ((pc < 2) || (pc > 65536) ||
+            ((bits > OUT_MIN_WAVEFORM_LENGTH_BITS) && ((pc << shifts[i]) < OUT_MIN_SAMPLE_CLOCKS)))
+        {
+          continue;
+        }
+        clocks = (uint64_t)pc << (shifts[i] + bits + 6);
+        error = (clocks > ideal) ? clocks - ideal : ideal - clocks;
+        if ((error < best_error) || ((error == best_error) && (bits > best_bits)))
+        {
+          best_error = error;
+          best_bits = bits;
+        }
+      }
+    }
+  }
+
+  PLAN_set_f_cpu(f_cpu);
+  PLAN_search(&actual, freq_mode, value, 500, OUT_MIN_WAVEFORM_LENGTH_BITS, OUT_MAX_WAVEFORM_LENGTH_BITS);
+  clocks = ((uint64_t)actual.timer.top + 1) << (shifts[actual.timer.clock_select - 1] + actual.table_length_bits + 6);
+  actual_error = (clocks > ideal) ? clocks - ideal : ideal - clocks;
+
+  if ((actual_error != best_error) ||
+      (actual.table_length_bits != best_bits) ||
+      (actual.period_ns != actual.timer.period_ns << actual.table_length_bits) ||
+      (actual.freq_mHz != (uint32_t)((1000ULL * f_cpu * 64 + clocks/2) / clocks)))
+  {
+    printf("FAIL: PLAN_search f_cpu=%u, mode=%u, value=%u, "
+           "expected error %llu with %u bits, got %llu with %u bits, %u ns, %u mHz\n",
+           f_cpu, freq_mode, value, (unsigned long long)best_error, best_bits,
+           (unsigned long long)actual_error, actual.table_length_bits,
+           actual.period_ns, actual.freq_mHz);
+    return 1;
+  }
+  return 0;
+}
+
+int test_compare(uint16_t top, uint16_t duty_cycle)
+{
+  uint32_t expected;
+  uint16_t actual;
+
+  expected = (((uint32_t)top + 1) * duty_cycle + 500) / 1000;
+  if (expected > 0)
+  {
+    expected--;
+  }
+  actual = PLAN_compare(top, duty_cycle);
+  if (actual != expected)
+  {
+    printf("FAIL: PLAN_compare(%u, %u), expected %u, got %u\n", top, duty_cycle, expected, actual);
+    return 1;
+  }
+  return 0;
+}
+
+int test_postscale(int8_t medium_cal, uint32_t value, uint16_t duty_cycle)
+{
+  PLAN_postscale_t actual;
+  uint32_t f_cpu;
+  uint64_t ticks;
+  uint64_t part_ticks[2];
+  uint64_t freq;
+  uint8_t result;
+  uint8_t part;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal);
+  PLAN_set_f_cpu(f_cpu);
+  result = PLAN_postscale(&actual, value, duty_cycle);
+
+  /* Cycle in clocks of the 1024 prescaler */
+  ticks = (1000ULL * f_cpu + 512 * value) / (1024 * value);
+  if (ticks <= 65536)
+  {
+    if (result != 0)
+    {
+      printf("FAIL: PLAN_postscale f_cpu=%u, value=%u should be left to PLAN_timer\n", f_cpu, value);
+      return 1;
+    }
+    return 0;
+  }
+
+  part_ticks[1] = (ticks * duty_cycle + 500) / 1000;
+  part_ticks[0] = ticks - part_ticks[1];
+  freq = (1000ULL * f_cpu + 512 * ticks) / (1024 * ticks);
+  if ((result != 1) ||
+      (actual.period_ns != 0xFFFFFFFFUL) ||
+      (actual.freq_mHz + 1 < freq) || (actual.freq_mHz > freq + 1))
+  {
+    printf("FAIL: PLAN_postscale f_cpu=%u, value=%u, got %u, %u ns, %u mHz\n",
+           f_cpu, value, result, actual.period_ns, actual.freq_mHz);
+    return 1;
+  }
+
+  /* Each part is as few periods as fit in 16 bits, as even as they go */
+  for (part = 0; part < 2; part++)
+  {
+    if ((actual.periods[part] != (part_ticks[part] + 0xFFFF) >> 16) ||
+        ((uint64_t)actual.periods[part] * ((uint64_t)actual.top[part] + 1) + actual.longer[part] != part_ticks[part]) ||
+        ((actual.periods[part] != 0) && (actual.longer[part] >= actual.periods[part])) ||
+        ((actual.longer[part] != 0) && (actual.top[part] == 0xFFFF)))
+    {
+      printf("FAIL: PLAN_postscale f_cpu=%u, value=%u, duty=%u, part %u of %llu clocks, "
+             "got %u periods, top %u, %u longer\n",
+             f_cpu, value, duty_cycle, part, (unsigned long long)part_ticks[part],
+             actual.periods[part], actual.top[part], actual.longer[part]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int test_pulse(int8_t medium_cal, uint8_t freq_mode, uint32_t value, uint32_t width_ns)
+{
+  static const uint8_t shifts[5] = { 0, 3, 6, 8, 10 };
+  PLAN_timer_t expected;
+  PLAN_timer_t actual;
+  uint32_t f_cpu;
+  uint32_t actual_width_ns;
+  uint64_t n;
+  uint64_t width;
+  uint8_t shift;
+  uint8_t fits;
+  uint8_t expected_fits = 1;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal);
+  PLAN_set_f_cpu(f_cpu);
+  PLAN_timer(&expected, freq_mode, value, 0);
+  fits = PLAN_pulse(&actual, freq_mode, value, width_ns, &actual_width_ns);
+
+  /* The period is PLAN_timer's, and the width in the same prescaled clocks */
+  shift = shifts[expected.clock_select - 1];
+  n = (1000000000UL + f_cpu/2) / f_cpu;
+  width = ((uint64_t)width_ns + n/2) / n;
+  width = (width + ((1U << shift) >> 1)) >> shift;
+  if (width == 0)
+  {
+    width = 1;
+    expected_fits = 0;
+  }
+  if (width > expected.top)
+  {
+    width = expected.top;
+    expected_fits = 0;
+  }
+
+  if ((actual.clock_select != expected.clock_select) ||
+      (actual.top != expected.top) ||
+      (actual.period_ns != expected.period_ns) ||
+      (actual.compare != width - 1) ||
+      (actual.compare_b != actual.compare) ||
+      (actual_width_ns != (uint32_t)((width << shift) * n)) ||
+      (fits != expected_fits))
+  {
+    printf("FAIL: PLAN_pulse f_cpu=%u, mode=%u, value=%u, width=%u, "
+           "expected %llu clocks, got %u/%u/%u, %u ns, fits %u\n",
+           f_cpu, freq_mode, value, width_ns, (unsigned long long)width,
+           actual.clock_select, actual.top, actual.compare, actual_width_ns, fits);
+    return 1;
+  }
+  return 0;
+}
+
+int test_channel_b(int8_t medium_cal, uint8_t freq_mode, uint32_t value, uint16_t phase, uint16_t duty_cycle)
+{
+  static const uint8_t shifts[5] = { 0, 3, 6, 8, 10 };
+  PLAN_timer_t off;
+  PLAN_timer_t in_phase;
+  PLAN_timer_t toggle;
+  uint32_t f_cpu;
+  uint64_t ideal;
+  uint64_t clocks;
+  uint64_t error;
+  uint32_t lag;
+  uint16_t modulo;
+  uint8_t shift;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal);
+  PLAN_set_f_cpu(f_cpu);
+  PLAN_set_channel_b(OUT_CHANNEL_B_OFF, phase, duty_cycle);
+  PLAN_timer(&off, freq_mode, value, 500);
+  PLAN_set_channel_b(OUT_CHANNEL_B_IN_PHASE, phase, duty_cycle);
+  PLAN_timer(&in_phase, freq_mode, value, 500);
+  PLAN_set_channel_b(OUT_CHANNEL_B_PHASE, phase, duty_cycle);
+  PLAN_timer(&toggle, freq_mode, value, 500);
+  PLAN_set_channel_b(OUT_CHANNEL_B_OFF, 0, 0);
+
+  /* Off, OC1B follows OC1A; in phase, only its compare is its own */
+  if ((off.compare_b != off.compare) ||
+      (in_phase.clock_select != off.clock_select) ||
+      (in_phase.top != off.top) ||
+      (in_phase.compare != off.compare) ||
+      (in_phase.compare_b != PLAN_compare(off.top, duty_cycle)) ||
+      (in_phase.freq_mHz != off.freq_mHz))
+  {
+    printf("FAIL: PLAN_timer channel B in phase f_cpu=%u, mode=%u, value=%u, duty=%u, got %u/%u/%u\n",
+           f_cpu, freq_mode, value, duty_cycle, in_phase.top, in_phase.compare, in_phase.compare_b);
+    return 1;
+  }
+
+  /* Toggling, a cycle is two timer periods. Converting to clocks, halving
+     and prescaling each round it, to within a prescaled clock plus
+     a clock and a half overall. */
+  shift = shifts[toggle.clock_select - 1];
+  clocks = ((uint64_t)toggle.top + 1) << (shift + 1);
+  ideal = ideal_clocks(f_cpu, freq_mode, value);
+  error = (clocks * 64 > ideal) ? clocks * 64 - ideal : ideal - clocks * 64;
+  modulo = phase % 180;
+  if (modulo == 0)
+  {
+    modulo = 180;
+  }
+  lag = (uint32_t)((((uint64_t)toggle.top + 1) * modulo + 90) / 180);
+  if (lag == 0)
+  {
+    lag = 1;
+  }
+  if ((toggle.compare != toggle.top) ||
+      (toggle.compare_b + 1U != lag) ||
+      ((toggle.top > 1) && (error > (64ULL << shift) + 96)) ||
+      (toggle.freq_mHz != (uint32_t)((1000ULL * f_cpu + clocks/2) / clocks)))
+  {
+    printf("FAIL: PLAN_timer channel B toggling f_cpu=%u, mode=%u, value=%u, phase=%u, "
+           "got %u/%u/%u/%u, %u mHz\n",
+           f_cpu, freq_mode, value, phase, toggle.clock_select, toggle.top,
+           toggle.compare, toggle.compare_b, toggle.freq_mHz);
+    return 1;
+  }
+  return 0;
+}
+
+int test_sweep(uint32_t start, uint32_t stop, uint8_t last_step, uint8_t log)
+{
+  uint16_t step;
+  uint32_t actual;
+  uint32_t previous;
+  double expected;
+  double error;
+
+  previous = start;
+  for (step = 0; step <= last_step; step++)
+  {
+    actual = PLAN_sweep_value(start, stop, step, last_step, log);
+    if (step == 0)
+    {
+      expected = start;
+    }
+    else if (step == last_step)
+    {
+      expected = stop;
+    }
+    else if (log)
+    {
+      expected = start * pow((double)stop / start, (double)step / last_step);
+    }
+    else if (stop >= start)
+    {
+      expected = start + (uint64_t)(stop - start) * step / last_step;
+    }
+    else
+    {
+      expected = start - (uint64_t)(start - stop) * step / last_step;
+    }
+
+    /* Log steps are within 100 ppm or, for small values, the rounding;
+       linear steps and the ends are exact, and no step goes backwards */
+    error = fabs(actual - expected);
+    if ((log ? ((error > expected * 100e-6) && (error > 0.5 + expected * 20e-6)) :
+               (actual != expected)) ||
+        (((step == 0) || (step == last_step)) && (actual != expected)) ||
+        ((stop >= start) ? (actual < previous) : (actual > previous)))
+    {
+      printf("FAIL: PLAN_sweep_value(%u, %u, %u, %u, %u), expected %.1f, got %u\n",
+             start, stop, step, last_step, log, expected, actual);
+      return 1;
+    }
+    previous = actual;
+  }
+  return 0;
+}
+
+int test_ppm(uint32_t error, uint32_t value)
+{
+  uint64_t expected;
+  uint16_t actual;
+
+  expected = (uint64_t)error * 1000000 / value;
+  if (expected > 0xFFFF)
+  {
+    expected = 0xFFFF;
+  }
+  actual = PLAN_ppm(error, value);
+
+  /* Rounding down the binary fraction can lose 1 ppm,
+     and beyond 62500 ppm it saturates early */
+  if ((actual != expected) && (actual + 1 != expected) &&
+      !((actual == 0xFFFF) && (expected >= 62500)))
+  {
+    printf("FAIL: PLAN_ppm(%u, %u), expected %llu, got %u\n",
+           error, value, (unsigned long long)expected, actual);
+    return 1;
+  }
+  return 0;
+}
+
+int test_dither(int8_t medium_cal, uint8_t freq_mode, uint32_t value)
+{
+  PLAN_timer_t expected;
+  PLAN_timer_t actual;
+  uint32_t f_cpu;
+  uint64_t ideal;
+  uint64_t n;
+  uint16_t fraction;
+
+  f_cpu = (uint32_t)((int32_t)F_CPU + 2048L*medium_cal);
+  PLAN_set_f_cpu(f_cpu);
+  PLAN_timer(&expected, freq_mode, value, 500);
+  fraction = PLAN_dither(&actual, freq_mode, value, 500);
+
+  /* Period in 1/65536ths of a clock */
+  if (freq_mode == OUT_PERIOD_MODE)
+  {
+    n = (1000000000UL + f_cpu/2) / f_cpu;
+    ideal = ((uint64_t)value * 65536 + n/2) / n;
+  }
+  else
+  {
+    ideal = (65536000ULL * f_cpu + value/2) / value;
+  }
+
+  if ((expected.clock_select != 1) || ((ideal >> 16) < OUT_DITHER_MIN_CLOCKS))
+  {
+    /* Not dithered */
+    if ((fraction != 0) ||
+        (actual.clock_select != expected.clock_select) ||
+        (actual.top != expected.top) ||
+        (actual.period_ns != expected.period_ns) ||
+        (actual.freq_mHz != expected.freq_mHz))
+    {
+      printf("FAIL: PLAN_dither f_cpu=%u, mode=%u, value=%u should be as PLAN_timer\n",
+             f_cpu, freq_mode, value);
+      return 1;
+    }
+    return 0;
+  }
+
+  /* The average period is (top + 1 + fraction / 65536) clocks,
+     and the reported period and frequency are the average ones */
+  if ((actual.clock_select != 1) ||
+      ((uint32_t)actual.top + 1 != (uint32_t)(ideal >> 16)) ||
+      (fraction != (uint16_t)ideal) ||
+      (llabs((int64_t)actual.freq_mHz - (int64_t)((65536000ULL * f_cpu + ideal/2) / ideal)) > 0) ||
+      (llabs((int64_t)actual.period_ns - (int64_t)(ideal * ((1000000000UL + f_cpu/2) / f_cpu) >> 16)) > 1))
+  {
+    printf("FAIL: PLAN_dither f_cpu=%u, mode=%u, value=%u, "
+           "expected %llu + %llu/65536 clocks, got %u + %u/65536, %u ns, %u mHz\n",
+           f_cpu, freq_mode, value, (unsigned long long)(ideal >> 16), (unsigned long long)(ideal & 0xFFFF),
+           actual.top + 1, fraction, actual.period_ns, actual.freq_mHz);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,572 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "plan.h"
+#include "retune.h"
+
+/* Runs retune.c against a cycle-counting model of Timer1 in fast PWM
+   mode 14 and traces OC1A through random retunes, checking that every
+   period and pulse is one the old or the new settings would make.
+   Register accesses take 1 to 3 cycles each, and the input capture
+   interrupt runs 4 to 160 cycles after its flag is set, as when another
+   interrupt is in progress. */
+
+void TIMER1_CAPT_vect(void);
+
+#define ISR_LATENCY_MIN 4
+#define ISR_LATENCY_MAX 160
+
+static const uint16_t prescaler[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+// The model
+static uint64_t now;
+static uint16_t prescaler_count;  // free running, reset by PSR10
+static uint8_t tccr1b;
+static uint8_t tifr;
+static uint8_t timsk;
+static uint16_t tcnt;
+static uint16_t icr;
+static uint16_t ocr1a;            // in use since the last TOP
+static uint16_t ocr1a_buffer;
+static uint16_t ocr1b;
+static uint8_t interrupts_enabled;
+static uint8_t flag_at_top;       // set ICF1 as the counter reaches TOP rather than as it leaves it
+static uint8_t output;
+static uint32_t runaways;         // times the counter ran past TOP to 0xFFFF
+
+// The trace
+typedef struct
+{
+  uint32_t period;
+  uint32_t high;
+  uint8_t clock_select;
+} setting_t;
+
+#define MAX_ALLOWED 4
+static setting_t allowed[MAX_ALLOWED];
+static int allowed_count;
+static uint8_t checking;
+static uint64_t last_rise;
+static uint64_t last_fall;
+static uint32_t periods_checked;
+static uint32_t violations;
+static uint8_t quiet;             // don't report violations
+static char failure[200];         // the first violation in a retune
+static uint64_t longest_blocked;  // the longest a set call kept interrupts disabled
+static uint64_t longest_isr;      // the longest the capture interrupt took
+
+static void check(uint32_t period, uint32_t high);
+
+static void skip(uint32_t cycles)
+{
+  now += cycles;
+  prescaler_count = (uint16_t)((prescaler_count + cycles) & 1023);
+}
+
+static void rise(void)
+{
+  if (!output)
+  {
+    if (checking && (last_rise != 0) && (last_fall > last_rise))
+    {
+      check((uint32_t)(now - last_rise), (uint32_t)(last_fall - last_rise));
+    }
+    last_rise = now;
+    output = 1;
+  }
+}
+
+static void fall(void)
+{
+  if (output)
+  {
+    last_fall = now;
+    output = 0;
+  }
+}
+
+static void tick(void)
+{
+  if (tcnt == icr)
+  {
+    if (!flag_at_top)
+    {
+      tifr |= 1<<ICF1;
+    }
+    tcnt = 0;
+    ocr1a = ocr1a_buffer;
+    rise();
+  }
+  else if (tcnt == 0xFFFF)
+  {
+    runaways++;
+    tcnt = 0;
+    rise();
+  }
+  else
+  {
+    if (tcnt == ocr1a)
+    {
+      fall();
+    }
+    tcnt++;
+    if (flag_at_top && (tcnt == icr))
+    {
+      tifr |= 1<<ICF1;
+    }
+  }
+}
+
+/* Number of ticks from here that change nothing but the count */
+static uint32_t uneventful_ticks(void)
+{
+  uint32_t ticks = 0xFFFFUL - tcnt;
+
+  if ((ocr1a >= tcnt) && ((uint32_t)(ocr1a - tcnt) < ticks))
+  {
+    ticks = ocr1a - tcnt;
+  }
+  if ((icr >= tcnt) && ((uint32_t)(icr - tcnt) < ticks))
+  {
+    ticks = icr - tcnt;
+  }
+  if (flag_at_top && (icr > tcnt) && ((uint32_t)(icr - 1 - tcnt) < ticks))
+  {
+    ticks = icr - 1 - tcnt;
+  }
+  return ticks;
+}
+
+static uint8_t pending(void)
+{
+  return interrupts_enabled && (timsk & (1<<TICIE1)) && (tifr & (1<<ICF1));
+}
+
+/* Runs the timer for up to cycles clock cycles, stopping early when
+   stop is set and an interrupt becomes pending. Returns the cycles run. */
+static uint32_t advance(uint32_t cycles, uint8_t stop)
+{
+  uint32_t done = 0;
+  uint32_t div;
+  uint32_t to_tick;
+  uint32_t ticks;
+  uint32_t skipped;
+
+  while (done < cycles)
+  {
+    div = prescaler[tccr1b & 7];
+    to_tick = div - (prescaler_count & (div - 1));
+    if ((div == 0) || (to_tick > cycles - done))
+    {
+      skip(cycles - done);
+      return cycles;
+    }
+
+    ticks = (cycles - done - to_tick) / div + 1;
+    skipped = uneventful_ticks();
+    if (skipped > 0)
+    {
+      if (skipped > ticks)
+      {
+        skipped = ticks;
+      }
+      skip(to_tick + (skipped - 1) * div);
+      done += to_tick + (skipped - 1) * div;
+      tcnt = (uint16_t)(tcnt + skipped);
+    }
+    else
+    {
+      skip(to_tick);
+      done += to_tick;
+      tick();
+      if (stop && pending())
+      {
+        return done;
+      }
+    }
+  }
+  return done;
+}
+
+static void access(void)
+{
+  advance(1 + rand() % 3, 0);
+}
+
+uint16_t sim_read(uint8_t reg)
+{
+  access();
+  switch (reg)
+  {
+    case SIM_TCCR1B: return tccr1b;
+    case SIM_TCNT1:  return tcnt;
+    case SIM_ICR1:   return icr;
+    case SIM_OCR1A:  return ocr1a_buffer;
+    case SIM_OCR1B:  return ocr1b;
+    case SIM_TIFR:   return tifr;
+    case SIM_TIMSK:  return timsk;
+  }
+  return 0;
+}
+
+void sim_write(uint8_t reg, uint16_t value)
+{
+  access();
+  switch (reg)
+  {
+    case SIM_TCCR1B: tccr1b = (uint8_t)value; break;
+    case SIM_TCNT1:  tcnt = value; break;
+    case SIM_ICR1:   icr = value; break;
+    case SIM_OCR1A:  ocr1a_buffer = value; break;
+    case SIM_OCR1B:  ocr1b = value; break;
+    case SIM_TIFR:   tifr &= (uint8_t)~value; break;
+    case SIM_TIMSK:  timsk = (uint8_t)value; break;
+    case SIM_SFIOR:
+      if (value & (1<<PSR10))
+      {
+        prescaler_count = 0;
+      }
+      break;
+  }
+}
+
+void sim_cli(void)
+{
+  advance(1, 0);
+  interrupts_enabled = 0;
+}
+
+void sim_sei(void)
+{
+  advance(1, 0);
+  interrupts_enabled = 1;
+}
+
+/* The main loop with interrupts enabled, for about cycles clock cycles */
+static void idle(uint64_t cycles)
+{
+  uint32_t run;
+  uint64_t start;
+
+  while (cycles > 0)
+  {
+    if (pending())
+    {
+      advance(ISR_LATENCY_MIN + rand() % (ISR_LATENCY_MAX - ISR_LATENCY_MIN + 1), 0);
+      tifr &= ~(1<<ICF1);
+      interrupts_enabled = 0;
+      start = now;
+      TIMER1_CAPT_vect();
+      if (now - start > longest_isr)
+      {
+        longest_isr = now - start;
+      }
+      advance(20, 0);
+      interrupts_enabled = 1;
+    }
+    else
+    {
+      run = (cycles > 0x40000000UL) ? 0x40000000UL : (uint32_t)cycles;
+      cycles -= advance(run, 1);
+    }
+  }
+}
+
+static setting_t setting_of(const PLAN_timer_t* timer)
+{
+  setting_t setting;
+
+  setting.period = ((uint32_t)timer->top + 1) << PLAN_prescaler_shift(timer->clock_select);
+  setting.high = ((uint32_t)timer->compare + 1) << PLAN_prescaler_shift(timer->clock_select);
+  setting.clock_select = timer->clock_select;
+  return setting;
+}
+
+static void check(uint32_t period, uint32_t high)
+{
+  int i;
+  int n;
+  int ok = 0;
+  uint32_t tolerance = 0;
+  uint32_t min_period = 0xFFFFFFFFUL;
+  uint32_t max_period = 0;
+  uint32_t min_high = 0xFFFFFFFFUL;
+  uint32_t max_high = 0;
+  uint32_t min_low = 0xFFFFFFFFUL;
+  uint32_t max_low = 0;
+
+  periods_checked++;
+  for (i = 0; i < allowed_count; i++)
+  {
+    if ((allowed[i].period == period) && (allowed[i].high == high))
+    {
+      return;
+    }
+    if ((allowed[i].clock_select != allowed[0].clock_select) ||
+        (prescaler[allowed[i].clock_select] > 8))
+    {
+      /* Restarting the prescaler loses part of a prescaled clock,
+         plus the few cycles the timer is stopped for. Slower than /8,
+         the capture interrupt restarts it rather than wait out TOP. */
+      tolerance = 64;
+    }
+  }
+
+  if (tolerance != 0)
+  {
+    for (i = 0; i < allowed_count; i++)
+    {
+      if (prescaler[allowed[i].clock_select] > tolerance - 64)
+      {
+        tolerance = prescaler[allowed[i].clock_select] + 64;
+      }
+      if (allowed[i].period < min_period) min_period = allowed[i].period;
+      if (allowed[i].period > max_period) max_period = allowed[i].period;
+      if (allowed[i].high < min_high) min_high = allowed[i].high;
+      if (allowed[i].high > max_high) max_high = allowed[i].high;
+      if (allowed[i].period - allowed[i].high < min_low) min_low = allowed[i].period - allowed[i].high;
+      if (allowed[i].period - allowed[i].high > max_low) max_low = allowed[i].period - allowed[i].high;
+    }
+    ok = (period + tolerance >= min_period) && (period <= max_period + tolerance) &&
+         (high + tolerance >= min_high) && (high <= max_high + tolerance) &&
+         (period - high + tolerance >= min_low) && (period - high <= max_low + tolerance);
+  }
+
+  if (!ok)
+  {
+    if (failure[0] == 0)
+    {
+      n = snprintf(failure, sizeof(failure), "FAIL: period %u high %u, expected", period, high);
+      for (i = 0; i < allowed_count; i++)
+      {
+        n += snprintf(failure + n, sizeof(failure) - n, " %u/%u", allowed[i].period, allowed[i].high);
+      }
+      snprintf(failure + n, sizeof(failure) - n, " (tolerance %u)", tolerance);
+    }
+    violations++;
+  }
+}
+
+static PLAN_timer_t random_timer(void)
+{
+  PLAN_timer_t timer;
+  uint8_t bits;
+  uint32_t period_clocks;
+
+  /* Log-uniform from 64 clocks to 2^26, which takes /1024 */
+  bits = (uint8_t)(6 + rand() % 20);
+  period_clocks = (1UL << bits) + (((uint32_t)rand() << 8) ^ (uint32_t)rand()) % (1UL << bits);
+
+  timer.clock_select = 1;
+  while ((period_clocks >> PLAN_prescaler_shift(timer.clock_select)) > 65536UL)
+  {
+    timer.clock_select++;
+  }
+  timer.top = (uint16_t)((period_clocks >> PLAN_prescaler_shift(timer.clock_select)) - 1);
+  timer.compare = (uint16_t)(rand() % timer.top);
+  timer.compare_b = timer.compare;
+  return timer;
+}
+
+/* What OUT_recompute_actual did before retune.c */
+static uint8_t restart(const PLAN_timer_t* timer)
+{
+  TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
+  TCCR1B |= timer->clock_select << CS10;
+  OCR1A = 0;
+  ICR1 = timer->top;
+  TCNT1 = 0;
+  OCR1A = timer->compare;
+  sei();
+  return 1;
+}
+
+/* The capture interrupt only waits out TOP up to /8, so it never holds
+   interrupts off for a slow prescaled clock */
+static int check_isr(void)
+{
+  if (longest_isr > 100)
+  {
+    printf("FAIL: capture interrupt took %u clocks\n", (uint32_t)longest_isr);
+    return 1;
+  }
+  return 0;
+}
+
+static uint8_t retune(const PLAN_timer_t* timer);
+static uint8_t retune_async(const PLAN_timer_t* timer);
+
+/* Calls set, keeping track of how long it keeps interrupts disabled */
+static uint8_t timed_set(uint8_t (*set)(const PLAN_timer_t*), const PLAN_timer_t* timer)
+{
+  uint64_t start = now;
+  uint8_t glitch_free = set(timer);
+
+  if (now - start > longest_blocked)
+  {
+    longest_blocked = now - start;
+  }
+  return glitch_free;
+}
+
+/* Runs retunes through set_timer, returning the number of violations */
+static uint32_t run(uint32_t retunes, uint8_t (*set_timer)(const PLAN_timer_t*))
+{
+  uint32_t i;
+  uint32_t restarts = 0;
+  uint32_t queued = 0;
+  uint32_t duty_changes = 0;
+  uint64_t longest;
+  PLAN_timer_t timer;
+  PLAN_timer_t next;
+  uint8_t glitch_free;
+  uint32_t before;
+  uint32_t reported = 0;
+  int k;
+
+  periods_checked = 0;
+  violations = 0;
+  runaways = 0;
+  longest_blocked = 0;
+  longest_isr = 0;
+
+  /* Start from a stopped timer, as after reset */
+  tccr1b = 0;
+  timer = random_timer();
+  cli();
+  timed_set(set_timer, &timer);
+  idle(3 * (uint64_t)setting_of(&timer).period);
+
+  for (i = 0; i < retunes; i++)
+  {
+    allowed[0] = setting_of(&timer);
+    allowed_count = 1;
+    longest = allowed[0].period;
+
+    /* Restarting the timer does glitch, so a change that had to
+       doesn't count */
+    before = violations;
+    failure[0] = 0;
+    next = random_timer();
+    allowed[allowed_count++] = setting_of(&next);
+    checking = 1;
+    cli();
+    glitch_free = timed_set(set_timer, &next);
+
+    if ((rand() & 3) == 0)
+    {
+      /* Another change before this one is through */
+      idle(rand() % allowed[0].period);
+      next = random_timer();
+      allowed[allowed_count++] = setting_of(&next);
+      cli();
+      glitch_free &= timed_set(set_timer, &next);
+      queued++;
+    }
+
+    if ((set_timer == retune) && ((rand() & 3) == 0))
+    {
+      /* A new duty cycle, possibly while the retune is under way */
+      idle(rand() % allowed[0].period);
+      next.compare = (uint16_t)(rand() % next.top);
+      allowed[allowed_count++] = setting_of(&next);
+      cli();
+      glitch_free &= RETUNE_set_compare(next.compare);
+      duty_changes++;
+    }
+
+    if (!glitch_free)
+    {
+      checking = 0;
+      violations = before;
+      restarts++;
+    }
+    for (k = 0; k < allowed_count; k++)
+    {
+      if (allowed[k].period > longest)
+      {
+        longest = allowed[k].period;
+      }
+    }
+    idle(4 * longest + (uint32_t)(((uint32_t)rand() << 8) ^ (uint32_t)rand()) % allowed[allowed_count - 1].period);
+    if ((violations > before) && !quiet && (reported++ < 10))
+    {
+      printf("%s\n", failure);
+    }
+    timer = next;
+  }
+  checking = 0;
+
+  printf("  %u retunes, %u with another queued, %u with a new compare, %u restarted,\n"
+         "  %u periods checked, %u wrong, %u ran past TOP, interrupts disabled for up to %u clocks\n"
+         "  in the set calls and %u in the capture interrupt\n",
+         retunes, queued, duty_changes, restarts, periods_checked, violations, runaways,
+         (uint32_t)longest_blocked, (uint32_t)longest_isr);
+  return violations + runaways;
+}
+
+static uint8_t retune(const PLAN_timer_t* timer)
+{
+  return RETUNE_set(timer, 0);
+}
+
+static uint8_t retune_async(const PLAN_timer_t* timer)
+{
+  return RETUNE_set_async(timer, 0);
+}
+
+int main(void)
+{
+  int fail = 0;
+
+  srand(1);
+  for (flag_at_top = 0; flag_at_top <= 1; flag_at_top++)
+  {
+    printf("RETUNE_set, input capture flag set %s TOP:\n", flag_at_top ? "reaching" : "leaving");
+    if (run(20000, retune) != 0)
+    {
+      fail = 1;
+    }
+    /* Polling waits for up to two short periods, plus its own cycles */
+    if (longest_blocked > 2 * RETUNE_SYNC_MAX_CLOCKS + 64)
+    {
+      printf("FAIL: interrupts disabled for %u clocks\n", (uint32_t)longest_blocked);
+      fail = 1;
+    }    if (check_isr() != 0)
+    {
+      fail = 1;
+    }
+  }
+
+  /* Never polling, it only keeps interrupts disabled for its own cycles */
+  printf("RETUNE_set_async:\n");
+  flag_at_top = 0;
+  if (run(20000, retune_async) != 0)
+  {
+    fail = 1;
+  }
+  if (longest_blocked > 64)
+  {
+    printf("FAIL: interrupts disabled for %u clocks\n", (uint32_t)longest_blocked);
+    fail = 1;
+  }
+  if (check_isr() != 0)
+  {
+    fail = 1;
+  }
+
+  /* The check has to catch the glitches from restarting the timer */
+  printf("Restarting the timer:\n");
+  flag_at_top = 0;
+  quiet = 1;
+  if (run(2000, restart) == 0)
+  {
+    printf("FAIL: no glitches seen when restarting the timer\n");
+    fail = 1;
+  }
+  return fail;
+}
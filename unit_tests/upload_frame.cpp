@@ -0,0 +1,226 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "out.h"
+#include "upload.h"
+
+/* Feeds upload.c's receive interrupt byte by byte, with the 50 Hz tick
+   in between where a test wants a gap, and checks which frames make it
+   to OUT_set_arbitrary: the start byte, the length byte, the checksum,
+   a receive error, and a gap of UPLOAD_GAP_TICKS, which ends a frame
+   whether it's whole or not. */
+
+void USART_RXC_vect(void);
+
+#define LENGTH (1 << OUT_MAX_WAVEFORM_LENGTH_BITS)
+#define FRAME_LENGTH (LENGTH + 3)
+
+// The registers
+static uint8_t ucsra;
+static uint8_t ucsrb;
+static uint8_t udr;
+static uint8_t ddrd;
+
+// What reached OUT_set_arbitrary
+static int8_t arbitrary[LENGTH];
+static int set_count;
+
+static int failures;
+
+uint16_t sim_read(uint8_t reg)
+{
+  switch (reg)
+  {
+    case SIM_UCSRA: return ucsra;
+    case SIM_UCSRB: return ucsrb;
+    case SIM_UDR:   return udr;
+    case SIM_DDRD:  return ddrd;
+  }
+  return 0;
+}
+
+void sim_write(uint8_t reg, uint16_t value)
+{
+  switch (reg)
+  {
+    case SIM_UCSRB: ucsrb = (uint8_t)value; break;
+    case SIM_DDRD:  ddrd = (uint8_t)value; break;
+  }
+}
+
+void sim_cli(void)
+{
+}
+
+void sim_sei(void)
+{
+}
+
+void OUT_set_arbitrary(const int8_t* samples)
+{
+  memcpy(arbitrary, samples, sizeof(arbitrary));
+  set_count++;
+}
+
+static void receive(uint8_t data, uint8_t errors)
+{
+  udr = data;
+  ucsra = errors;
+  USART_RXC_vect();
+}
+
+static void gap(uint8_t ticks)
+{
+  while (ticks-- > 0)
+  {
+    UPLOAD_tick();
+  }
+}
+
+/* A whole frame of a ramp from first, as send_wave.pl sends it */
+static void make_frame(uint8_t* frame, int8_t first)
+{
+  uint8_t checksum = 0xAA;
+  uint16_t i;
+
+  frame[0] = UPLOAD_START;
+  frame[1] = OUT_MAX_WAVEFORM_LENGTH_BITS;
+  for (i = 0; i < LENGTH; i++)
+  {
+    frame[2 + i] = (uint8_t)(int8_t)(first + i);
+    checksum += frame[2 + i];
+  }
+  frame[FRAME_LENGTH - 1] = checksum;
+}
+
+static void send(const uint8_t* frame, uint16_t count)
+{
+  uint16_t i;
+
+  for (i = 0; i < count; i++)
+  {
+    receive(frame[i], 0);
+  }
+}
+
+static void check(const char* name, int ok)
+{
+  if (!ok)
+  {
+    printf("FAIL: %s\n", name);
+    failures++;
+  }
+}
+
+/* Sends frame, or count bytes of it, then the gap that ends it, and
+   checks whether it got through and the status it left */
+static void expect(const char* name, const uint8_t* frame, uint16_t count, int taken, uint8_t status)
+{
+  int before = set_count;
+
+  send(frame, count);
+  UPLOAD_cyclic();
+  gap(UPLOAD_GAP_TICKS);
+  UPLOAD_cyclic();
+  check(name, (set_count - before == taken) && (UPLOAD_get_status() == status));
+  if (taken)
+  {
+    check(name, memcmp(arbitrary, frame + 2, LENGTH) == 0);
+  }
+}
+
+int main(void)
+{
+  uint8_t frame[FRAME_LENGTH];
+  uint8_t bad[FRAME_LENGTH];
+  uint16_t i;
+  int before;
+
+  UPLOAD_init();
+
+  /* Not while PD0 is a DAC line */
+  ddrd = 1<<PD0;
+  UPLOAD_cyclic();
+  check("off while PD0 is an output", UPLOAD_get_status() == UPLOAD_OFF);
+
+  ddrd = 0;
+  UPLOAD_cyclic();
+  check("listening once PD0 is an input", UPLOAD_get_status() == UPLOAD_IDLE);
+
+  make_frame(frame, -64);
+  expect("whole frame", frame, FRAME_LENGTH, 1, UPLOAD_DONE);
+
+  memcpy(bad, frame, sizeof(bad));
+  bad[0] = UPLOAD_START + 1;
+  expect("wrong start byte", bad, FRAME_LENGTH, 0, UPLOAD_FAILED);
+
+  memcpy(bad, frame, sizeof(bad));
+  bad[1] = OUT_MAX_WAVEFORM_LENGTH_BITS - 1;
+  expect("wrong length byte", bad, FRAME_LENGTH, 0, UPLOAD_FAILED);
+
+  memcpy(bad, frame, sizeof(bad));
+  bad[FRAME_LENGTH - 1]++;
+  expect("wrong checksum", bad, FRAME_LENGTH, 0, UPLOAD_FAILED);
+
+  memcpy(bad, frame, sizeof(bad));
+  bad[10]++;
+  expect("sample changed in transit", bad, FRAME_LENGTH, 0, UPLOAD_FAILED);
+
+  expect("cut short", frame, FRAME_LENGTH / 2, 0, UPLOAD_FAILED);
+
+  make_frame(frame, 5);
+  expect("whole frame after failures", frame, FRAME_LENGTH, 1, UPLOAD_DONE);
+
+  /* A receive error anywhere spoils the frame */
+  before = set_count;
+  send(frame, 20);
+  receive(frame[20], 1<<FE);
+  send(frame + 21, FRAME_LENGTH - 21);
+  gap(UPLOAD_GAP_TICKS);
+  UPLOAD_cyclic();
+  check("framing error", (set_count == before) && (UPLOAD_get_status() == UPLOAD_FAILED));
+
+  /* Anything after a whole frame, up to the gap, is ignored */
+  make_frame(frame, -100);
+  before = set_count;
+  send(frame, FRAME_LENGTH);
+  send(frame, FRAME_LENGTH);
+  gap(UPLOAD_GAP_TICKS);
+  UPLOAD_cyclic();
+  check("bytes after a frame", (set_count == before + 1) && (UPLOAD_get_status() == UPLOAD_DONE));
+
+  /* Shorter gaps between bytes don't end the frame */
+  make_frame(frame, 0);
+  before = set_count;
+  for (i = 0; i < FRAME_LENGTH; i++)
+  {
+    receive(frame[i], 0);
+    gap(UPLOAD_GAP_TICKS - 1);
+    if (i == FRAME_LENGTH / 2)
+    {
+      check("percent", UPLOAD_get_percent() == (uint8_t)((uint32_t)(i + 1) * 100 / FRAME_LENGTH));
+      check("receiving", UPLOAD_get_status() == UPLOAD_RECEIVING);
+    }
+  }
+  UPLOAD_cyclic();
+  check("gaps shorter than UPLOAD_GAP_TICKS", set_count == before + 1);
+
+  /* The gap ends a frame the start byte of the next one can't */
+  before = set_count;
+  send(frame, 10);
+  gap(UPLOAD_GAP_TICKS);
+  send(frame, FRAME_LENGTH);
+  UPLOAD_cyclic();
+  check("frame after a cut-off one", set_count == before + 1);
+
+  /* Stopped before PD0 becomes a DAC line */
+  UPLOAD_stop();
+  check("stopped", UPLOAD_get_status() == UPLOAD_OFF);
+
+  printf("upload_frame: %s\n", failures ? "FAIL" : "OK");
+  return failures != 0;
+}
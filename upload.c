@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "out.h"
+#include "upload.h"
+
+#if OUT_UPLOAD
+
+/* The USART shares PD0 (RXD) and PD1 (TXD) with the R-2R DAC, and
+   enabling the receiver takes PD0 over whatever DDRD says. So it only
+   listens while PD0 is an input: with the ladder, while the output is a
+   square wave or pulse; with OUT_PWM_DAC, while it isn't noise. The
+   transmitter is never used. */
+
+#define LENGTH (1 << OUT_MAX_WAVEFORM_LENGTH_BITS)
+
+/* UPLOAD_START, the length in bits, the samples and the checksum */
+#define FRAME_LENGTH (LENGTH + 3)
+
+#define UBRR_VALUE ((F_CPU + 8UL * OUT_UPLOAD_BAUD) / (16UL * OUT_UPLOAD_BAUD) - 1)
+
+// The frame coming in. The receive ISR leaves buffer alone from when a
+// whole frame is in until UPLOAD_cyclic has handed it over.
+static int8_t buffer[LENGTH];
+static volatile uint16_t received;
+static uint8_t checksum;
+static volatile uint8_t frame_ready;
+
+// Non-zero to ignore bytes until the next gap, after the end of a
+// frame or a bad byte
+static volatile uint8_t discarding;
+static volatile uint8_t idle_ticks;
+
+static volatile uint8_t status = UPLOAD_IDLE;
+
+void UPLOAD_init(void)
+{
+  UBRRH = (uint8_t)(UBRR_VALUE >> 8);
+  UBRRL = (uint8_t)UBRR_VALUE;
+  UCSRC = (1<<URSEL)|(1<<UCSZ1)|(1<<UCSZ0);
+}
+
+void UPLOAD_cyclic(void)
+{
+  /* With interrupts disabled, so that a sequence can't take the DAC
+     lines in the UI interrupt between the test and the write */
+  cli();
+  if (!(DDRD & (1<<PD0)) && !(UCSRB & (1<<RXEN)))
+  {
+    UCSRB = (1<<RXCIE)|(1<<RXEN);
+  }
+  sei();
+
+  if (frame_ready)
+  {
+    OUT_set_arbitrary(buffer);
+    status = UPLOAD_DONE;
+    frame_ready = 0;
+  }
+}
+
+void UPLOAD_tick(void)
+{
+  cli();
+  if ((received != 0) && (++idle_ticks >= UPLOAD_GAP_TICKS))
+  {
+    if (!discarding)
+    {
+      /* cut short */
+      status = UPLOAD_FAILED;
+    }
+    received = 0;
+    discarding = 0;
+  }
+  sei();
+}
+
+void UPLOAD_stop(void)
+{
+  UCSRB = 0;
+}
+
+uint8_t UPLOAD_get_status(void)
+{
+  if (!(UCSRB & (1<<RXEN)))
+  {
+    return UPLOAD_OFF;
+  }
+  return status;
+}
+
+uint8_t UPLOAD_get_percent(void)
+{
+  uint16_t n;
+
+  cli();
+  n = received;
+  sei();
+  return (uint8_t)((uint32_t)n * 100 / FRAME_LENGTH);
+}
+
+ISR(USART_RXC_vect)
+{
+  uint8_t errors;
+  uint8_t data;
+  uint8_t bad = 0;
+
+  errors = UCSRA & ((1<<FE)|(1<<DOR));
+  data = UDR;
+  idle_ticks = 0;
+
+  if (discarding || frame_ready)
+  {
+    return;
+  }
+
+  if (errors)
+  {
+    bad = 1;
+  }
+  else if (received == 0)
+  {
+    bad = (data != UPLOAD_START);
+    checksum = 0xAA;
+    status = UPLOAD_RECEIVING;
+  }
+  else if (received == 1)
+  {
+    bad = (data != OUT_MAX_WAVEFORM_LENGTH_BITS);
+  }
+  else if (received < FRAME_LENGTH - 1)
+  {
+    buffer[received - 2] = (int8_t)data;
+    checksum += data;
+  }
+  else
+  {
+    bad = (data != checksum);
+    frame_ready = !bad;
+    discarding = 1;
+  }
+
+  if (bad)
+  {
+    status = UPLOAD_FAILED;
+    discarding = 1;
+  }
+  received++;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __UPLOAD_H_
+#define __UPLOAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Uploading the shape of OUT_ARBITRARY over the USART (OUT_UPLOAD), at
+   OUT_UPLOAD_BAUD, 8 data bits, no parity, 1 stop bit. A frame is
+     UPLOAD_START
+     OUT_MAX_WAVEFORM_LENGTH_BITS
+     2^OUT_MAX_WAVEFORM_LENGTH_BITS samples from -127 to 127, as signed bytes
+     checksum, 0xAA plus the samples, modulo 256
+   sent without a break: a gap of UPLOAD_GAP_TICKS ends it, whole or not.
+   It goes into a buffer of its own, and only to OUT_set_arbitrary once
+   all of it has arrived and checks out, so the output carries on as it
+   was until then. Nothing is sent back, TXD (PD1) being a DAC line;
+   the LCD shows how it went. */
+#define UPLOAD_START 'W'
+
+/* Ticks of UPLOAD_tick, at 50 Hz, without a byte that end a frame */
+#define UPLOAD_GAP_TICKS 5
+
+/* What UPLOAD_get_status returns */
+#define UPLOAD_OFF       0  /* not listening, while PD0 is a DAC line */
+#define UPLOAD_IDLE      1  /* listening, nothing received yet */
+#define UPLOAD_RECEIVING 2
+#define UPLOAD_DONE      3  /* the last frame went to OUT_set_arbitrary */
+#define UPLOAD_FAILED    4  /* the last frame was cut short or didn't check out */
+
+void UPLOAD_init(void);
+
+/* Starts listening whenever PD0 isn't a DAC line, and hands a frame
+   that has come in to OUT_set_arbitrary */
+void UPLOAD_cyclic(void);
+
+/* Called at 50 Hz from the UI interrupt, to time the gaps between bytes */
+void UPLOAD_tick(void);
+
+/* Stops listening, before PD0 becomes a DAC line. Also called from
+   interrupts. */
+void UPLOAD_stop(void);
+
+uint8_t UPLOAD_get_status(void);
+
+/* How much of the frame being received is in, in percent */
+uint8_t UPLOAD_get_percent(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif